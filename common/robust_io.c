@@ -0,0 +1,296 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "robust_io.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * Block until fd is ready for events, after a transfer failed with EAGAIN.
+ * @return 0 when the transfer should be retried, -1 on error
+ */
+static int wait_ready(int fd, short events)
+{
+    struct pollfd pfd = {fd, events, 0};
+    while (poll(&pfd, 1, -1) == -1)
+    {
+        if (errno != EINTR)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Decide whether a failed transfer is worth retrying.
+ * @return true after EINTR, or after EAGAIN once fd is ready again
+ */
+static bool retry(int fd, short events)
+{
+    if (errno == EINTR)
+    {
+        return true;
+    }
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+    {
+        return wait_ready(fd, events) == 0;
+    }
+    return false;
+}
+
+int rio_write_full(int fd, const void* p, size_t len)
+{
+    const char* c = p;
+    while (len > 0)
+    {
+        ssize_t n = write(fd, c, len);
+        if (n < 0)
+        {
+            if (retry(fd, POLLOUT))
+            {
+                continue;
+            }
+            return -1;
+        }
+        c += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+int rio_pwrite_full(int fd, const void* p, size_t len, off_t offset)
+{
+    const char* c = p;
+    while (len > 0)
+    {
+        ssize_t n = pwrite(fd, c, len, offset);
+        if (n < 0)
+        {
+            if (retry(fd, POLLOUT))
+            {
+                continue;
+            }
+            return -1;
+        }
+        c += n;
+        len -= (size_t)n;
+        offset += n;
+    }
+    return 0;
+}
+
+ssize_t rio_read(int fd, void* p, size_t len)
+{
+    for (;;)
+    {
+        ssize_t n = read(fd, p, len);
+        if (n >= 0 || !retry(fd, POLLIN))
+        {
+            return n;
+        }
+    }
+}
+
+ssize_t rio_read_full(int fd, void* p, size_t len)
+{
+    char* c = p;
+    size_t got = 0;
+    while (got < len)
+    {
+        ssize_t n = rio_read(fd, c + got, len - got);
+        if (n < 0)
+        {
+            return -1;
+        }
+        if (n == 0)
+        {
+            break;
+        }
+        got += (size_t)n;
+    }
+    return (ssize_t)got;
+}
+
+ssize_t rio_pread_full(int fd, void* p, size_t len, off_t offset)
+{
+    char* c = p;
+    size_t got = 0;
+    while (got < len)
+    {
+        ssize_t n = pread(fd, c + got, len - got, offset + (off_t)got);
+        if (n < 0)
+        {
+            if (retry(fd, POLLIN))
+            {
+                continue;
+            }
+            return -1;
+        }
+        if (n == 0)
+        {
+            break;
+        }
+        got += (size_t)n;
+    }
+    return (ssize_t)got;
+}
+
+static size_t page_size(void)
+{
+    static size_t page;
+    if (page == 0)
+    {
+        long n = sysconf(_SC_PAGESIZE);
+        page = n > 0 ? (size_t)n : 4096;
+    }
+    return page;
+}
+
+size_t rio_buffer_size(int fd, size_t min)
+{
+    size_t size = min;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_blksize > 0 && (size_t)st.st_blksize > size)
+    {
+        size = (size_t)st.st_blksize;
+    }
+
+    size_t page = page_size();
+    if (size < page)
+    {
+        return page;
+    }
+    return (size + page - 1) / page * page;
+}
+
+void* rio_alloc(size_t size)
+{
+    void* p = NULL;
+    int err = posix_memalign(&p, page_size(), size > 0 ? size : 1);
+    if (err != 0)
+    {
+        errno = err;
+        return NULL;
+    }
+    return p;
+}
+
+void rio_error(const char* what, const char* path)
+{
+    int err = errno;
+    if (path != NULL)
+    {
+        fprintf(stderr, "%s '%s': %s\n", what, path, strerror(err));
+    }
+    else
+    {
+        fprintf(stderr, "%s: %s\n", what, strerror(err));
+    }
+    errno = err;
+}
+
+int rio_writer_init(rio_writer_t* w, int fd, char* buf, size_t cap)
+{
+    w->fd = fd;
+    w->len = 0;
+    w->err = 0;
+    w->owned = buf == NULL;
+    if (buf == NULL)
+    {
+        if (cap == 0)
+        {
+            cap = rio_buffer_size(fd, 0);
+        }
+        buf = rio_alloc(cap);
+        if (buf == NULL)
+        {
+            w->buf = NULL;
+            w->cap = 0;
+            return -1;
+        }
+    }
+    w->buf = buf;
+    w->cap = cap;
+    return 0;
+}
+
+/**
+ * Write out the buffer; a failure is remembered so that output never
+ * continues past a gap.
+ */
+static int drain(rio_writer_t* w)
+{
+    if (w->err != 0)
+    {
+        errno = w->err;
+        return -1;
+    }
+    if (w->len > 0 && rio_write_full(w->fd, w->buf, w->len) == -1)
+    {
+        w->err = errno;
+        return -1;
+    }
+    w->len = 0;
+    return 0;
+}
+
+int rio_writer_put(rio_writer_t* w, const void* p, size_t len)
+{
+    if (len > w->cap - w->len || w->err != 0)
+    {
+        if (drain(w) == -1)
+        {
+            return -1;
+        }
+        if (len >= w->cap)
+        {
+            /* copying would only cost a pass over the data */
+            if (rio_write_full(w->fd, p, len) == -1)
+            {
+                w->err = errno;
+                return -1;
+            }
+            return 0;
+        }
+    }
+    memcpy(w->buf + w->len, p, len);
+    w->len += len;
+    return 0;
+}
+
+int rio_writer_puts(rio_writer_t* w, const char* s)
+{
+    return rio_writer_put(w, s, strlen(s));
+}
+
+int rio_writer_putc(rio_writer_t* w, char c)
+{
+    if ((w->len == w->cap || w->err != 0) && drain(w) == -1)
+    {
+        return -1;
+    }
+    w->buf[w->len++] = c;
+    return 0;
+}
+
+int rio_writer_flush(rio_writer_t* w)
+{
+    return drain(w);
+}
+
+void rio_writer_free(rio_writer_t* w)
+{
+    if (w->owned)
+    {
+        free(w->buf);
+    }
+    w->buf = NULL;
+    w->len = 0;
+    w->cap = 0;
+}
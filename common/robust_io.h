@@ -0,0 +1,103 @@
+#ifndef ROBUST_IO_H
+#define ROBUST_IO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * I/O core shared by the utilities and the shells, built into a static
+ * library by both Makefiles. Every transfer is restarted after EINTR and
+ * waits in poll() on EAGAIN, so a non-blocking descriptor inherited from
+ * the caller behaves like a blocking one, and short transfers are
+ * continued until the request is complete (or, for reads, end of file).
+ * All functions return -1 with errno set on failure; rio_error() is the
+ * one place that turns such a failure into a message.
+ */
+
+/**
+ * Write all len bytes to fd.
+ * @return 0 on success, -1 on error
+ */
+int rio_write_full(int fd, const void* p, size_t len);
+
+/**
+ * Write all len bytes to fd at offset, leaving the file position alone.
+ * @return 0 on success, -1 on error
+ */
+int rio_pwrite_full(int fd, const void* p, size_t len, off_t offset);
+
+/**
+ * One read() of at most len bytes, for callers that process data as it arrives.
+ * @return bytes read, 0 at end of file, -1 on error
+ */
+ssize_t rio_read(int fd, void* p, size_t len);
+
+/**
+ * Read until len bytes have arrived or the input ends.
+ * @return bytes read, less than len only at end of file; -1 on error
+ */
+ssize_t rio_read_full(int fd, void* p, size_t len);
+
+/**
+ * Like rio_read_full(), reading at offset without moving the file position.
+ */
+ssize_t rio_pread_full(int fd, void* p, size_t len, off_t offset);
+
+/**
+ * Buffer size for bulk I/O on fd: its st_blksize, at least min, rounded up
+ * to a whole number of pages.
+ */
+size_t rio_buffer_size(int fd, size_t min);
+
+/**
+ * Page-aligned allocation, so buffers also satisfy O_DIRECT and never
+ * straddle more pages than needed. Release with free().
+ * @return NULL on error
+ */
+void* rio_alloc(size_t size);
+
+/**
+ * Report a failed call on stderr as "what 'path': reason", or "what: reason"
+ * when path is NULL, with the reason taken from errno. errno is preserved.
+ */
+void rio_error(const char* what, const char* path);
+
+/* buffered output to one descriptor; nothing reaches fd before a flush or a full buffer */
+typedef struct
+{
+    int fd;
+    char* buf;
+    size_t len;
+    size_t cap;
+    int err;    /* errno of the first failed write, every later call fails with it */
+    bool owned; /* buf came from rio_alloc() */
+} rio_writer_t;
+
+/**
+ * Set up a writer on fd. With buf NULL a page-aligned buffer of cap bytes is
+ * allocated, or of rio_buffer_size(fd, 0) when cap is 0 too; otherwise the
+ * caller's cap-byte buffer is used and must outlive the writer.
+ * @return 0 on success, -1 on error
+ */
+int rio_writer_init(rio_writer_t* w, int fd, char* buf, size_t cap);
+
+/**
+ * Append len bytes, writing the buffer out whenever it fills; blocks at
+ * least as large as the buffer go straight to fd.
+ * @return 0 on success, -1 on error
+ */
+int rio_writer_put(rio_writer_t* w, const void* p, size_t len);
+int rio_writer_puts(rio_writer_t* w, const char* s);
+int rio_writer_putc(rio_writer_t* w, char c);
+
+/**
+ * Write out everything buffered so far.
+ * @return 0 on success, -1 on error, also for a failure in an earlier put
+ */
+int rio_writer_flush(rio_writer_t* w);
+
+/* release the buffer; pending data is dropped, flush first to keep it */
+void rio_writer_free(rio_writer_t* w);
+
+#endif /* ROBUST_IO_H */
@@ -0,0 +1,85 @@
+#!/bin/sh
+# bench_lines.sh CATEXE SCALAR_CATEXE [LINES] [RUNS]
+#
+# Throughput of mycat -n, -s and -l with the SIMD newline kernels, the same
+# modes built with the scalar kernels only, and GNU cat -n, cat -s and wc -l,
+# all on one generated file of LINES lines (base64 text with single and
+# double empty lines in between). Each command runs RUNS times from a warm
+# page cache with output to /dev/null; the best run is reported. Outputs are
+# compared once first.
+
+set -e
+
+cat_simd=$1
+cat_scalar=$2
+lines=${3:-2000000}
+runs=${4:-5}
+
+if [ -z "$cat_simd" ] || [ -z "$cat_scalar" ]; then
+    echo "usage: $0 CATEXE SCALAR_CATEXE [LINES] [RUNS]" >&2
+    exit 2
+fi
+
+input=$(mktemp "${TMPDIR:-/tmp}/bench_lines.XXXXXX")
+expect=$(mktemp "${TMPDIR:-/tmp}/bench_lines.XXXXXX")
+got=$(mktemp "${TMPDIR:-/tmp}/bench_lines.XXXXXX")
+trap 'rm -f "$input" "$expect" "$got"' EXIT
+
+head -c $((lines * 57)) /dev/urandom | base64 -w 76 |
+    awk -v n="$lines" 'c >= n { exit } NR % 4 == 0 { print ""; c++ } NR % 12 == 0 { print ""; c++ } c < n { print; c++ }' > "$input"
+bytes=$(wc -c < "$input")
+echo "input: $(wc -l < "$input") lines, $((bytes / 1048576)) MiB"
+
+# same output as the reference tool, or the timings mean nothing
+check() {
+    ref=$1
+    shift
+    $ref "$input" > "$expect"
+    for exe in "$cat_simd" "$cat_scalar"; do
+        "$exe" "$@" "$input" > "$got"
+        if [ "$ref" = "wc -l" ]; then
+            # wc also prints the file name
+            awk '{ print $1 }' "$expect" | cmp -s - "$got" || { echo "$exe $*: output differs from $ref" >&2; exit 1; }
+        else
+            cmp -s "$expect" "$got" || { echo "$exe $*: output differs from $ref" >&2; exit 1; }
+        fi
+    done
+}
+
+# best wall time of RUNS runs, in microseconds
+best() {
+    b=
+    i=0
+    while [ $i -lt "$runs" ]; do
+        t0=$(date +%s%N)
+        "$@" "$input" > /dev/null
+        t1=$(date +%s%N)
+        t=$(((t1 - t0) / 1000))
+        if [ -z "$b" ] || [ $t -lt $b ]; then
+            b=$t
+        fi
+        i=$((i + 1))
+    done
+    echo $b
+}
+
+report() {
+    label=$1
+    shift
+    us=$(best "$@")
+    awk -v l="$label" -v us="$us" -v b="$bytes" 'BEGIN { printf "%-22s %9.3f s %9.1f MiB/s\n", l, us / 1e6, b / 1048576 / (us / 1e6) }'
+}
+
+check "cat -n" -n
+check "cat -s" -s
+check "wc -l" -l
+
+report "mycat -n (simd)" "$cat_simd" -n
+report "mycat -n (scalar)" "$cat_scalar" -n
+report "cat -n" cat -n
+report "mycat -s (simd)" "$cat_simd" -s
+report "mycat -s (scalar)" "$cat_scalar" -s
+report "cat -s" cat -s
+report "mycat -l (simd)" "$cat_simd" -l
+report "mycat -l (scalar)" "$cat_scalar" -l
+report "wc -l" wc -l
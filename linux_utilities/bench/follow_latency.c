@@ -0,0 +1,136 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define DEFAULT_ROUNDS 1000
+#define LINE "0123456789abcdefghijklmnopqrstuvwxyz0123456789abcdefghijklmnopqrstuvwxyz\n"
+
+/*
+ * follow_latency ROUNDS COMMAND [ARGS...]
+ *
+ * Start COMMAND ARGS... FILE on a fresh temporary file with its stdout on a
+ * pipe, then append one line at a time and time how long each takes to come
+ * out of the pipe. Prints min, median, p99 and max in microseconds.
+ * Example: follow_latency 1000 bin/catexe -f
+ */
+
+static double now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e6 + (double)ts.tv_nsec / 1e3;
+}
+
+static int compare_double(const void* a, const void* b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/* read exactly len bytes of the follower's output, -1 if it went away */
+static int read_line(int fd, size_t len)
+{
+    char buf[sizeof(LINE)];
+    size_t got = 0;
+    while (got < len)
+    {
+        ssize_t n = read(fd, buf, len - got);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return -1;
+        }
+        got += (size_t)n;
+    }
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "usage: %s ROUNDS COMMAND [ARGS...]\n", argv[0]);
+        return 2;
+    }
+    int rounds = atoi(argv[1]);
+    if (rounds <= 0)
+    {
+        rounds = DEFAULT_ROUNDS;
+    }
+
+    const char* tmpdir = getenv("TMPDIR");
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/follow_latency.XXXXXX", tmpdir != NULL ? tmpdir : "/tmp");
+    int fd = mkstemp(path);
+    int out[2];
+    if (fd == -1 || pipe(out) == -1)
+    {
+        perror("Error while creating the test file");
+        return 1;
+    }
+
+    /* COMMAND ARGS... FILE */
+    int nargs = argc - 2;
+    char** args = calloc((size_t)nargs + 2, sizeof(*args));
+    memcpy(args, argv + 2, (size_t)nargs * sizeof(*args));
+    args[nargs] = path;
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        dup2(out[1], STDOUT_FILENO);
+        close(out[0]);
+        close(out[1]);
+        execvp(args[0], args);
+        perror(args[0]);
+        _exit(127);
+    }
+    close(out[1]);
+
+    const size_t len = sizeof(LINE) - 1;
+    double* lat = malloc((size_t)rounds * sizeof(*lat));
+
+    /* first line only proves the follower is up; it may be read before or after its watches exist */
+    if (write(fd, LINE, len) != (ssize_t)len || read_line(out[0], len) == -1)
+    {
+        fprintf(stderr, "%s: follower produced no output\n", args[0]);
+        kill(pid, SIGTERM);
+        unlink(path);
+        return 1;
+    }
+    usleep(100 * 1000);
+
+    for (int i = 0; i < rounds; ++i)
+    {
+        double t0 = now_us();
+        if (write(fd, LINE, len) != (ssize_t)len || read_line(out[0], len) == -1)
+        {
+            fprintf(stderr, "%s: lost output after %d lines\n", args[0], i);
+            kill(pid, SIGTERM);
+            unlink(path);
+            return 1;
+        }
+        lat[i] = now_us() - t0;
+    }
+
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    unlink(path);
+
+    qsort(lat, (size_t)rounds, sizeof(*lat), compare_double);
+    printf("%-24s %6d appends  min %7.1f  median %7.1f  p99 %7.1f  max %8.1f us\n", args[0], rounds, lat[0],
+           lat[rounds / 2], lat[(size_t)rounds * 99 / 100], lat[rounds - 1]);
+    free(lat);
+    free(args);
+    return 0;
+}
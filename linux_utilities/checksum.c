@@ -0,0 +1,318 @@
+#include "checksum.h"
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define HAVE_HW_CRC32C 1
+#endif
+
+/* ---------------------------------------------------------------- crc32c */
+
+#define CRC32C_POLY 0x82F63B78u /* Castagnoli, reflected */
+
+static uint32_t crc32c_table[8][256];
+static uint32_t (*crc32c_update)(uint32_t crc, const uint8_t* p, size_t len);
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Portable slicing-by-8 implementation, eight bytes per table round
+ */
+static uint32_t crc32c_sw(uint32_t crc, const uint8_t* p, size_t len)
+{
+    while (len >= 8)
+    {
+        uint32_t lo = crc ^ ((uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+        crc = crc32c_table[7][lo & 0xFF] ^ crc32c_table[6][(lo >> 8) & 0xFF] ^ crc32c_table[5][(lo >> 16) & 0xFF]
+              ^ crc32c_table[4][lo >> 24] ^ crc32c_table[3][p[4]] ^ crc32c_table[2][p[5]] ^ crc32c_table[1][p[6]]
+              ^ crc32c_table[0][p[7]];
+        p += 8;
+        len -= 8;
+    }
+    while (len--)
+    {
+        crc = crc32c_table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#ifdef HAVE_HW_CRC32C
+/**
+ * SSE4.2 crc32 instruction, selected at runtime when the CPU supports it
+ */
+__attribute__((target("sse4.2"))) static uint32_t crc32c_hw(uint32_t crc, const uint8_t* p, size_t len)
+{
+#if defined(__x86_64__)
+    uint64_t crc64 = crc;
+    while (len >= 8)
+    {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+        p += 8;
+        len -= 8;
+    }
+    crc = (uint32_t)crc64;
+#endif
+    while (len--)
+    {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+    return crc;
+}
+#endif
+
+/**
+ * Build the tables and pick an implementation; run through crc32c_once,
+ * as the copy workers start their checksums concurrently
+ */
+static void crc32c_setup(void)
+{
+    for (uint32_t i = 0; i < 256; ++i)
+    {
+        uint32_t crc = i;
+        for (int k = 0; k < 8; ++k)
+        {
+            crc = (crc >> 1) ^ (CRC32C_POLY & (0u - (crc & 1)));
+        }
+        crc32c_table[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; ++i)
+    {
+        for (int t = 1; t < 8; ++t)
+        {
+            crc32c_table[t][i] = crc32c_table[0][crc32c_table[t - 1][i] & 0xFF] ^ (crc32c_table[t - 1][i] >> 8);
+        }
+    }
+
+    crc32c_update = crc32c_sw;
+#ifdef HAVE_HW_CRC32C
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2"))
+    {
+        crc32c_update = crc32c_hw;
+    }
+#endif
+}
+
+/* ----------------------------------------------------------------- xxh64 */
+
+#define XXH_P1 11400714785074694791ULL
+#define XXH_P2 14029467366897019727ULL
+#define XXH_P3 1609587929392839161ULL
+#define XXH_P4 9650029242287828579ULL
+#define XXH_P5 2870177450012600261ULL
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const uint8_t* p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+static inline uint32_t read32(const uint8_t* p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+static inline uint64_t xxh64_round(uint64_t acc, uint64_t input)
+{
+    acc += input * XXH_P2;
+    acc = rotl64(acc, 31);
+    return acc * XXH_P1;
+}
+
+static inline uint64_t xxh64_merge(uint64_t acc, uint64_t val)
+{
+    acc ^= xxh64_round(0, val);
+    return acc * XXH_P1 + XXH_P4;
+}
+
+/**
+ * Consume whole 32-byte stripes; the four lanes are independent so the
+ * compiler can keep them in flight in parallel
+ */
+static const uint8_t* xxh64_stripes(uint64_t v[4], const uint8_t* p, const uint8_t* end)
+{
+    uint64_t v1 = v[0], v2 = v[1], v3 = v[2], v4 = v[3];
+    while (p + 32 <= end)
+    {
+        v1 = xxh64_round(v1, read64(p));
+        v2 = xxh64_round(v2, read64(p + 8));
+        v3 = xxh64_round(v3, read64(p + 16));
+        v4 = xxh64_round(v4, read64(p + 24));
+        p += 32;
+    }
+    v[0] = v1;
+    v[1] = v2;
+    v[2] = v3;
+    v[3] = v4;
+    return p;
+}
+
+static void xxh64_update(checksum_t* sum, const uint8_t* p, size_t len)
+{
+    const uint8_t* end = p + len;
+    sum->total_len += len;
+
+    if (sum->memsize + len < 32)
+    {
+        memcpy(sum->mem + sum->memsize, p, len);
+        sum->memsize += len;
+        return;
+    }
+
+    if (sum->memsize > 0)
+    {
+        size_t fill = 32 - sum->memsize;
+        memcpy(sum->mem + sum->memsize, p, fill);
+        xxh64_stripes(sum->v, sum->mem, sum->mem + 32);
+        p += fill;
+        sum->memsize = 0;
+    }
+
+    p = xxh64_stripes(sum->v, p, end);
+
+    if (p < end)
+    {
+        sum->memsize = (size_t)(end - p);
+        memcpy(sum->mem, p, sum->memsize);
+    }
+}
+
+static uint64_t xxh64_digest(const checksum_t* sum)
+{
+    uint64_t h;
+    if (sum->total_len >= 32)
+    {
+        h = rotl64(sum->v[0], 1) + rotl64(sum->v[1], 7) + rotl64(sum->v[2], 12) + rotl64(sum->v[3], 18);
+        for (int i = 0; i < 4; ++i)
+        {
+            h = xxh64_merge(h, sum->v[i]);
+        }
+    }
+    else
+    {
+        h = sum->v[2] + XXH_P5; /* v[2] holds the seed */
+    }
+    h += sum->total_len;
+
+    const uint8_t* p = sum->mem;
+    const uint8_t* end = sum->mem + sum->memsize;
+    for (; p + 8 <= end; p += 8)
+    {
+        h ^= xxh64_round(0, read64(p));
+        h = rotl64(h, 27) * XXH_P1 + XXH_P4;
+    }
+    if (p + 4 <= end)
+    {
+        h ^= (uint64_t)read32(p) * XXH_P1;
+        h = rotl64(h, 23) * XXH_P2 + XXH_P3;
+        p += 4;
+    }
+    for (; p < end; ++p)
+    {
+        h ^= *p * XXH_P5;
+        h = rotl64(h, 11) * XXH_P1;
+    }
+
+    h ^= h >> 33;
+    h *= XXH_P2;
+    h ^= h >> 29;
+    h *= XXH_P3;
+    h ^= h >> 32;
+    return h;
+}
+
+/* ------------------------------------------------------------ public API */
+
+bool checksum_parse(const char* name, checksum_algo_t* algo)
+{
+    if (strcmp(name, "crc32c") == 0)
+    {
+        *algo = CHECKSUM_CRC32C;
+        return true;
+    }
+    if (strcmp(name, "xxh64") == 0)
+    {
+        *algo = CHECKSUM_XXH64;
+        return true;
+    }
+    return false;
+}
+
+void checksum_init(checksum_t* sum, checksum_algo_t algo)
+{
+    memset(sum, 0, sizeof(*sum));
+    sum->algo = algo;
+
+    if (algo == CHECKSUM_CRC32C)
+    {
+        pthread_once(&crc32c_once, crc32c_setup);
+        sum->crc = 0xFFFFFFFFu;
+    }
+    else if (algo == CHECKSUM_XXH64)
+    {
+        const uint64_t seed = 0;
+        sum->v[0] = seed + XXH_P1 + XXH_P2;
+        sum->v[1] = seed + XXH_P2;
+        sum->v[2] = seed;
+        sum->v[3] = seed - XXH_P1;
+    }
+}
+
+void checksum_update(checksum_t* sum, const void* data, size_t len)
+{
+    if (sum->algo == CHECKSUM_CRC32C)
+    {
+        sum->crc = crc32c_update(sum->crc, data, len);
+    }
+    else if (sum->algo == CHECKSUM_XXH64)
+    {
+        xxh64_update(sum, data, len);
+    }
+}
+
+void checksum_update_zeros(checksum_t* sum, uint64_t len)
+{
+    static const uint8_t zeros[64 * 1024];
+
+    while (len > 0)
+    {
+        size_t n = len < sizeof(zeros) ? (size_t)len : sizeof(zeros);
+        checksum_update(sum, zeros, n);
+        len -= n;
+    }
+}
+
+void checksum_hex(const checksum_t* sum, char* out)
+{
+    if (sum->algo == CHECKSUM_CRC32C)
+    {
+        snprintf(out, CHECKSUM_HEX_MAX, "%08" PRIx32, ~sum->crc);
+    }
+    else if (sum->algo == CHECKSUM_XXH64)
+    {
+        snprintf(out, CHECKSUM_HEX_MAX, "%016" PRIx64, xxh64_digest(sum));
+    }
+    else
+    {
+        out[0] = '\0';
+    }
+}
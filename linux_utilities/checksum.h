@@ -0,0 +1,47 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define CHECKSUM_HEX_MAX 17 /* 16 hex digits for xxh64 plus NUL */
+
+typedef enum
+{
+    CHECKSUM_NONE,
+    CHECKSUM_CRC32C,
+    CHECKSUM_XXH64
+} checksum_algo_t;
+
+/* streaming state; hashes are updated in the order the bytes appear in the file */
+typedef struct
+{
+    checksum_algo_t algo;
+    uint32_t crc;
+    uint64_t v[4];        /* xxh64 accumulators */
+    uint64_t total_len;   /* xxh64 bytes consumed */
+    uint8_t mem[32];      /* xxh64 partial stripe */
+    size_t memsize;
+} checksum_t;
+
+/**
+ * Map an algorithm name ("crc32c", "xxh64") to its identifier
+ * @return true if the name is known
+ */
+bool checksum_parse(const char* name, checksum_algo_t* algo);
+
+void checksum_init(checksum_t* sum, checksum_algo_t algo);
+void checksum_update(checksum_t* sum, const void* data, size_t len);
+
+/**
+ * Feed len zero bytes, used for holes that are never read from disk
+ */
+void checksum_update_zeros(checksum_t* sum, uint64_t len);
+
+/**
+ * Format the final digest as lowercase hex into out (CHECKSUM_HEX_MAX bytes)
+ */
+void checksum_hex(const checksum_t* sum, char* out);
+
+#endif /* CHECKSUM_H */
@@ -1,49 +1,1091 @@
+#define _GNU_SOURCE
 #include <fcntl.h>
 #include <stdio.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+#include <getopt.h>
+#include <libgen.h>
+#include <poll.h>
+#include <signal.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
 #include <unistd.h>
 
-#define COUNT 1024
+#include "robust_io.h"
 
-int main(int argc, char** argv)
+/* -DMYCAT_SCALAR_ONLY builds the scalar kernels alone, for bench/bench_lines.sh */
+#if (defined(__x86_64__) || defined(__i386__)) && !defined(MYCAT_SCALAR_ONLY)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+#define COUNT (128 * 1024)      /* minimum read buffer size */
+#define OUT_COUNT (256 * 1024)  /* minimum output buffer size, flushed with one write */
+#define NUM_MIN_DIGITS 6        /* line numbers are right-aligned like "%6llu\t" */
+#define TEE_BUFFER (256 * 1024) /* default --tee-buffer: how far one output may fall behind */
+
+typedef struct
+{
+    bool number;  /* -n: number all output lines */
+    bool squeeze; /* -s: suppress repeated empty lines */
+    bool count;   /* -l: only print the number of lines */
+    bool follow;  /* -f: keep streaming the file as it grows */
+} Options;
+
+/* line state carried across read() boundaries */
+typedef struct
 {
-	if (argc != 2)
-	{
-		//! output error statement and exit
-		printf("Usage: %s <filepath>\n", argv[0]);
-		exit (-1);
-	}
-
-	char buf[COUNT]; 
-	// this program is hardcoded to open and print only the content of the file "/etc/passwd"
-	const char* filename=argv[1];
-
-	int fd = open(filename, O_RDONLY);
-	if (fd < 0)
-	{
-		perror("Error occured while opening file");
-		exit (-2);
-	}
-
-	ssize_t num_bytes = 0;
-	while ((num_bytes = read(fd, buf, COUNT)) > 0)
-	{
-		
-		if (write(1, buf, num_bytes) < 0)
-		{
-			perror("Error occured while writing to stdout\n");
-			exit(-3);
-		}
-	}
-
-	if (close (fd) < 0)
-	{
-		perror("Error occured while closing file descriptor\n");
-		exit(4);
-	}
-	
-	return 0;
+    bool at_line_start;
+    unsigned blank_run;
+    char num[24];             /* current line number as right-aligned ASCII digits */
+    char* num_first;          /* most significant digit in num */
+    unsigned long long lines; /* newlines seen, for -l */
+} LineState;
+
+static char* buf; /* page-aligned, sized by alloc_buffer() */
+static size_t buf_size;
+static rio_writer_t out;
+static bool use_sendfile = true;
+
+/* newline kernels, selected once at startup by select_kernels() */
+static const char* (*next_newline)(const char* p, const char* end);
+static size_t (*count_newlines)(const char* p, const char* end);
+
+static const char* next_newline_scalar(const char* p, const char* end)
+{
+    const char* nl = memchr(p, '\n', (size_t)(end - p));
+    return nl != NULL ? nl : end;
 }
 
+static size_t count_newlines_scalar(const char* p, const char* end)
+{
+    size_t n = 0;
+    for (; p < end; ++p)
+    {
+        n += (*p == '\n');
+    }
+    return n;
+}
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("sse2"))) static const char* next_newline_sse2(const char* p, const char* end)
+{
+    const __m128i nl = _mm_set1_epi8('\n');
+    for (; end - p >= 16; p += 16)
+    {
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), nl));
+        if (mask != 0)
+        {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return next_newline_scalar(p, end);
+}
+
+__attribute__((target("sse2,popcnt"))) static size_t count_newlines_sse2(const char* p, const char* end)
+{
+    const __m128i nl = _mm_set1_epi8('\n');
+    size_t n = 0;
+    for (; end - p >= 16; p += 16)
+    {
+        __m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), nl);
+        n += (size_t)__builtin_popcount((unsigned)_mm_movemask_epi8(eq));
+    }
+    return n + count_newlines_scalar(p, end);
+}
+
+__attribute__((target("avx2"))) static const char* next_newline_avx2(const char* p, const char* end)
+{
+    const __m256i nl = _mm256_set1_epi8('\n');
+    for (; end - p >= 32; p += 32)
+    {
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)p), nl));
+        if (mask != 0)
+        {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return next_newline_scalar(p, end);
+}
+
+/* 64 bytes per iteration: two 32-byte compares folded into one 64-bit mask */
+__attribute__((target("avx2,popcnt"))) static size_t count_newlines_avx2(const char* p, const char* end)
+{
+    const __m256i nl = _mm256_set1_epi8('\n');
+    size_t n = 0;
+    for (; end - p >= 64; p += 64)
+    {
+        __m256i eq_lo = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)p), nl);
+        __m256i eq_hi = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p + 32)), nl);
+        uint64_t lo = (uint32_t)_mm256_movemask_epi8(eq_lo);
+        uint64_t hi = (uint32_t)_mm256_movemask_epi8(eq_hi);
+        n += (size_t)__builtin_popcountll(lo | (hi << 32));
+    }
+    return n + count_newlines_scalar(p, end);
+}
+#endif
+
+static void select_kernels(void)
+{
+    next_newline = next_newline_scalar;
+    count_newlines = count_newlines_scalar;
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt"))
+    {
+        next_newline = next_newline_avx2;
+        count_newlines = count_newlines_avx2;
+    }
+    else if (__builtin_cpu_supports("sse2") && __builtin_cpu_supports("popcnt"))
+    {
+        next_newline = next_newline_sse2;
+        count_newlines = count_newlines_sse2;
+    }
+#endif
+}
+
+/**
+ * Size the read buffer from the input's st_blksize
+ */
+static void alloc_buffer(int fd)
+{
+    buf_size = rio_buffer_size(fd, COUNT);
+    buf = rio_alloc(buf_size);
+    if (buf == NULL)
+    {
+        rio_error("Error occured while allocating memory", NULL);
+        exit(-1);
+    }
+}
+
+static void write_all_fd(int fd, const char* p, size_t len)
+{
+    if (rio_write_full(fd, p, len) == -1)
+    {
+        rio_error("Error occured while writing output", NULL);
+        exit(-3);
+    }
+}
+
+static void write_all(const char* p, size_t len)
+{
+    write_all_fd(STDOUT_FILENO, p, len);
+}
+
+static void flush_out(void)
+{
+    if (rio_writer_flush(&out) == -1)
+    {
+        rio_error("Error occured while writing to stdout", NULL);
+        exit(-3);
+    }
+}
+
+static void emit(const char* p, size_t len)
+{
+    if (rio_writer_put(&out, p, len) == -1)
+    {
+        rio_error("Error occured while writing to stdout", NULL);
+        exit(-3);
+    }
+}
+
+static void init_line_state(LineState* st)
+{
+    st->at_line_start = true;
+    st->blank_run = 0;
+    st->lines = 0;
+    memset(st->num, ' ', sizeof(st->num) - 2);
+    st->num[sizeof(st->num) - 3] = '0';
+    st->num[sizeof(st->num) - 2] = '\t';
+    st->num[sizeof(st->num) - 1] = '\0';
+    st->num_first = &st->num[sizeof(st->num) - 3];
+}
+
+/**
+ * Increment the line number in place and append it, avoiding a printf per line
+ */
+static void emit_line_number(LineState* st)
+{
+    char* last = &st->num[sizeof(st->num) - 3];
+    char* p = last;
+    while (*p == '9')
+    {
+        *p-- = '0';
+    }
+    *p = (*p == ' ') ? '1' : (char)(*p + 1);
+    if (p < st->num_first)
+    {
+        st->num_first = p;
+    }
+
+    char* start = st->num_first;
+    if (last - start + 1 < NUM_MIN_DIGITS)
+    {
+        start = last - (NUM_MIN_DIGITS - 1);
+    }
+    emit(start, (size_t)(last - start + 2));
+}
+
+/**
+ * Apply -n/-s to one chunk of input, appending the result to the output buffer
+ */
+static void filter_lines(const char* p, const char* end, const Options* options, LineState* st)
+{
+    while (p < end)
+    {
+        if (st->at_line_start)
+        {
+            if (*p == '\n')
+            {
+                st->blank_run++;
+                if (options->squeeze && st->blank_run > 1)
+                {
+                    p++;
+                    continue;
+                }
+            }
+            else
+            {
+                st->blank_run = 0;
+            }
+
+            if (options->number)
+            {
+                emit_line_number(st);
+            }
+            st->at_line_start = false;
+        }
+
+        const char* nl = next_newline(p, end);
+        if (nl < end)
+        {
+            emit(p, (size_t)(nl + 1 - p));
+            p = nl + 1;
+            st->at_line_start = true;
+        }
+        else
+        {
+            emit(p, (size_t)(end - p));
+            p = end;
+        }
+    }
+}
+
+/**
+ * Plain copy to stdout with sendfile(), which moves the data inside the kernel.
+ * @return false if sendfile is not usable for this pair of descriptors
+ */
+static bool drain_sendfile(int fd)
+{
+    for (;;)
+    {
+        ssize_t n = sendfile(STDOUT_FILENO, fd, NULL, 0x7ffff000);
+        if (n > 0)
+        {
+            continue;
+        }
+        if (n == 0)
+        {
+            return true;
+        }
+        if (errno == EINTR)
+        {
+            continue;
+        }
+        if (errno == EINVAL || errno == ENOSYS)
+        {
+            use_sendfile = false;
+            return false;
+        }
+        perror("Error occured while writing to stdout");
+        exit(-3);
+    }
+}
+
+/**
+ * Process everything that can currently be read from fd
+ */
+static void drain(int fd, const Options* options, LineState* st)
+{
+    bool filtering = options->number || options->squeeze;
+
+    if (!filtering && !options->count && use_sendfile && drain_sendfile(fd))
+    {
+        return;
+    }
+
+    ssize_t num_bytes = 0;
+    while ((num_bytes = rio_read(fd, buf, buf_size)) != 0)
+    {
+        if (num_bytes < 0)
+        {
+            rio_error("Error occured while reading file", NULL);
+            exit(-2);
+        }
+
+        if (options->count)
+        {
+            st->lines += count_newlines(buf, buf + num_bytes);
+        }
+        else if (filtering)
+        {
+            filter_lines(buf, buf + num_bytes, options, st);
+        }
+        else
+        {
+            write_all(buf, (size_t)num_bytes);
+        }
+    }
+}
+
+#define FOLLOW_FILE_MASK (IN_MODIFY | IN_MOVE_SELF | IN_DELETE_SELF)
+#define FOLLOW_DIR_MASK (IN_CREATE | IN_MOVED_TO)
+
+/**
+ * Stream the file as it grows, like tail -F. inotify reports appends
+ * (IN_MODIFY) and rotation: the old file being renamed or removed and a new
+ * one appearing under the same name in the parent directory. On rotation the
+ * rest of the old file is drained before switching to the new one.
+ * Never returns; the process is stopped by a signal.
+ */
+static void follow(const char* path, int fd, const Options* options, LineState* st)
+{
+    char dir_copy[PATH_MAX], base_copy[PATH_MAX];
+    snprintf(dir_copy, sizeof(dir_copy), "%s", path);
+    snprintf(base_copy, sizeof(base_copy), "%s", path);
+    const char* dir = dirname(dir_copy);
+    const char* base = basename(base_copy);
+
+    int ino = inotify_init1(IN_CLOEXEC);
+    if (ino < 0)
+    {
+        perror("Error occured while initializing inotify");
+        exit(-5);
+    }
+
+    int wd_file = inotify_add_watch(ino, path, FOLLOW_FILE_MASK);
+    int wd_dir = inotify_add_watch(ino, dir, FOLLOW_DIR_MASK);
+    if (wd_file < 0 || wd_dir < 0)
+    {
+        perror("Error occured while adding inotify watch");
+        exit(-5);
+    }
+    /* data appended between main's drain and the watches raised no event */
+    drain(fd, options, st);
+    flush_out();
+
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    for (;;)
+    {
+        ssize_t len = read(ino, events, sizeof(events));
+        if (len < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("Error occured while reading inotify events");
+            exit(-5);
+        }
+
+        bool modified = false;
+        bool created = false;
+        for (char* p = events; p < events + len;)
+        {
+            const struct inotify_event* ev = (const struct inotify_event*)p;
+            if (ev->wd == wd_file && (ev->mask & FOLLOW_FILE_MASK))
+            {
+                /* appended to, or renamed/removed: either way drain what is left */
+                modified = true;
+            }
+            else if (ev->wd == wd_dir && ev->len > 0 && strcmp(ev->name, base) == 0)
+            {
+                created = true;
+            }
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+
+        if (modified)
+        {
+            /* truncated in place (copytruncate rotation): start over */
+            struct stat sb;
+            if (fstat(fd, &sb) == 0 && sb.st_size < lseek(fd, 0, SEEK_CUR))
+            {
+                lseek(fd, 0, SEEK_SET);
+            }
+            drain(fd, options, st);
+        }
+
+        if (created)
+        {
+            struct stat old_sb, new_sb;
+            int nfd = open(path, O_RDONLY | O_CLOEXEC);
+            if (nfd >= 0 && fstat(fd, &old_sb) == 0 && fstat(nfd, &new_sb) == 0
+                && (old_sb.st_ino != new_sb.st_ino || old_sb.st_dev != new_sb.st_dev))
+            {
+                drain(fd, options, st);
+                inotify_rm_watch(ino, wd_file);
+                close(fd);
+                fd = nfd;
+                wd_file = inotify_add_watch(ino, path, FOLLOW_FILE_MASK);
+                drain(fd, options, st);
+            }
+            else if (nfd >= 0)
+            {
+                close(nfd);
+            }
+        }
+
+        flush_out();
+    }
+}
+
+/* one output of --tee */
+typedef struct
+{
+    int fd;
+    const char* name;
+    int lag[2];  /* private pipe with the data this output has not taken yet */
+    bool copy;   /* splice into fd is not supported: drain lag with read/write */
+    ssize_t got; /* bytes of the current chunk that went into lag */
+    char* over;  /* rest of a chunk that did not fit into lag */
+    size_t over_off;
+    size_t over_len;
+    char* out; /* copy mode: bytes read from lag that fd has not taken yet */
+    size_t out_off;
+    size_t out_len;
+    size_t out_cap;
+} TeeSink;
+
+static volatile sig_atomic_t stdout_flags = -1; /* stdout's flags before --tee set O_NONBLOCK on it */
+
+/* O_NONBLOCK is shared with every process using the same open stdout, put it back */
+static void restore_stdout(void)
+{
+    if (stdout_flags != -1)
+    {
+        fcntl(STDOUT_FILENO, F_SETFL, (int)stdout_flags);
+    }
+}
+
+/* a fatal signal: restore stdout, then die of it as if it had not been caught */
+static void restore_stdout_and_die(int sig)
+{
+    restore_stdout();
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+/**
+ * The descriptor --tee writes stdout's data to, in non-blocking mode.
+ * Regular files and block devices never make a writer wait, so stdout is
+ * used as is. Otherwise stdout is reopened through /proc, which gives a
+ * private open file description with its own O_NONBLOCK. Only when that is
+ * not possible (a socket) is O_NONBLOCK set on stdout itself. It is then
+ * undone at exit and on the usual fatal signals.
+ */
+static int open_tee_stdout(void)
+{
+    struct stat sb;
+    if (fstat(STDOUT_FILENO, &sb) == 0 && (S_ISREG(sb.st_mode) || S_ISBLK(sb.st_mode)))
+    {
+        return STDOUT_FILENO;
+    }
+    int fd = open("/proc/self/fd/1", O_WRONLY | O_NONBLOCK | O_NOCTTY | O_CLOEXEC);
+    if (fd >= 0)
+    {
+        return fd;
+    }
+
+    int flags = fcntl(STDOUT_FILENO, F_GETFL);
+    if (flags == -1)
+    {
+        return -1;
+    }
+    stdout_flags = flags;
+    atexit(restore_stdout);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = restore_stdout_and_die;
+    sigemptyset(&sa.sa_mask);
+    const int fatal[] = {SIGHUP, SIGINT, SIGQUIT, SIGTERM};
+    for (size_t i = 0; i < sizeof(fatal) / sizeof(fatal[0]); ++i)
+    {
+        sigaction(fatal[i], &sa, NULL);
+    }
+    return fcntl(STDOUT_FILENO, F_SETFL, flags | O_NONBLOCK) == -1 ? -1 : STDOUT_FILENO;
+}
+
+/**
+ * Report a failed write to an output and exit. A reader that went away
+ * (EPIPE, SIGPIPE is ignored in --tee) ends the process by SIGPIPE as
+ * usual, once stdout's flags are back.
+ */
+static void sink_failed(const TeeSink* s)
+{
+    if (errno == EPIPE)
+    {
+        restore_stdout();
+        signal(SIGPIPE, SIG_DFL);
+        raise(SIGPIPE);
+    }
+    fprintf(stderr, "Error occured while writing to %s: %s\n", s->name, strerror(errno));
+    exit(-3);
+}
+
+static size_t pipe_used(int fd)
+{
+    int n = 0;
+    return ioctl(fd, FIONREAD, &n) == 0 ? (size_t)n : 0;
+}
+
+static bool sink_pending(const TeeSink* s)
+{
+    return s->over_len > 0 || s->out_len > 0 || pipe_used(s->lag[0]) > 0;
+}
+
+/**
+ * Write what copy mode holds for the output.
+ * @return false when the output takes no more right now
+ */
+static bool drain_out(TeeSink* s)
+{
+    while (s->out_len > 0)
+    {
+        ssize_t n = write(s->fd, s->out + s->out_off, s->out_len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EAGAIN)
+            {
+                return false;
+            }
+            sink_failed(s);
+        }
+        s->out_off += (size_t)n;
+        s->out_len -= (size_t)n;
+    }
+    return true;
+}
+
+/**
+ * Move as much as the output takes right now without blocking on it:
+ * leftovers into the lag pipe, the lag pipe into the output. Every output
+ * that can make a writer wait is O_NONBLOCK, so a slow pipe, socket or
+ * terminal only holds up itself.
+ */
+static void flush_sink(TeeSink* s)
+{
+    bool progress = true;
+    while (progress)
+    {
+        progress = false;
+        while (s->over_len > 0)
+        {
+            ssize_t n = write(s->lag[1], s->over + s->over_off, s->over_len);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                break; /* EAGAIN: lag is full */
+            }
+            s->over_off += (size_t)n;
+            s->over_len -= (size_t)n;
+            progress = true;
+        }
+
+        size_t avail;
+        while (drain_out(s) && (avail = pipe_used(s->lag[0])) > 0)
+        {
+            ssize_t n;
+            if (s->copy)
+            {
+                n = read(s->lag[0], s->out, avail < s->out_cap ? avail : s->out_cap);
+                if (n > 0)
+                {
+                    s->out_off = 0;
+                    s->out_len = (size_t)n;
+                }
+            }
+            else
+            {
+                n = splice(s->lag[0], NULL, s->fd, NULL, avail, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            }
+            if (n > 0)
+            {
+                progress = true;
+                continue;
+            }
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n < 0 && errno == EAGAIN)
+            {
+                break;
+            }
+            if (n < 0 && errno == EINVAL && !s->copy)
+            {
+                /* e.g. a terminal: no splice support */
+                s->copy = true;
+                continue;
+            }
+            sink_failed(s);
+        }
+    }
+}
+
+/**
+ * Consume exactly len bytes from the source pipe into buf
+ */
+static void read_exact(int fd, char* p, size_t len)
+{
+    ssize_t n = rio_read_full(fd, p, len);
+    if (n != (ssize_t)len)
+    {
+        if (n >= 0)
+        {
+            errno = EIO; /* the pipe held fewer bytes than it reported */
+        }
+        rio_error("Error occured while reading input", NULL);
+        exit(-2);
+    }
+}
+
+/**
+ * Hand one chunk that sits in the pipe src to every output. Each lag pipe
+ * gets a tee() of it, which only takes page references; the chunk is then
+ * dropped from src by splicing it to /dev/null. Outputs whose lag pipe was
+ * too fragmented to take the whole chunk get the rest copied out instead.
+ */
+static void tee_chunk(int src, size_t len, TeeSink* sinks, int nsinks, int devnull)
+{
+    bool partial = false;
+    for (int i = 0; i < nsinks; ++i)
+    {
+        ssize_t m;
+        do
+        {
+            m = tee(src, sinks[i].lag[1], len, SPLICE_F_NONBLOCK);
+        } while (m < 0 && errno == EINTR);
+        if (m < 0 && errno != EAGAIN)
+        {
+            perror("Error occured while duplicating input");
+            exit(-3);
+        }
+        sinks[i].got = m < 0 ? 0 : m;
+        partial = partial || (size_t)sinks[i].got < len;
+    }
+
+    if (partial)
+    {
+        read_exact(src, buf, len);
+        for (int i = 0; i < nsinks; ++i)
+        {
+            size_t rest = len - (size_t)sinks[i].got;
+            memcpy(sinks[i].over, buf + sinks[i].got, rest);
+            sinks[i].over_off = 0;
+            sinks[i].over_len = rest;
+        }
+        return;
+    }
+
+    while (len > 0)
+    {
+        ssize_t n = devnull >= 0 ? splice(src, NULL, devnull, NULL, len, SPLICE_F_MOVE) : -1;
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            read_exact(src, buf, len);
+            return;
+        }
+        len -= (size_t)n;
+    }
+}
+
+/**
+ * --tee: copy stdin to stdout and to every path. Input is spliced into a
+ * pipe once (or used as is when stdin already is a pipe) and tee()d into a
+ * private lag pipe per output, which is spliced on to the output without
+ * blocking on it. The lag pipes are sized to buffer_size: a slow output may
+ * fall that far behind the others before input is paused for it. When the
+ * input cannot be spliced, each chunk is read once and written to every
+ * lag pipe instead.
+ */
+static void tee_mode(char** paths, int npaths, size_t buffer_size)
+{
+    int nsinks = npaths + 1;
+    TeeSink* sinks = calloc((size_t)nsinks, sizeof(*sinks));
+    if (sinks == NULL)
+    {
+        perror("Error occured while allocating memory");
+        exit(-1);
+    }
+
+    /* a closed output shows up as EPIPE, see sink_failed() */
+    signal(SIGPIPE, SIG_IGN);
+    sinks[0].fd = open_tee_stdout();
+    sinks[0].name = "stdout";
+    if (sinks[0].fd < 0)
+    {
+        perror("Error occured while setting up stdout");
+        exit(-1);
+    }
+    for (int i = 1; i < nsinks; ++i)
+    {
+        sinks[i].name = paths[i - 1];
+        sinks[i].fd = open(paths[i - 1], O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        if (sinks[i].fd < 0)
+        {
+            fprintf(stderr, "Error occured while opening %s: %s\n", paths[i - 1], strerror(errno));
+            exit(-2);
+        }
+    }
+
+    /* the smallest lag pipe decides the chunk size, so a chunk always fits */
+    size_t lag_size = SIZE_MAX;
+    for (int i = 0; i < nsinks; ++i)
+    {
+        /* stdout is non-blocking already, see open_tee_stdout() */
+        int flags = i > 0 ? fcntl(sinks[i].fd, F_GETFL) : 0;
+        if (i > 0 && (flags == -1 || fcntl(sinks[i].fd, F_SETFL, flags | O_NONBLOCK) == -1))
+        {
+            fprintf(stderr, "Error occured while setting up %s: %s\n", sinks[i].name, strerror(errno));
+            exit(-1);
+        }
+        if (pipe2(sinks[i].lag, O_NONBLOCK | O_CLOEXEC) < 0)
+        {
+            perror("Error occured while creating pipe");
+            exit(-1);
+        }
+        fcntl(sinks[i].lag[1], F_SETPIPE_SZ, (int)(buffer_size < INT_MAX ? buffer_size : INT_MAX));
+        int size = fcntl(sinks[i].lag[1], F_GETPIPE_SZ);
+        if (size > 0 && (size_t)size < lag_size)
+        {
+            lag_size = (size_t)size;
+        }
+    }
+    size_t chunk = lag_size / 4;
+    alloc_buffer(STDIN_FILENO);
+    if (chunk > buf_size)
+    {
+        chunk = buf_size;
+    }
+    if (chunk < 4096)
+    {
+        chunk = 4096;
+    }
+    for (int i = 0; i < nsinks; ++i)
+    {
+        sinks[i].over = malloc(chunk);
+        sinks[i].out = malloc(chunk);
+        sinks[i].out_cap = chunk;
+        if (sinks[i].over == NULL || sinks[i].out == NULL)
+        {
+            perror("Error occured while allocating memory");
+            exit(-1);
+        }
+    }
+
+    struct stat in_sb;
+    bool in_pipe = fstat(STDIN_FILENO, &in_sb) == 0 && S_ISFIFO(in_sb.st_mode);
+    bool copy_in = false;
+    int src[2] = {-1, -1};
+    if (!in_pipe && pipe2(src, O_CLOEXEC) < 0)
+    {
+        perror("Error occured while creating pipe");
+        exit(-1);
+    }
+    if (!in_pipe)
+    {
+        fcntl(src[1], F_SETPIPE_SZ, (int)chunk);
+    }
+    int devnull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+
+    struct pollfd* pfds = calloc((size_t)nsinks + 1, sizeof(*pfds));
+    if (pfds == NULL)
+    {
+        perror("Error occured while allocating memory");
+        exit(-1);
+    }
+
+    bool eof = false;
+    for (;;)
+    {
+        bool pending = false;
+        bool room = true;
+        for (int i = 0; i < nsinks; ++i)
+        {
+            flush_sink(&sinks[i]);
+            pending = pending || sink_pending(&sinks[i]);
+            room = room && sinks[i].over_len == 0 && pipe_used(sinks[i].lag[0]) + chunk <= lag_size;
+        }
+        if (eof && !pending)
+        {
+            break;
+        }
+
+        /* input waits while any output is a full buffer behind: that is the backpressure */
+        bool want_input = !eof && room;
+        nfds_t nfds = 0;
+        if (want_input)
+        {
+            pfds[nfds].fd = STDIN_FILENO;
+            pfds[nfds++].events = POLLIN;
+        }
+        for (int i = 0; i < nsinks; ++i)
+        {
+            if (sink_pending(&sinks[i]))
+            {
+                pfds[nfds].fd = sinks[i].fd;
+                pfds[nfds++].events = POLLOUT;
+            }
+        }
+        if (nfds == 0)
+        {
+            continue;
+        }
+        if (poll(pfds, nfds, -1) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("Error occured while polling");
+            exit(-3);
+        }
+        if (!want_input || pfds[0].revents == 0)
+        {
+            continue;
+        }
+
+        ssize_t n;
+        if (copy_in)
+        {
+            n = read(STDIN_FILENO, buf, chunk);
+        }
+        else if (in_pipe)
+        {
+            /* tee straight from the input pipe: whatever is in it now */
+            n = (ssize_t)pipe_used(STDIN_FILENO);
+            if (n > (ssize_t)chunk)
+            {
+                n = (ssize_t)chunk;
+            }
+        }
+        else
+        {
+            n = splice(STDIN_FILENO, NULL, src[1], NULL, chunk, SPLICE_F_MOVE);
+            if (n < 0 && errno == EINVAL)
+            {
+                copy_in = true;
+                continue;
+            }
+        }
+
+        if (n < 0)
+        {
+            if (errno == EINTR || errno == EAGAIN)
+            {
+                continue;
+            }
+            perror("Error occured while reading input");
+            exit(-2);
+        }
+        if (n == 0)
+        {
+            eof = true;
+            continue;
+        }
+
+        if (copy_in)
+        {
+            for (int i = 0; i < nsinks; ++i)
+            {
+                memcpy(sinks[i].over, buf, (size_t)n);
+                sinks[i].over_off = 0;
+                sinks[i].over_len = (size_t)n;
+            }
+        }
+        else
+        {
+            tee_chunk(in_pipe ? STDIN_FILENO : src[0], (size_t)n, sinks, nsinks, devnull);
+        }
+    }
+
+    for (int i = 0; i < nsinks; ++i)
+    {
+        if (sinks[i].fd != STDOUT_FILENO && close(sinks[i].fd) < 0)
+        {
+            fprintf(stderr, "Error occured while closing %s: %s\n", sinks[i].name, strerror(errno));
+            exit(4);
+        }
+        close(sinks[i].lag[0]);
+        close(sinks[i].lag[1]);
+        free(sinks[i].over);
+        free(sinks[i].out);
+    }
+    free(sinks);
+    free(pfds);
+    free(buf);
+}
+
+/* "256K", "1M" or a plain byte count */
+static bool parse_size(const char* s, size_t* out)
+{
+    char* end = NULL;
+    errno = 0;
+    unsigned long long n = strtoull(s, &end, 10);
+    if (end == s || errno != 0)
+    {
+        return false;
+    }
+    if (*end == 'K' || *end == 'k')
+    {
+        n <<= 10;
+        end++;
+    }
+    else if (*end == 'M' || *end == 'm')
+    {
+        n <<= 20;
+        end++;
+    }
+    if (*end != '\0' || n == 0)
+    {
+        return false;
+    }
+    *out = (size_t)n;
+    return true;
+}
+
+static void print_usage(const char* program_name)
+{
+    printf("Usage: %s [options] <filepath>\n", program_name);
+    printf("       %s --tee [--tee-buffer=<size>] <out>...\n", program_name);
+    printf("Options:\n");
+    printf("\t-n: Number all output lines\n");
+    printf("\t-s: Suppress repeated empty output lines\n");
+    printf("\t-l: Print the number of lines instead of the content\n");
+    printf("\t-f, --follow: Keep printing data appended to the file, across log rotation\n");
+    printf("\t--tee: Copy stdin to stdout and to every <out>, with tee()/splice() where possible\n");
+    printf("\t--tee-buffer=<size>: How far one --tee output may fall behind the others (default 256K)\n");
+    printf("\t-h: Show this help message\n");
+}
+
+int main(int argc, char** argv)
+{
+    static const struct option long_options[] = {
+        {"follow", no_argument, NULL, 'f'},
+        {"help", no_argument, NULL, 'h'},
+        {"tee", no_argument, NULL, 'T'},
+        {"tee-buffer", required_argument, NULL, 'B'},
+        {NULL, 0, NULL, 0}
+    };
+
+    Options options = {false, false, false, false};
+    bool tee = false;
+    size_t tee_buffer = TEE_BUFFER;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "nslfh", long_options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'n': options.number = true; break;
+        case 's': options.squeeze = true; break;
+        case 'l': options.count = true; break;
+        case 'f': options.follow = true; break;
+        case 'T': tee = true; break;
+        case 'B':
+            if (!parse_size(optarg, &tee_buffer))
+            {
+                fprintf(stderr, "Invalid --tee-buffer size: %s\n", optarg);
+                exit(-1);
+            }
+            break;
+        case 'h':
+            print_usage(argv[0]);
+            exit(EXIT_SUCCESS);
+        default:
+            print_usage(argv[0]);
+            exit(-1);
+        }
+    }
+
+    if (tee)
+    {
+        if (argc - optind < 1 || options.number || options.squeeze || options.count || options.follow)
+        {
+            print_usage(argv[0]);
+            exit(-1);
+        }
+        tee_mode(argv + optind, argc - optind, tee_buffer);
+        return 0;
+    }
+
+    if (argc - optind != 1 || (options.follow && options.count))
+    {
+        //! output error statement and exit
+        print_usage(argv[0]);
+        exit (-1);
+    }
+
+    const char* filename=argv[optind];
+
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        perror("Error occured while opening file");
+        exit (-2);
+    }
+
+    select_kernels();
+    alloc_buffer(fd);
+    if (rio_writer_init(&out, STDOUT_FILENO, NULL, rio_buffer_size(STDOUT_FILENO, OUT_COUNT)) == -1)
+    {
+        rio_error("Error occured while allocating memory", NULL);
+        exit(-1);
+    }
+
+    LineState st;
+    init_line_state(&st);
+
+    drain(fd, &options, &st);
+
+    if (options.count)
+    {
+        char line[32];
+        emit(line, (size_t)snprintf(line, sizeof(line), "%llu\n", st.lines));
+    }
+    flush_out();
+
+    if (options.follow)
+    {
+        follow(filename, fd, &options, &st);
+    }
+
+    if (close (fd) < 0)
+    {
+        perror("Error occured while closing file descriptor\n");
+        exit(4);
+    }
+    rio_writer_free(&out);
+    free(buf);
+
+    return 0;
+}
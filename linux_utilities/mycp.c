@@ -1,55 +1,1357 @@
+#define _GNU_SOURCE
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
 #include <errno.h>
+#include <getopt.h>
+#include <libgen.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <unistd.h>
 
-#define COUNT 4096
+#include "checksum.h"
+#include "robust_io.h"
+
+#define COUNT (128 * 1024)                /* minimum copy buffer size */
+#define ZERO_BLOCK 4096                   /* granularity of --sparse=always zero detection */
+#define DIRECT_ALIGN 4096                 /* buffer and length alignment for O_DIRECT */
+#define DIRECT_CHUNK (1024 * 1024)        /* bytes per in-flight buffer in --direct mode */
+#define DIRECT_BUFS 4                     /* buffers shared by the reader and writer */
+#define DROP_LAG (4 * 1024 * 1024)        /* written data kept in cache before it is dropped */
+#define WRITEBACK_CHUNK (8 * 1024 * 1024) /* start writeback every 8 MiB with --durable */
+#define SMALL_FILE_MAX (64 * 1024)        /* files up to this size go to the worker pool */
+#define MAX_WORKERS 8                     /* threads copying small files */
+
+typedef enum
+{
+    SPARSE_AUTO,   /* follow the holes already present in the source */
+    SPARSE_ALWAYS, /* additionally turn all-zero blocks into holes */
+    SPARSE_NEVER   /* plain byte-for-byte copy, fully allocated */
+} sparse_mode_t;
+
+typedef enum
+{
+    DURABLE_NONE, /* leave writeback to the kernel */
+    DURABLE_FILE, /* fsync every file and its directory */
+    DURABLE_BATCH /* wait for data writeback per file, one syncfs() at the end */
+} durable_mode_t;
+
+typedef struct
+{
+    sparse_mode_t sparse_mode;
+    checksum_algo_t checksum_algo;
+    bool verify;
+    bool direct;
+    bool atomic;
+} copy_options_t;
+
+/* one source file, stat'ed before any copying starts */
+typedef struct
+{
+    const char* source;
+    char destination[PATH_MAX]; /* for messages and checksum output */
+    char base[NAME_MAX + 1];    /* name inside the destination directory */
+    bool valid;
+    bool regular;
+    bool small; /* copied by the small-file pool */
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    blkcnt_t blocks;
+    int status;                      /* 0, or the exit status of a failed copy */
+    char checksum[CHECKSUM_HEX_MAX]; /* digest printed once all copies are done */
+} copy_job_t;
+
+typedef struct
+{
+    const copy_options_t* options;
+    copy_job_t** jobs;
+    size_t count;
+    int dir_fd;
+    atomic_size_t next; /* index of the next job to hand out */
+} small_pool_t;
+
+typedef struct
+{
+    int fd;
+    int dir_fd; /* destination directory, shared by all files */
+    bool atomic;
+    bool tmpfile;     /* fd is an unnamed O_TMPFILE */
+    const char* path; /* final destination, for messages */
+    char base[NAME_MAX + 1];
+    char tmp_name[NAME_MAX + 1]; /* hidden temporary name in dir_fd, empty if none */
+} dest_t;
+
+typedef struct
+{
+    char* data;
+    size_t len;
+} direct_buf_t;
+
+/* buffers cycle reader -> writer: [head, head + filled) hold data to be written */
+typedef struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    direct_buf_t bufs[DIRECT_BUFS];
+    size_t head;
+    size_t tail;
+    size_t filled;
+    bool eof;
+    bool failed;
+    int read_errno;
+    int fd_in;
+} direct_ring_t;
+
+/* per thread, small files are copied by several workers at once; see reserve_buffer() */
+static _Thread_local char* buf;
+static _Thread_local size_t buf_size;
+static _Thread_local off_t wb_kicked; /* end of the range already handed to writeback */
+static durable_mode_t durable_mode = DURABLE_NONE;
+
+static void print_usage(const char* program_name)
+{
+    printf("Usage: %s [options] <source> <destination>\n", program_name);
+    printf("       %s [options] <source>... <directory>\n", program_name);
+    printf("Options:\n");
+    printf("\t--sparse=WHEN: create sparse destination files (auto, always, never; default auto)\n");
+    printf("\t--checksum=ALGO: hash the data while copying and print it (crc32c, xxh64)\n");
+    printf("\t--direct: bypass the page cache with O_DIRECT and double buffering\n");
+    printf("\t--atomic: write to a temporary file and rename it over the destination\n");
+    printf("\t--durable=MODE: make the copy crash-safe (none, file, batch; default none)\n");
+    printf("\t--verify: re-read the destination with O_DIRECT and compare its checksum\n");
+    printf("\t-h, --help: Show this help message\n");
+}
+
+/**
+ * Start asynchronous writeback of what has been written so far, in
+ * WRITEBACK_CHUNK steps, so the final sync has little left to wait for.
+ */
+static void kick_writeback(int fd, off_t end)
+{
+    if (durable_mode == DURABLE_NONE || end - wb_kicked < WRITEBACK_CHUNK)
+    {
+        return;
+    }
+    sync_file_range(fd, wb_kicked, end - wb_kicked, SYNC_FILE_RANGE_WRITE);
+    wb_kicked = end;
+}
+
+/**
+ * Open a directory once so that every file below it is created and renamed
+ * relative to it instead of resolving the full path again
+ */
+static int open_destination_dir(const char* dir)
+{
+    int dir_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd == -1)
+    {
+        perror("Error while opening destination directory");
+        exit(-1);
+    }
+    return dir_fd;
+}
+
+/**
+ * Create a hidden ".name.<pid>.<n>" entry next to the destination, either as
+ * a new file (fd_src == -1) or as a link to the unnamed O_TMPFILE fd_src.
+ * @return file descriptor of the new file, 0 for a link, or -1 on error
+ */
+static int create_hidden(dest_t* d, int fd_src)
+{
+    char proc_path[64];
+    snprintf(proc_path, sizeof(proc_path), "/proc/self/fd/%d", fd_src);
+
+    for (unsigned i = 0;; ++i)
+    {
+        if (snprintf(d->tmp_name, sizeof(d->tmp_name), ".%s.%ld.%u", d->base, (long)getpid(), i)
+            >= (int)sizeof(d->tmp_name))
+        {
+            fprintf(stderr, "Error: destination name is too long\n");
+            d->tmp_name[0] = '\0';
+            return -1;
+        }
+
+        int rc = fd_src == -1
+                     ? openat(d->dir_fd, d->tmp_name, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600)
+                     : linkat(AT_FDCWD, proc_path, d->dir_fd, d->tmp_name, AT_SYMLINK_FOLLOW);
+        if (rc != -1)
+        {
+            return rc;
+        }
+        if (errno != EEXIST)
+        {
+            perror("Error while creating temporary destination file");
+            d->tmp_name[0] = '\0';
+            return -1;
+        }
+    }
+}
+
+/**
+ * Open the file that receives the copy of 'base' inside dir_fd. Without
+ * --atomic this is the destination itself; with it, an unnamed O_TMPFILE in
+ * the target directory or, where the filesystem lacks O_TMPFILE, a hidden
+ * temporary file. Nothing is visible under the destination name until
+ * commit_destination().
+ * @return 0 on success, otherwise the exit status for the reported error
+ */
+static int open_destination(int dir_fd, const char* base, const char* path, bool atomic, dest_t* d)
+{
+    memset(d, 0, sizeof(*d));
+    d->dir_fd = dir_fd;
+    d->path = path;
+    d->atomic = atomic;
+    snprintf(d->base, sizeof(d->base), "%s", base);
+    wb_kicked = 0;
+
+    if (!atomic)
+    {
+        d->fd = openat(dir_fd, base, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (d->fd == -1)
+        {
+            fprintf(stderr, "Error while opening destination file '%s': %s\n", path, strerror(errno));
+            return -1;
+        }
+        return 0;
+    }
+
+    /* keep the permissions of a file that is being replaced */
+    struct stat st;
+    mode_t mode = 0644;
+    if (fstatat(dir_fd, base, &st, 0) == 0)
+    {
+        if (!S_ISREG(st.st_mode))
+        {
+            fprintf(stderr, "Error: --atomic needs a regular file destination\n");
+            d->fd = -1;
+            return -1;
+        }
+        mode = st.st_mode & 07777;
+    }
+
+    d->fd = openat(dir_fd, ".", O_TMPFILE | O_WRONLY | O_CLOEXEC, 0600);
+    if (d->fd != -1)
+    {
+        d->tmpfile = true;
+    }
+    else
+    {
+        d->fd = create_hidden(d, -1);
+        if (d->fd == -1)
+        {
+            return -1;
+        }
+    }
+    fchmod(d->fd, mode);
+    return 0;
+}
+
+/**
+ * Give up on a destination after a failed copy: close it and remove the
+ * temporary name of an --atomic copy, so the old file stays untouched.
+ */
+static void abort_destination(dest_t* d)
+{
+    if (d->fd != -1)
+    {
+        close(d->fd);
+        d->fd = -1;
+    }
+    if (d->tmp_name[0] != '\0')
+    {
+        unlinkat(d->dir_fd, d->tmp_name, 0);
+        d->tmp_name[0] = '\0';
+    }
+}
+
+/**
+ * Make the copied data durable as requested and move it into place.
+ *  file:  fsync the file before it gets its final name
+ *  batch: only wait for the writeback started by kick_writeback()
+ * The directory itself is synced once by sync_destination_dir().
+ * @return 0 on success, otherwise the exit status for the reported error
+ */
+static int commit_destination(dest_t* d)
+{
+    if (durable_mode == DURABLE_FILE && fsync(d->fd) == -1)
+    {
+        perror("Error while syncing destination file");
+        abort_destination(d);
+        return -2;
+    }
+    if (durable_mode == DURABLE_BATCH)
+    {
+        sync_file_range(d->fd, 0, 0, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+    }
+
+    if (d->atomic && d->tmpfile)
+    {
+        /* give the unnamed file a name; link to a temporary one first if the destination exists */
+        char proc_path[64];
+        snprintf(proc_path, sizeof(proc_path), "/proc/self/fd/%d", d->fd);
+        if (linkat(AT_FDCWD, proc_path, d->dir_fd, d->base, AT_SYMLINK_FOLLOW) == -1)
+        {
+            if (errno != EEXIST)
+            {
+                perror("Error while linking destination file");
+                abort_destination(d);
+                return -2;
+            }
+            if (create_hidden(d, d->fd) == -1)
+            {
+                abort_destination(d);
+                return -2;
+            }
+        }
+    }
+
+    if (d->atomic && d->tmp_name[0] != '\0' && renameat(d->dir_fd, d->tmp_name, d->dir_fd, d->base) == -1)
+    {
+        perror("Error while renaming destination file");
+        abort_destination(d);
+        return -2;
+    }
+
+    close(d->fd);
+    d->fd = -1;
+    return 0;
+}
+
+/**
+ * End of a durable run, once per destination directory: fsync the directory
+ * for --durable=file; for --durable=batch one syncfs() commits all files and
+ * renames on the filesystem instead of an fsync per file.
+ */
+static void sync_destination_dir(int dir_fd)
+{
+    if (durable_mode == DURABLE_FILE && fsync(dir_fd) == -1)
+    {
+        perror("Error while syncing destination directory");
+        exit(-2);
+    }
+    if (durable_mode == DURABLE_BATCH && syncfs(dir_fd) == -1)
+    {
+        perror("Error while syncing destination filesystem");
+        exit(-2);
+    }
+}
+
+/**
+ * Check whether a block contains only zero bytes.
+ * The first 16 bytes are tested directly, then the block is compared against
+ * itself shifted by 16 bytes, which lets libc's vectorized memcmp do the work.
+ */
+static bool is_zero_block(const char* p, size_t len)
+{
+    size_t head = len < 16 ? len : 16;
+    for (size_t i = 0; i < head; ++i)
+    {
+        if (p[i] != 0)
+        {
+            return false;
+        }
+    }
+
+    return len <= 16 || memcmp(p, p + 16, len - 16) == 0;
+}
+
+/**
+ * Make this thread's copy buffer at least as large as fd's st_blksize (and
+ * COUNT). The buffer is kept for the following files and released by
+ * release_buffer() when the thread is done.
+ * @return 0 on success, -1 after reporting an allocation failure
+ */
+static int reserve_buffer(int fd)
+{
+    size_t size = rio_buffer_size(fd, COUNT);
+    if (size <= buf_size)
+    {
+        return 0;
+    }
+
+    char* p = rio_alloc(size);
+    if (p == NULL)
+    {
+        rio_error("Error while allocating copy buffer", NULL);
+        return -1;
+    }
+    free(buf);
+    buf = p;
+    buf_size = size;
+    return 0;
+}
+
+static void release_buffer(void)
+{
+    free(buf);
+    buf = NULL;
+    buf_size = 0;
+}
+
+/**
+ * Copy the byte range [start, end) from fd_in to the same offsets in fd_out.
+ * With skip_zeros, all-zero blocks are not written and stay holes in the destination.
+ * When sum is not NULL the data is hashed while it is still in the copy buffer.
+ * @return 0 on success, otherwise the exit status for the reported error
+ */
+static int copy_range(int fd_in, int fd_out, off_t start, off_t end, bool skip_zeros, checksum_t* sum)
+{
+    off_t pos = start;
+    while (pos < end)
+    {
+        size_t want = (end - pos) < (off_t)buf_size ? (size_t)(end - pos) : buf_size;
+        ssize_t n = rio_pread_full(fd_in, buf, want, pos);
+        if (n < 0)
+        {
+            rio_error("Error while reading from source file", NULL);
+            return -3;
+        }
+        if (n == 0)
+        {
+            /* source shrank while copying */
+            break;
+        }
+
+        if (sum != NULL)
+        {
+            checksum_update(sum, buf, (size_t)n);
+        }
+
+        for (ssize_t off = 0; off < n; off += ZERO_BLOCK)
+        {
+            size_t len = (n - off) < ZERO_BLOCK ? (size_t)(n - off) : ZERO_BLOCK;
+            if (skip_zeros && is_zero_block(buf + off, len))
+            {
+                continue;
+            }
+            if (rio_pwrite_full(fd_out, buf + off, len, pos + off) == -1)
+            {
+                rio_error("Error while writing to destination file", NULL);
+                return -2;
+            }
+        }
+        pos += n;
+        kick_writeback(fd_out, pos);
+    }
+    return 0;
+}
+
+/**
+ * Copy a regular file by walking its data extents with SEEK_DATA/SEEK_HOLE.
+ * The destination was opened with O_TRUNC, so every skipped range is already
+ * a hole; the final ftruncate() recreates a trailing hole and sets the size.
+ * @return 0 on success, otherwise the exit status for the reported error
+ */
+static int copy_sparse(int fd_in, int fd_out, off_t size, bool skip_zeros, checksum_t* sum)
+{
+    off_t pos = 0;
+    while (pos < size)
+    {
+        off_t data = lseek(fd_in, pos, SEEK_DATA);
+        if (data == -1)
+        {
+            if (errno == ENXIO)
+            {
+                /* no more data: the rest of the file is a hole */
+                break;
+            }
+            /* filesystem cannot report extents, treat the rest as data */
+            int rc = copy_range(fd_in, fd_out, pos, size, skip_zeros, sum);
+            if (rc != 0)
+            {
+                return rc;
+            }
+            pos = size;
+            break;
+        }
+
+        off_t hole = lseek(fd_in, data, SEEK_HOLE);
+        if (hole == -1 || hole > size)
+        {
+            hole = size;
+        }
+
+        if (sum != NULL)
+        {
+            checksum_update_zeros(sum, (uint64_t)(data - pos));
+        }
+        int rc = copy_range(fd_in, fd_out, data, hole, skip_zeros, sum);
+        if (rc != 0)
+        {
+            return rc;
+        }
+        pos = hole;
+    }
+
+    if (sum != NULL && pos < size)
+    {
+        checksum_update_zeros(sum, (uint64_t)(size - pos));
+    }
+
+    if (ftruncate(fd_out, size) == -1)
+    {
+        perror("Error while setting destination file size");
+        return -2;
+    }
+    return 0;
+}
+
+/**
+ * Sequential copy used for non-seekable sources/destinations and --sparse=never.
+ * @return 0 on success, otherwise the exit status for the reported error
+ */
+static int copy_stream(int fd_in, int fd_out, checksum_t* sum)
+{
+    off_t written = 0;
+    ssize_t n;
+    while ((n = rio_read(fd_in, buf, buf_size)) != 0)
+    {
+        if (n < 0)
+        {
+            rio_error("Error while reading from source file", NULL);
+            return -3;
+        }
+
+        if (sum != NULL)
+        {
+            checksum_update(sum, buf, (size_t)n);
+        }
+
+        if (rio_write_full(fd_out, buf, (size_t)n) == -1)
+        {
+            rio_error("Error while writing to destination file", NULL);
+            return -2;
+        }
+        written += n;
+        kick_writeback(fd_out, written);
+    }
+    return 0;
+}
+
+static int set_direct(int fd)
+{
+    /* O_DIRECT turns pipes into packet mode, only use it on regular files */
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode))
+    {
+        return -1;
+    }
+
+    int flags = fcntl(fd, F_GETFL);
+    return flags == -1 ? -1 : fcntl(fd, F_SETFL, flags | O_DIRECT);
+}
+
+static int drop_direct(int fd)
+{
+    int flags = fcntl(fd, F_GETFL);
+    if (flags == -1 || !(flags & O_DIRECT))
+    {
+        return -1;
+    }
+    return fcntl(fd, F_SETFL, flags & ~O_DIRECT);
+}
+
+/**
+ * Read as much as fits into the buffer, stopping only at end of file,
+ * so that every chunk except the last one stays a multiple of DIRECT_ALIGN.
+ * An O_DIRECT read rejected with EINVAL drops O_DIRECT and is retried.
+ */
+static ssize_t direct_fill(int fd, char* p, size_t len)
+{
+    size_t got = 0;
+    while (got < len)
+    {
+        ssize_t n = read(fd, p + got, len - got);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EINVAL && drop_direct(fd) == 0)
+            {
+                continue;
+            }
+            return -1;
+        }
+        if (n == 0)
+        {
+            break;
+        }
+        got += (size_t)n;
+    }
+
+    return (ssize_t)got;
+}
+
+/**
+ * Write one chunk; the unaligned tail of the last chunk is written after
+ * clearing O_DIRECT, since direct I/O only accepts block-sized lengths.
+ */
+static int direct_write(int fd, const char* p, size_t len)
+{
+    size_t aligned = len & ~(size_t)(DIRECT_ALIGN - 1);
+    while (len > 0)
+    {
+        size_t want = aligned > 0 ? aligned : len;
+        ssize_t n = write(fd, p, want);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EINVAL && drop_direct(fd) == 0)
+            {
+                aligned = 0;
+                continue;
+            }
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+        aligned = aligned > (size_t)n ? aligned - (size_t)n : 0;
+        if (aligned == 0 && len > 0)
+        {
+            drop_direct(fd);
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Buffered fallback for --direct: wait for the writeback of [from, to) to
+ * finish and drop it from the page cache. FADV_DONTNEED skips dirty pages,
+ * so the range has to be clean first.
+ */
+static void drop_written(int fd, off_t from, off_t to)
+{
+    if (to <= from)
+    {
+        return;
+    }
+    sync_file_range(fd, from, to - from,
+                    SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+    posix_fadvise(fd, from, to - from, POSIX_FADV_DONTNEED);
+}
+
+static void* direct_reader(void* arg)
+{
+    direct_ring_t* ring = arg;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&ring->lock);
+        while (ring->filled == DIRECT_BUFS && !ring->failed)
+        {
+            pthread_cond_wait(&ring->cond, &ring->lock);
+        }
+        if (ring->failed)
+        {
+            pthread_mutex_unlock(&ring->lock);
+            return NULL;
+        }
+        direct_buf_t* slot = &ring->bufs[ring->tail];
+        pthread_mutex_unlock(&ring->lock);
+
+        /* the slot is free, fill it without holding the lock */
+        ssize_t n = direct_fill(ring->fd_in, slot->data, DIRECT_CHUNK);
+
+        pthread_mutex_lock(&ring->lock);
+        if (n < 0)
+        {
+            ring->read_errno = errno;
+            ring->failed = true;
+        }
+        else if (n == 0)
+        {
+            ring->eof = true;
+        }
+        else
+        {
+            slot->len = (size_t)n;
+            ring->tail = (ring->tail + 1) % DIRECT_BUFS;
+            ring->filled++;
+        }
+        bool done = ring->eof || ring->failed;
+        pthread_cond_broadcast(&ring->cond);
+        pthread_mutex_unlock(&ring->lock);
+
+        if (done)
+        {
+            return NULL;
+        }
+    }
+}
+
+/**
+ * Copy with O_DIRECT on both descriptors so neither file goes through the page
+ * cache. A reader thread fills DIRECT_BUFS aligned buffers while this thread
+ * writes the previous ones, keeping a read and a write in flight at once.
+ * Filesystems that reject O_DIRECT fall back to buffered I/O with the written
+ * range dropped from the cache as it goes.
+ * @return number of bytes copied, -1 with errno set on error
+ */
+static off_t copy_direct(int fd_in, int fd_out, checksum_t* sum)
+{
+    bool in_direct = set_direct(fd_in) == 0;
+    bool out_direct = set_direct(fd_out) == 0;
+    if (!in_direct || !out_direct)
+    {
+        fprintf(stderr, "O_DIRECT not supported on %s, using buffered I/O with cache dropping\n",
+                !in_direct ? "source" : "destination");
+    }
+
+    direct_ring_t ring;
+    memset(&ring, 0, sizeof(ring));
+    ring.fd_in = fd_in;
+    pthread_mutex_init(&ring.lock, NULL);
+    pthread_cond_init(&ring.cond, NULL);
+
+    off_t copied = 0;
+    off_t dropped = 0; /* destination cache below this offset is already dropped */
+    int write_errno = 0;
+    int err = 0;
+    for (int i = 0; i < DIRECT_BUFS && err == 0; ++i)
+    {
+        void* p = NULL;
+        err = posix_memalign(&p, DIRECT_ALIGN, DIRECT_CHUNK);
+        ring.bufs[i].data = p;
+    }
+    pthread_t reader;
+    if (err != 0 || (err = pthread_create(&reader, NULL, direct_reader, &ring)) != 0)
+    {
+        goto done;
+    }
+
+    for (;;)
+    {
+        pthread_mutex_lock(&ring.lock);
+        while (ring.filled == 0 && !ring.eof && !ring.failed)
+        {
+            pthread_cond_wait(&ring.cond, &ring.lock);
+        }
+        if (ring.filled == 0 || ring.failed)
+        {
+            pthread_mutex_unlock(&ring.lock);
+            break;
+        }
+        direct_buf_t* slot = &ring.bufs[ring.head];
+        pthread_mutex_unlock(&ring.lock);
+
+        if (sum != NULL)
+        {
+            checksum_update(sum, slot->data, slot->len);
+        }
+        if (direct_write(fd_out, slot->data, slot->len) == -1)
+        {
+            write_errno = errno;
+        }
+        else if (!out_direct)
+        {
+            /* start writeback now, drop an older window once it had time to complete */
+            sync_file_range(fd_out, copied, (off_t)slot->len, SYNC_FILE_RANGE_WRITE);
+            if (copied + (off_t)slot->len - dropped > DROP_LAG)
+            {
+                drop_written(fd_out, dropped, copied);
+                dropped = copied;
+            }
+        }
+        if (!in_direct)
+        {
+            posix_fadvise(fd_in, copied, (off_t)slot->len, POSIX_FADV_DONTNEED);
+        }
+        copied += (off_t)slot->len;
+
+        pthread_mutex_lock(&ring.lock);
+        if (write_errno != 0)
+        {
+            ring.failed = true;
+        }
+        ring.head = (ring.head + 1) % DIRECT_BUFS;
+        ring.filled--;
+        pthread_cond_broadcast(&ring.cond);
+        pthread_mutex_unlock(&ring.lock);
+
+        if (write_errno != 0)
+        {
+            break;
+        }
+    }
+
+    pthread_join(reader, NULL);
+    if (!out_direct && write_errno == 0)
+    {
+        drop_written(fd_out, dropped, copied);
+    }
+    err = write_errno != 0 ? write_errno : ring.read_errno;
+
+done:
+    for (int i = 0; i < DIRECT_BUFS; ++i)
+    {
+        free(ring.bufs[i].data);
+    }
+    pthread_mutex_destroy(&ring.lock);
+    pthread_cond_destroy(&ring.cond);
+
+    if (err != 0)
+    {
+        errno = err;
+        return -1;
+    }
+    return copied;
+}
+
+/**
+ * Size of the page cache in KiB as reported by /proc/meminfo, or -1
+ */
+static long page_cache_kib(void)
+{
+    FILE* fp = fopen("/proc/meminfo", "r");
+    if (fp == NULL)
+    {
+        return -1;
+    }
+
+    char line[128];
+    long kib = -1;
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        if (sscanf(line, "Cached: %ld kB", &kib) == 1)
+        {
+            break;
+        }
+    }
+    fclose(fp);
+
+    return kib;
+}
+
+/**
+ * Re-read the destination, bypassing the page cache where the filesystem
+ * allows O_DIRECT, and compare its digest with the one computed while copying.
+ * @return 0 if the digests match, otherwise the exit status for the reported mismatch or error
+ */
+static int verify_destination(int dir_fd, const char* base, const char* path, const checksum_t* expected)
+{
+    int fd = openat(dir_fd, base, O_RDONLY | O_DIRECT | O_CLOEXEC);
+    if (fd == -1 && errno == EINVAL)
+    {
+        /* no O_DIRECT support: flush and drop the cached pages instead */
+        fd = openat(dir_fd, base, O_RDONLY | O_CLOEXEC);
+        if (fd != -1)
+        {
+            fdatasync(fd);
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        }
+    }
+    if (fd == -1)
+    {
+        perror("Error while opening destination file for verification");
+        return -4;
+    }
+
+    /* page-aligned, which also satisfies O_DIRECT */
+    size_t vsize = rio_buffer_size(fd, COUNT);
+    void* vbuf = rio_alloc(vsize);
+    if (vbuf == NULL)
+    {
+        rio_error("Error while allocating verification buffer", NULL);
+        close(fd);
+        return -4;
+    }
+
+    checksum_t actual;
+    checksum_init(&actual, expected->algo);
+
+    ssize_t n;
+    while ((n = rio_read(fd, vbuf, vsize)) != 0)
+    {
+        if (n < 0)
+        {
+            rio_error("Error while reading destination file for verification", NULL);
+            free(vbuf);
+            close(fd);
+            return -4;
+        }
+        checksum_update(&actual, vbuf, (size_t)n);
+    }
+
+    free(vbuf);
+    close(fd);
+
+    char want[CHECKSUM_HEX_MAX], got[CHECKSUM_HEX_MAX];
+    checksum_hex(expected, want);
+    checksum_hex(&actual, got);
+    if (strcmp(want, got) != 0)
+    {
+        fprintf(stderr, "checksum mismatch after copying to '%s'\n", path);
+        return -4;
+    }
+    return 0;
+}
+
+/**
+ * Copy one source into 'base' inside dir_fd, picking the engine from the
+ * source's type and size: O_DIRECT pipeline, extent walk for sparse files,
+ * or a sequential copy. The digest, if any, is left in job->checksum.
+ * @return 0 on success, otherwise the exit status for the reported error
+ */
+static int copy_file(const copy_options_t* options, copy_job_t* job, int dir_fd)
+{
+    int fd1 = open(job->source, O_RDONLY | O_CLOEXEC);
+    if (fd1 == -1)
+    {
+        fprintf(stderr, "Error while opening source file '%s': %s\n", job->source, strerror(errno));
+        return -1;
+    }
+
+    dest_t dest;
+    int rc = open_destination(dir_fd, job->base, job->destination, options->atomic, &dest);
+    if (rc != 0)
+    {
+        abort_destination(&dest);
+        close(fd1);
+        return rc;
+    }
+    int fd2 = dest.fd;
+
+    struct stat dst_st;
+    if (fstat(fd2, &dst_st) == -1)
+    {
+        perror("Error while getting file status");
+        abort_destination(&dest);
+        close(fd1);
+        return -1;
+    }
+
+    checksum_t sum;
+    checksum_t* psum = NULL;
+    if (options->checksum_algo != CHECKSUM_NONE)
+    {
+        checksum_init(&sum, options->checksum_algo);
+        psum = &sum;
+    }
+
+    /* holes can only be recreated between two regular files; size 0 may be a procfs file */
+    bool seekable = job->regular && S_ISREG(dst_st.st_mode) && job->size > 0;
+    if (!options->direct && reserve_buffer(fd1) != 0)
+    {
+        abort_destination(&dest);
+        close(fd1);
+        return -1;
+    }
+    if (options->direct)
+    {
+        struct timespec t0, t1;
+        long cache_before = page_cache_kib();
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+
+        off_t copied = copy_direct(fd1, fd2, psum);
+        if (copied == -1)
+        {
+            fprintf(stderr, "Error while copying '%s' to '%s': %s\n", job->source, job->destination,
+                    strerror(errno));
+            rc = -1;
+        }
+        else
+        {
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            long cache_after = page_cache_kib();
+            double secs = (double)(t1.tv_sec - t0.tv_sec) + (double)(t1.tv_nsec - t0.tv_nsec) / 1e9;
+            fprintf(stderr, "copied %lld bytes in %.3f s (%.1f MiB/s), page cache delta %+ld KiB\n",
+                    (long long)copied, secs, secs > 0 ? (double)copied / (1024.0 * 1024.0) / secs : 0.0,
+                    cache_after - cache_before);
+        }
+    }
+    else if (!seekable || options->sparse_mode == SPARSE_NEVER)
+    {
+        rc = copy_stream(fd1, fd2, psum);
+    }
+    else if (options->sparse_mode == SPARSE_ALWAYS)
+    {
+        rc = copy_sparse(fd1, fd2, job->size, true, psum);
+    }
+    else if ((off_t)job->blocks * 512 < job->size)
+    {
+        /* auto: the source has holes, copy only its data extents */
+        rc = copy_sparse(fd1, fd2, job->size, false, psum);
+    }
+    else
+    {
+        rc = copy_stream(fd1, fd2, psum);
+    }
+
+    close(fd1);
+    if (rc != 0)
+    {
+        abort_destination(&dest);
+        return rc;
+    }
+    rc = commit_destination(&dest);
+    if (rc != 0)
+    {
+        return rc;
+    }
+
+    if (psum != NULL)
+    {
+        if (options->verify)
+        {
+            rc = verify_destination(dir_fd, job->base, job->destination, psum);
+            if (rc != 0)
+            {
+                return rc;
+            }
+        }
+        checksum_hex(psum, job->checksum);
+    }
+    return 0;
+}
+
+static void* small_file_worker(void* arg)
+{
+    small_pool_t* pool = arg;
+
+    for (;;)
+    {
+        size_t i = atomic_fetch_add(&pool->next, 1);
+        if (i >= pool->count)
+        {
+            release_buffer();
+            return NULL;
+        }
+        /* a failed file is reported and the worker moves on, main() picks up the status */
+        pool->jobs[i]->status = copy_file(pool->options, pool->jobs[i], pool->dir_fd);
+    }
+}
+
+/**
+ * Copy the small files on a pool of threads; for them the cost is in the
+ * open/create/close syscalls rather than in moving data, so several can
+ * proceed in parallel
+ */
+static void copy_small_files(const copy_options_t* options, copy_job_t** jobs, size_t count, int dir_fd)
+{
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t nthreads = ncpu > 0 ? (size_t)ncpu : 1;
+    if (nthreads > MAX_WORKERS)
+    {
+        nthreads = MAX_WORKERS;
+    }
+    if (nthreads > count)
+    {
+        nthreads = count;
+    }
+
+    small_pool_t pool = {options, jobs, count, dir_fd, 0};
+    pthread_t threads[MAX_WORKERS];
+    size_t started = 0;
+    for (; started < nthreads; ++started)
+    {
+        if (pthread_create(&threads[started], NULL, small_file_worker, &pool) != 0)
+        {
+            break;
+        }
+    }
+    if (started == 0)
+    {
+        /* no threads available, copy them here */
+        small_file_worker(&pool);
+    }
+    for (size_t i = 0; i < started; ++i)
+    {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+static int compare_job_base(const void* a, const void* b)
+{
+    const copy_job_t* ja = *(const copy_job_t* const*)a;
+    const copy_job_t* jb = *(const copy_job_t* const*)b;
+    int cmp = strcmp(ja->base, jb->base);
+    if (cmp != 0)
+    {
+        return cmp;
+    }
+    /* same name: keep argv order, jobs[] is one array */
+    return ja < jb ? -1 : ja > jb;
+}
+
+/**
+ * Sources with the same basename would be copied onto the same destination,
+ * possibly at the same time by two workers. Like cp, keep the first of them
+ * in argv order and skip the others with a message.
+ * @return true if any source was skipped
+ */
+static bool skip_duplicates(const char* program, copy_job_t* jobs, size_t count)
+{
+    copy_job_t** sorted = malloc(count * sizeof(*sorted));
+    if (sorted == NULL)
+    {
+        perror("Error while allocating copy jobs");
+        exit(-1);
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (jobs[i].valid)
+        {
+            sorted[n++] = &jobs[i];
+        }
+    }
+    qsort(sorted, n, sizeof(*sorted), compare_job_base);
+
+    bool skipped = false;
+    for (size_t i = 1; i < n; ++i)
+    {
+        if (strcmp(sorted[i]->base, sorted[i - 1]->base) == 0)
+        {
+            fprintf(stderr, "%s: will not overwrite just-created '%s' with '%s'\n", program, sorted[i]->destination,
+                    sorted[i]->source);
+            sorted[i]->valid = false;
+            skipped = true;
+        }
+    }
+    free(sorted);
+    return skipped;
+}
 
 int main(int argc, char** argv)
 {
-	if (argc != 3)
-	{
-		printf("Usage: %s <source> <destination>\n", argv[0]);
-		exit(1);
-	}
-
-	const char* source_file 	 = argv[1];
-	const char* destination_file = argv[2];
-
-	int fd1 = open(source_file, O_RDONLY);
-	if (fd1 == -1)
-	{
-		perror("Error while opening source file");
-		exit(-1);
-	}
-
-	int fd2 = open(destination_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-	if (fd2 == -1)
-	{
-		perror("Error while opening destination file");
-		exit(-1);
-	}
-
-	char buf[COUNT];
-	int n;
-	while ((n = read(fd1, buf, sizeof(buf))) > 0)
-	{
-		if (write(fd2, buf, n) != n)
-		{
-			perror("Error while writing to destination file");
-			exit(-2);
-		}
-	}
-
-	if (n == -1)
-	{
-		perror("Error while reading from source file");
-		exit(-3);
-	}
-
-	close(fd1);
-	close(fd2);
-	
-	return 0;
+    static const struct option long_options[] = {
+        {"sparse", required_argument, NULL, 's'},
+        {"checksum", required_argument, NULL, 'c'},
+        {"verify", no_argument, NULL, 'v'},
+        {"direct", no_argument, NULL, 'd'},
+        {"atomic", no_argument, NULL, 'a'},
+        {"durable", required_argument, NULL, 'D'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+
+    copy_options_t options = {SPARSE_AUTO, CHECKSUM_NONE, false, false, false};
+    int opt;
+    while ((opt = getopt_long(argc, argv, "h", long_options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 's':
+            if (strcmp(optarg, "auto") == 0)
+                options.sparse_mode = SPARSE_AUTO;
+            else if (strcmp(optarg, "always") == 0)
+                options.sparse_mode = SPARSE_ALWAYS;
+            else if (strcmp(optarg, "never") == 0)
+                options.sparse_mode = SPARSE_NEVER;
+            else
+            {
+                fprintf(stderr, "%s: invalid argument '%s' for '--sparse'\n", argv[0], optarg);
+                exit(1);
+            }
+            break;
+        case 'c':
+            if (!checksum_parse(optarg, &options.checksum_algo))
+            {
+                fprintf(stderr, "%s: invalid argument '%s' for '--checksum'\n", argv[0], optarg);
+                exit(1);
+            }
+            break;
+        case 'v':
+            options.verify = true;
+            break;
+        case 'd':
+            options.direct = true;
+            break;
+        case 'a':
+            options.atomic = true;
+            break;
+        case 'D':
+            if (strcmp(optarg, "none") == 0)
+                durable_mode = DURABLE_NONE;
+            else if (strcmp(optarg, "file") == 0)
+                durable_mode = DURABLE_FILE;
+            else if (strcmp(optarg, "batch") == 0)
+                durable_mode = DURABLE_BATCH;
+            else
+            {
+                fprintf(stderr, "%s: invalid argument '%s' for '--durable'\n", argv[0], optarg);
+                exit(1);
+            }
+            break;
+        case 'h':
+            print_usage(argv[0]);
+            exit(EXIT_SUCCESS);
+        default:
+            print_usage(argv[0]);
+            exit(1);
+        }
+    }
+
+    if (argc - optind < 2)
+    {
+        print_usage(argv[0]);
+        exit(1);
+    }
+
+    if (options.verify && options.checksum_algo == CHECKSUM_NONE)
+    {
+        /* verification needs a digest of the source, default to the cheapest one */
+        options.checksum_algo = CHECKSUM_CRC32C;
+    }
+
+    size_t nsources = (size_t)(argc - optind - 1);
+    char** sources = &argv[optind];
+    const char* destination = argv[argc - 1];
+
+    /* several sources, or an existing directory, means "copy into the directory" */
+    struct stat dst_st;
+    bool into_dir = nsources > 1 || (stat(destination, &dst_st) == 0 && S_ISDIR(dst_st.st_mode));
+    if (nsources > 1 && (stat(destination, &dst_st) != 0 || !S_ISDIR(dst_st.st_mode)))
+    {
+        fprintf(stderr, "%s: target '%s' is not a directory\n", argv[0], destination);
+        exit(1);
+    }
+    if (!into_dir && destination[0] != '\0' && destination[strlen(destination) - 1] == '/')
+    {
+        /* "dir/" names a directory, never a file to create */
+        fprintf(stderr, "%s: cannot create regular file '%s': %s\n", argv[0], destination, strerror(ENOTDIR));
+        exit(1);
+    }
+
+    int dir_fd;
+    char dir_copy[PATH_MAX], base_copy[PATH_MAX];
+    if (into_dir)
+    {
+        dir_fd = open_destination_dir(destination);
+    }
+    else
+    {
+        snprintf(dir_copy, sizeof(dir_copy), "%s", destination);
+        dir_fd = open_destination_dir(dirname(dir_copy));
+    }
+
+    copy_job_t* jobs = calloc(nsources, sizeof(*jobs));
+    copy_job_t** small = calloc(nsources, sizeof(*small));
+    if (jobs == NULL || small == NULL)
+    {
+        perror("Error while allocating copy jobs");
+        exit(-1);
+    }
+
+    /* stat every source up front so each one can be routed to the right engine */
+    int status = 0;
+    for (size_t i = 0; i < nsources; ++i)
+    {
+        copy_job_t* job = &jobs[i];
+        job->source = sources[i];
+
+        struct statx stx;
+        if (statx(AT_FDCWD, job->source, 0, STATX_TYPE | STATX_INO | STATX_SIZE | STATX_BLOCKS, &stx) == -1)
+        {
+            fprintf(stderr, "%s: cannot stat '%s': %s\n", argv[0], job->source, strerror(errno));
+            status = 1;
+            continue;
+        }
+        if (S_ISDIR(stx.stx_mode))
+        {
+            fprintf(stderr, "%s: omitting directory '%s'\n", argv[0], job->source);
+            status = 1;
+            continue;
+        }
+        job->regular = S_ISREG(stx.stx_mode);
+        job->dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+        job->ino = (ino_t)stx.stx_ino;
+        job->size = (off_t)stx.stx_size;
+        job->blocks = (blkcnt_t)stx.stx_blocks;
+
+        snprintf(base_copy, sizeof(base_copy), "%s", into_dir ? job->source : destination);
+        snprintf(job->base, sizeof(job->base), "%s", basename(base_copy));
+        if (into_dir)
+        {
+            if (snprintf(job->destination, sizeof(job->destination), "%s/%s", destination, job->base)
+                >= (int)sizeof(job->destination))
+            {
+                fprintf(stderr, "%s: destination path for '%s' is too long\n", argv[0], job->source);
+                status = 1;
+                continue;
+            }
+        }
+        else
+        {
+            snprintf(job->destination, sizeof(job->destination), "%s", destination);
+        }
+
+        /* opening the destination would truncate the source */
+        struct stat st;
+        if (fstatat(dir_fd, job->base, &st, 0) == 0 && st.st_dev == job->dev && st.st_ino == job->ino)
+        {
+            fprintf(stderr, "%s: '%s' and '%s' are the same file\n", argv[0], job->source, job->destination);
+            status = 1;
+            continue;
+        }
+        job->valid = true;
+        job->small = into_dir && job->regular && job->size > 0 && job->size <= SMALL_FILE_MAX && !options.direct;
+    }
+
+    if (into_dir && skip_duplicates(argv[0], jobs, nsources))
+    {
+        status = 1;
+    }
+
+    /* large and special files one at a time, each engine uses its own buffers and threads */
+    size_t nsmall = 0;
+    for (size_t i = 0; i < nsources; ++i)
+    {
+        copy_job_t* job = &jobs[i];
+        if (job->valid && job->small)
+        {
+            small[nsmall++] = job;
+        }
+        else if (job->valid)
+        {
+            job->status = copy_file(&options, job, dir_fd);
+        }
+    }
+    if (nsmall > 0)
+    {
+        copy_small_files(&options, small, nsmall, dir_fd);
+    }
+
+    /* digests in argv order, whichever thread finished first; same layout as sha256sum/xxhsum */
+    for (size_t i = 0; i < nsources; ++i)
+    {
+        copy_job_t* job = &jobs[i];
+        if (!job->valid)
+        {
+            continue;
+        }
+        if (job->status != 0)
+        {
+            if (status == 0)
+            {
+                status = job->status;
+            }
+            continue;
+        }
+        if (job->checksum[0] != '\0')
+        {
+            printf("%s  %s\n", job->checksum, job->destination);
+        }
+    }
+
+    sync_destination_dir(dir_fd);
+    close(dir_fd);
+    release_buffer();
+    free(small);
+    free(jobs);
+
+    return status;
 }
@@ -5,6 +5,8 @@
 #include <string.h>
 #include <stdbool.h>  // Use standard boolean type
 
+#include "robust_io.h"
+
 
 // Error messages
 #define ERR_UNKNOWN_OPT         "Error: invalid argument.\n"
@@ -19,6 +21,9 @@ typedef struct {
 const char escape_chars[] = {'\n', '\t', '\r', '\b', '\v', '\f', '\7', '\0', '\\'};
 const char *space_char = " ";
 
+// Whole message is collected here and written with as few write() calls as possible
+static rio_writer_t out;
+
 /**
  * Print usage information
  * @param program_name The name of the program
@@ -36,7 +41,7 @@ void print_usage(const char *program_name) {
  * @param message The error message
  */
 void print_error_and_exit(const char *message) {
-    write(STDERR_FILENO, message, strlen(message));
+    rio_write_full(STDERR_FILENO, message, strlen(message));
     exit(EXIT_FAILURE);
 }
 
@@ -59,19 +64,19 @@ void print_with_escapes(const char *str) {
         if (*str == '\\' && *(str + 1)) {
             str++;
             switch (*str) {
-                case 'n': write(STDOUT_FILENO, escape_chars, 1); break;
-                case 't': write(STDOUT_FILENO, escape_chars+1, 1); break;
-                case 'r': write(STDOUT_FILENO, escape_chars+2, 1); break;
-                case 'b': write(STDOUT_FILENO, escape_chars+3, 1); break;
-                case 'v': write(STDOUT_FILENO, escape_chars+4, 1); break;
-                case 'f': write(STDOUT_FILENO, escape_chars+5, 1); break;
-                case 'a': write(STDOUT_FILENO, escape_chars+6, 1); break;
-                case '0': write(STDOUT_FILENO, escape_chars+7, 1); break;
-                case '\\': write(STDOUT_FILENO, escape_chars+8, 1); break;
-                default : write(STDOUT_FILENO, str, 1); break;
+                case 'n': rio_writer_putc(&out, escape_chars[0]); break;
+                case 't': rio_writer_putc(&out, escape_chars[1]); break;
+                case 'r': rio_writer_putc(&out, escape_chars[2]); break;
+                case 'b': rio_writer_putc(&out, escape_chars[3]); break;
+                case 'v': rio_writer_putc(&out, escape_chars[4]); break;
+                case 'f': rio_writer_putc(&out, escape_chars[5]); break;
+                case 'a': rio_writer_putc(&out, escape_chars[6]); break;
+                case '0': rio_writer_putc(&out, escape_chars[7]); break;
+                case '\\': rio_writer_putc(&out, escape_chars[8]); break;
+                default : rio_writer_putc(&out, *str); break;
             }
         } else {
-            write(STDOUT_FILENO, str, 1);
+            rio_writer_putc(&out, *str);
         }
     }
 }
@@ -121,7 +126,7 @@ int parse_options(int argc, char **argv, Options *options) {
                     exit(EXIT_SUCCESS);
                     
                 default:
-                    write(STDOUT_FILENO, arg+i, 1);
+                    rio_write_full(STDOUT_FILENO, arg+i, 1);
                     print_error_and_exit(ERR_UNKNOWN_OPT);
                     break;
             }
@@ -142,7 +147,7 @@ void print_message(char **argv, int start_idx, int argc, const Options *options)
     // If no message arguments, do nothing (except newline if needed)
     if (start_idx >= argc) {
         if (options->add_newline) {
-            write(STDOUT_FILENO, escape_chars, 1);
+            rio_writer_putc(&out, escape_chars[0]);
         }
         return;
     }
@@ -152,32 +157,44 @@ void print_message(char **argv, int start_idx, int argc, const Options *options)
         if (options->interpret_escapes) {
             print_with_escapes(argv[i]);
         } else {
-            write(STDOUT_FILENO, argv[i], strlen(argv[i]));
+            rio_writer_puts(&out, argv[i]);
         }
         
         // Add space between arguments, but not after the last one
         if (i < argc - 1) {
-            write(STDOUT_FILENO, space_char, 1);
+            rio_writer_putc(&out, *space_char);
         }
     }
     
     // Add newline if needed
     if (options->add_newline) {
-        write(STDOUT_FILENO, escape_chars, 1);
+        rio_writer_putc(&out, escape_chars[0]);
     }
 }
 
 int main(int argc, char **argv) {
     // Handle special case: no arguments
     if (argc == 1) {
-        write(STDOUT_FILENO, escape_chars, 1);
+        if (rio_write_full(STDOUT_FILENO, escape_chars, 1) == -1) {
+            rio_error("Error while writing to stdout", NULL);
+            return EXIT_FAILURE;
+        }
         return EXIT_SUCCESS;
     }
     
     Options options;
     int message_start_idx = parse_options(argc, argv, &options);
     
+    if (rio_writer_init(&out, STDOUT_FILENO, NULL, 0) == -1) {
+        rio_error("Error while allocating output buffer", NULL);
+        return EXIT_FAILURE;
+    }
     print_message(argv, message_start_idx, argc, &options);
+    if (rio_writer_flush(&out) == -1) {
+        rio_error("Error while writing to stdout", NULL);
+        return EXIT_FAILURE;
+    }
+    rio_writer_free(&out);
 
     close(STDIN_FILENO);
     close(STDOUT_FILENO);
@@ -7,6 +7,8 @@
 #include <errno.h>
 #include <unistd.h>
 
+#include "robust_io.h"
+
 #ifndef PATH_MAX
     #define PATH_MAX 4096
 #endif
@@ -94,7 +96,7 @@ int main(int argc, char** argv)
     }
     else
     {
-        write(STDERR_FILENO, ERR_UNSUPPORTED_FTYPE(SRC), strlen(ERR_UNSUPPORTED_FTYPE(SRC)));
+        rio_write_full(STDERR_FILENO, ERR_UNSUPPORTED_FTYPE(SRC), strlen(ERR_UNSUPPORTED_FTYPE(SRC)));
         free((void*)src_path_stat);
         exit(-1);
     }
@@ -118,7 +120,7 @@ int main(int argc, char** argv)
         }
         else
         {
-            write(STDERR_FILENO, ERR_UNSUPPORTED_FTYPE(DEST), strlen(ERR_UNSUPPORTED_FTYPE(DEST)));
+            rio_write_full(STDERR_FILENO, ERR_UNSUPPORTED_FTYPE(DEST), strlen(ERR_UNSUPPORTED_FTYPE(DEST)));
             free((void*)src_path_stat);
             free((void*)dest_path_stat);
             exit(-1);
@@ -151,10 +153,10 @@ int main(int argc, char** argv)
     case DIR_2_FILE:
         char err_msg[50];
         snprintf(err_msg, sizeof(err_msg), "Cannot copy a directory to a regular file\n");
-        write(STDERR_FILENO, err_msg, strlen(err_msg));
+        rio_write_full(STDERR_FILENO, err_msg, strlen(err_msg));
         break;
     default:
-        write(STDERR_FILENO, ERR_UNSUPPORTED_FTYPE(SRC), strlen(ERR_UNSUPPORTED_FTYPE(SRC)));
+        rio_write_full(STDERR_FILENO, ERR_UNSUPPORTED_FTYPE(SRC), strlen(ERR_UNSUPPORTED_FTYPE(SRC)));
         break;
     }
 
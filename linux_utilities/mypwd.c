@@ -3,6 +3,9 @@
 #include <unistd.h>
 #include <limits.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include "robust_io.h"
 
 #define MAX_PATH 500 /* max number of character for the path */
 
@@ -28,7 +31,14 @@ int main()
 
     }
 
-    printf("%s\n", path);
+    size_t len = strlen(path);
+    path[len] = '\n'; /* getcwd() only needs len + 1 of the buffer */
+    if (rio_write_full(STDOUT_FILENO, path, len + 1) == -1)
+    {
+        rio_error("Error while writing to stdout", NULL);
+        free(path);
+        return -1;
+    }
     free(path);
 
     return 0;
@@ -0,0 +1,100 @@
+#!/bin/sh
+# bench_script.sh PICO [ITERATIONS] [RUNS]
+#
+# Run time of pico scripts next to dash and bash on the same text, best of
+# RUNS runs each:
+#   loop   ITERATIONS rounds of  while [ $i -lt N ]; do i=$((i+1)); done
+#   call   the same loop calling a shell function each round
+#   parse  a 20000-line script of if/while/for inside a function that is
+#          never called, so only reading and parsing are timed; pico runs it
+#          without and with $PICO_SCRIPT_CACHE
+# Shells that are not installed are skipped.
+
+set -e
+
+pico=$1
+iterations=${2:-1000000}
+runs=${3:-3}
+
+if [ -z "$pico" ]; then
+    echo "usage: $0 PICO [ITERATIONS] [RUNS]" >&2
+    exit 2
+fi
+
+dir=$(mktemp -d "${TMPDIR:-/tmp}/bench_script.XXXXXX")
+trap 'rm -rf "$dir"' EXIT
+mkdir "$dir/cache"
+
+cat > "$dir/loop" <<EOF
+i=0
+while [ \$i -lt $iterations ]; do
+    i=\$((i + 1))
+done
+EOF
+
+cat > "$dir/call" <<EOF
+f() {
+    x=\$1
+}
+i=0
+while [ \$i -lt $iterations ]; do
+    f \$i
+    i=\$((i + 1))
+done
+EOF
+
+awk 'BEGIN {
+    print "unused() {"
+    for (i = 0; i < 2500; i++) {
+        print "    if [ \"$a\" = x" i " ]; then"
+        print "        echo \"branch " i " $b\" > /dev/null"
+        print "    elif [ $((i + " i ")) -gt 3 ]; then"
+        print "        while [ $j -lt 2 ]; do j=$((j + 1)); done"
+        print "    fi"
+        print "    for w in a b c; do"
+        print "        v" i "=$w"
+        print "    done"
+    }
+    print "}"
+    print ":"
+}' > "$dir/parse"
+
+# best wall time of RUNS runs, in seconds
+best() {
+    b=
+    i=0
+    while [ $i -lt "$runs" ]; do
+        t0=$(date +%s%N)
+        "$@" > /dev/null
+        t1=$(date +%s%N)
+        t=$(((t1 - t0) / 1000))
+        if [ -z "$b" ] || [ $t -lt $b ]; then
+            b=$t
+        fi
+        i=$((i + 1))
+    done
+    awk -v us="$b" 'BEGIN { printf "%8.3f s", us / 1e6 }'
+}
+
+row() {
+    script=$1
+    printf "%-6s pico %s" "$script" "$(best "$pico" "$dir/$script")"
+    if [ "$script" = parse ]; then
+        # the first run fills the cache
+        export PICO_SCRIPT_CACHE="$dir/cache"
+        "$pico" "$dir/$script" > /dev/null
+        printf "  pico cached %s" "$(best "$pico" "$dir/$script")"
+        unset PICO_SCRIPT_CACHE
+    fi
+    for sh in dash bash; do
+        if command -v $sh > /dev/null 2>&1; then
+            printf "  %s %s" $sh "$(best $sh "$dir/$script")"
+        fi
+    done
+    echo
+}
+
+echo "loop/call: $iterations iterations, parse: $(wc -l < "$dir/parse") lines, best of $runs"
+row loop
+row call
+row parse
@@ -0,0 +1,189 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "pico_serve.h"
+#include "robust_io.h"
+
+#define DEFAULT_REQUESTS 2000
+#define COMMAND ":"
+
+/*
+ * serve_latency PICO PICOC [REQUESTS]
+ *
+ * Per-command latency and throughput of one short command (":") run:
+ *   serve   by a "pico --serve" server, REQUESTS submissions on one connection
+ *   picoc   by the picoc client started once per command
+ *   fresh   by a fresh pico started once per command
+ * Every command gets /dev/null as stdin, stdout and stderr. Prints min,
+ * median, p99 and commands per second for each.
+ */
+
+static double now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e6 + (double)ts.tv_nsec / 1e3;
+}
+
+static int compare_double(const void* a, const void* b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static void report(const char* label, double* lat, int n, double total_us)
+{
+    qsort(lat, (size_t)n, sizeof(*lat), compare_double);
+    printf("%-6s %6d commands  min %8.1f  median %8.1f  p99 %8.1f us  %8.0f commands/s\n", label, n, lat[0],
+           lat[n / 2], lat[(size_t)n * 99 / 100], (double)n / (total_us / 1e6));
+}
+
+/* fork and exec argv with fds 0-2 on /dev/null, wait for it */
+static int run_child(char** argv, int devnull)
+{
+    pid_t pid = fork();
+    if (pid == -1)
+    {
+        return -1;
+    }
+    if (pid == 0)
+    {
+        dup2(devnull, STDIN_FILENO);
+        dup2(devnull, STDOUT_FILENO);
+        dup2(devnull, STDERR_FILENO);
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    int status;
+    while (waitpid(pid, &status, 0) == -1)
+    {
+        if (errno != EINTR)
+        {
+            return -1;
+        }
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "usage: %s PICO PICOC [REQUESTS]\n", argv[0]);
+        return 2;
+    }
+    char* pico = argv[1];
+    char* picoc = argv[2];
+    int requests = argc > 3 ? atoi(argv[3]) : DEFAULT_REQUESTS;
+    if (requests <= 0)
+    {
+        requests = DEFAULT_REQUESTS;
+    }
+
+    const char* tmpdir = getenv("TMPDIR");
+    char dir[4096], sock_path[4200], script[4200];
+    snprintf(dir, sizeof(dir), "%s/serve_latency.XXXXXX", tmpdir != NULL ? tmpdir : "/tmp");
+    if (mkdtemp(dir) == NULL)
+    {
+        rio_error("Error while creating directory", dir);
+        return 1;
+    }
+    snprintf(sock_path, sizeof(sock_path), "%s/sock", dir);
+    snprintf(script, sizeof(script), "%s/script", dir);
+    int fd = open(script, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd == -1 || rio_write_full(fd, COMMAND "\n", strlen(COMMAND) + 1) == -1)
+    {
+        rio_error("Error while writing", script);
+        return 1;
+    }
+    close(fd);
+
+    int devnull = open("/dev/null", O_RDWR);
+    double* lat = malloc((size_t)requests * sizeof(*lat));
+    if (devnull == -1 || lat == NULL)
+    {
+        perror("Error while setting up");
+        return 1;
+    }
+
+    pid_t server = fork();
+    if (server == 0)
+    {
+        dup2(devnull, STDIN_FILENO);
+        dup2(devnull, STDOUT_FILENO);
+        execl(pico, pico, "--serve", sock_path, (char*)NULL);
+        _exit(127);
+    }
+
+    /* wait for the server to listen */
+    int sock = -1;
+    const struct timespec retry = {0, 10 * 1000 * 1000};
+    for (int i = 0; i < 500 && sock == -1; ++i)
+    {
+        sock = serve_connect(sock_path);
+        if (sock == -1)
+        {
+            nanosleep(&retry, NULL);
+        }
+    }
+    if (sock == -1)
+    {
+        rio_error("Error while connecting to", sock_path);
+        kill(server, SIGTERM);
+        return 1;
+    }
+
+    const int fds[3] = {devnull, devnull, devnull};
+    int status;
+    double start = now_us();
+    for (int i = 0; i < requests; ++i)
+    {
+        double t0 = now_us();
+        if (serve_submit(sock, COMMAND, strlen(COMMAND), fds, &status) == -1)
+        {
+            rio_error("Error while submitting to", sock_path);
+            kill(server, SIGTERM);
+            return 1;
+        }
+        lat[i] = now_us() - t0;
+    }
+    report("serve", lat, requests, now_us() - start);
+    close(sock);
+
+    char* picoc_argv[] = {picoc, sock_path, COMMAND, NULL};
+    start = now_us();
+    for (int i = 0; i < requests; ++i)
+    {
+        double t0 = now_us();
+        run_child(picoc_argv, devnull);
+        lat[i] = now_us() - t0;
+    }
+    report("picoc", lat, requests, now_us() - start);
+
+    kill(server, SIGTERM);
+    waitpid(server, NULL, 0);
+
+    char* fresh_argv[] = {pico, script, NULL};
+    start = now_us();
+    for (int i = 0; i < requests; ++i)
+    {
+        double t0 = now_us();
+        run_child(fresh_argv, devnull);
+        lat[i] = now_us() - t0;
+    }
+    report("fresh", lat, requests, now_us() - start);
+
+    unlink(script);
+    rmdir(dir);
+    free(lat);
+    return 0;
+}
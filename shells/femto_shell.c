@@ -11,6 +11,8 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include "robust_io.h"
+
 #define CMD_IDX_0        0
 #define CMD_IDX_1        1
 #define UNDEFINED_CMD    (-1)
@@ -81,9 +83,9 @@ int  main(int argc, char *argv[])
 
     while (1)
     {
-        if (write(STDOUT_FILENO, "FS> ", strlen("FS> ")) != 4)
+        if (rio_write_full(STDOUT_FILENO, "FS> ", strlen("FS> ")) != 0)
         {
-            perror("write");
+            rio_error("write", NULL);
             exit(1);
         }
         fflush(stdout);
@@ -148,7 +150,7 @@ int  main(int argc, char *argv[])
                     *exit_flag = 1;
                     break;
                 default:
-                    write(STDERR_FILENO, ERR_INVL_CMD, strlen(ERR_INVL_CMD));
+                    rio_write_full(STDERR_FILENO, ERR_INVL_CMD, strlen(ERR_INVL_CMD));
                     break;
                 }
                 // terminate the child proc
@@ -204,7 +206,7 @@ void FS_exec_echo(char *argv[])
 int FS_exec_exit(char *argv[])
 {
     // exit with 0 if no arguments or error code if any
-    write(STDOUT_FILENO, END_MSG, strlen(END_MSG));
+    rio_write_full(STDOUT_FILENO, END_MSG, strlen(END_MSG));
     if (argv[0] != NULL)
     {
         int retCode = atoi(argv[0]);
@@ -226,8 +228,8 @@ void FS_fill_cmdDB(cmdConfig_t *totalcmds, int cmdIdx)
     }
     else
     {
-        if (write(STDERR_FILENO, "Invlaid pointer\n",
-                  strlen("Invlaid pointer\n")) < 0)
+        if (rio_write_full(STDERR_FILENO, "Invlaid pointer\n",
+                           strlen("Invlaid pointer\n")) < 0)
         {
             exit(-1);
         }
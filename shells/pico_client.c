@@ -0,0 +1,56 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pico_serve.h"
+#include "robust_io.h"
+
+#define CLIENT_ERROR 255 /* the server could not be reached, like ssh */
+
+/*
+ * picoc SOCKET COMMAND...
+ *
+ * Submit each COMMAND in turn to a "pico --serve SOCKET" server over one
+ * connection, with this process's stdin, stdout and stderr as the
+ * command's. Exits with the status of the last command.
+ */
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "usage: %s SOCKET COMMAND...\n", argv[0]);
+        return 2;
+    }
+
+    /* a server that goes away shows up as an error from serve_submit() */
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = SIG_IGN;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGPIPE, &sa, NULL);
+
+    int sock = serve_connect(argv[1]);
+    if (sock == -1)
+    {
+        rio_error("picoc: cannot connect to", argv[1]);
+        return CLIENT_ERROR;
+    }
+
+    const int fds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+    int status = 0;
+    for (int i = 2; i < argc; ++i)
+    {
+        if (serve_submit(sock, argv[i], strlen(argv[i]), fds, &status) == -1)
+        {
+            rio_error("picoc: lost connection to", argv[1]);
+            close(sock);
+            return CLIENT_ERROR;
+        }
+    }
+
+    close(sock);
+    return status;
+}
@@ -0,0 +1,788 @@
+#define _GNU_SOURCE
+
+#include "pico_glob.h"
+
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define DENTS_BUF_SIZE (64 * 1024)
+
+typedef struct arena_block
+{
+    struct arena_block* next;
+    size_t used;
+    size_t cap;
+    char data[];
+} arena_block_t;
+
+typedef struct
+{
+    char** items;
+    size_t len;
+    size_t cap;
+} str_vec_t;
+
+typedef struct
+{
+    const char* name;
+    unsigned char type; /* DT_* from getdents64 */
+} dir_entry_t;
+
+typedef struct dir_listing
+{
+    struct dir_listing* next;
+    const char* path;
+    dir_entry_t* entries;
+    size_t count;
+} dir_listing_t;
+
+struct glob_ctx
+{
+    bool sort;
+    arena_block_t* arena;
+    dir_listing_t* listings; /* directories read while expanding this line */
+    str_vec_t result;
+};
+
+typedef enum
+{
+    PAT_CHAR,
+    PAT_ANY,  /* ? */
+    PAT_STAR, /* * */
+    PAT_CLASS /* [...] */
+} pat_kind_t;
+
+typedef struct
+{
+    pat_kind_t kind;
+    unsigned char ch;
+    uint8_t set[32]; /* bitmap of accepted bytes for PAT_CLASS */
+} pat_op_t;
+
+/* a compiled path component, matched against every entry of a directory */
+typedef struct
+{
+    pat_op_t* ops;
+    size_t count;
+} pattern_t;
+
+/* layout of the records returned by getdents64 */
+struct linux_dirent64
+{
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+/* ------------------------------------------------------------------ memory */
+
+static void* arena_alloc(glob_ctx_t* ctx, size_t size)
+{
+    size = (size + 7) & ~(size_t)7;
+    arena_block_t* b = ctx->arena;
+    if (b == NULL || b->cap - b->used < size)
+    {
+        size_t cap = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        b = malloc(sizeof(*b) + cap);
+        if (b == NULL)
+        {
+            return NULL;
+        }
+        b->next = ctx->arena;
+        b->used = 0;
+        b->cap = cap;
+        ctx->arena = b;
+    }
+
+    void* p = b->data + b->used;
+    b->used += size;
+    return p;
+}
+
+static char* arena_join(glob_ctx_t* ctx, const char* a, size_t alen, const char* b, size_t blen, const char* c,
+                        size_t clen)
+{
+    char* s = arena_alloc(ctx, alen + blen + clen + 1);
+    if (s == NULL)
+    {
+        return NULL;
+    }
+    memcpy(s, a, alen);
+    memcpy(s + alen, b, blen);
+    memcpy(s + alen + blen, c, clen);
+    s[alen + blen + clen] = '\0';
+    return s;
+}
+
+static int vec_push(str_vec_t* v, char* s)
+{
+    if (v->len + 1 >= v->cap)
+    {
+        size_t cap = v->cap ? v->cap * 2 : 16;
+        char** tmp = realloc(v->items, cap * sizeof(*tmp));
+        if (tmp == NULL)
+        {
+            return -1;
+        }
+        v->items = tmp;
+        v->cap = cap;
+    }
+    v->items[v->len++] = s;
+    v->items[v->len] = NULL;
+    return 0;
+}
+
+glob_ctx_t* glob_ctx_new(bool sort)
+{
+    glob_ctx_t* ctx = calloc(1, sizeof(*ctx));
+    if (ctx != NULL)
+    {
+        ctx->sort = sort;
+    }
+    return ctx;
+}
+
+void glob_ctx_free(glob_ctx_t* ctx)
+{
+    if (ctx == NULL)
+    {
+        return;
+    }
+    for (dir_listing_t* l = ctx->listings; l != NULL; l = l->next)
+    {
+        free(l->entries);
+    }
+    while (ctx->arena != NULL)
+    {
+        arena_block_t* next = ctx->arena->next;
+        free(ctx->arena);
+        ctx->arena = next;
+    }
+    free(ctx->result.items);
+    free(ctx);
+}
+
+/* ---------------------------------------------------------------- patterns */
+
+static bool has_glob_chars(const char* s, size_t len)
+{
+    for (size_t i = 0; i < len; ++i)
+    {
+        if (s[i] == '\\')
+        {
+            i++;
+        }
+        else if (s[i] == '*' || s[i] == '?' || s[i] == '[')
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* s[0..len) with its backslash escapes removed, in the arena */
+static char* literal_text(glob_ctx_t* ctx, const char* s, size_t len)
+{
+    char* out = arena_alloc(ctx, len + 1);
+    if (out == NULL)
+    {
+        return NULL;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < len; ++i)
+    {
+        if (s[i] == '\\' && i + 1 < len)
+        {
+            i++;
+        }
+        out[n++] = s[i];
+    }
+    out[n] = '\0';
+    return out;
+}
+
+static void set_bit(uint8_t* set, unsigned char c)
+{
+    set[c >> 3] |= (uint8_t)(1u << (c & 7));
+}
+
+static int named_class(const char* name, size_t len, int c)
+{
+    static const struct
+    {
+        const char* name;
+        int (*fn)(int);
+    } classes[] = {{"alpha", isalpha}, {"digit", isdigit}, {"alnum", isalnum}, {"upper", isupper},
+                   {"lower", islower}, {"space", isspace}, {"punct", ispunct}, {"xdigit", isxdigit}};
+
+    for (size_t i = 0; i < sizeof(classes) / sizeof(classes[0]); ++i)
+    {
+        if (strlen(classes[i].name) == len && strncmp(classes[i].name, name, len) == 0)
+        {
+            return classes[i].fn(c) ? 1 : 0;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Parse a bracket expression starting at s[0] == '['. Returns the index just
+ * past the closing ']' or 0 if there is none (the '[' is then a literal).
+ */
+static size_t compile_class(const char* s, size_t len, pat_op_t* op)
+{
+    size_t i = 1;
+    bool negate = false;
+    memset(op->set, 0, sizeof(op->set));
+    op->kind = PAT_CLASS;
+
+    if (i < len && (s[i] == '!' || s[i] == '^'))
+    {
+        negate = true;
+        i++;
+    }
+
+    bool first = true;
+    for (; i < len; ++i)
+    {
+        unsigned char c = (unsigned char)s[i];
+        if (c == '\\' && i + 1 < len)
+        {
+            /* escaped: a plain member, even ']' */
+            set_bit(op->set, (unsigned char)s[++i]);
+            first = false;
+            continue;
+        }
+        if (c == ']' && !first)
+        {
+            if (negate)
+            {
+                for (size_t k = 0; k < sizeof(op->set); ++k)
+                {
+                    op->set[k] = (uint8_t)~op->set[k];
+                }
+            }
+            return i + 1;
+        }
+        first = false;
+
+        if (c == '[' && i + 1 < len && s[i + 1] == ':')
+        {
+            const char* end = strstr(s + i + 2, ":]");
+            if (end != NULL && (size_t)(end - s) < len)
+            {
+                const char* name = s + i + 2;
+                size_t nlen = (size_t)(end - name);
+                for (int ch = 0; ch < 256; ++ch)
+                {
+                    if (named_class(name, nlen, ch) == 1)
+                    {
+                        set_bit(op->set, (unsigned char)ch);
+                    }
+                }
+                i = (size_t)(end - s) + 1;
+                continue;
+            }
+        }
+
+        if (i + 2 < len && s[i + 1] == '-' && s[i + 2] != ']')
+        {
+            unsigned char hi = (unsigned char)s[i + 2];
+            for (unsigned ch = c; ch <= hi; ++ch)
+            {
+                set_bit(op->set, (unsigned char)ch);
+            }
+            i += 2;
+            continue;
+        }
+        set_bit(op->set, c);
+    }
+
+    return 0;
+}
+
+static int compile_pattern(glob_ctx_t* ctx, const char* s, size_t len, pattern_t* pat)
+{
+    pat->ops = arena_alloc(ctx, (len + 1) * sizeof(pat_op_t));
+    pat->count = 0;
+    if (pat->ops == NULL)
+    {
+        return -1;
+    }
+
+    for (size_t i = 0; i < len;)
+    {
+        pat_op_t* op = &pat->ops[pat->count];
+        if (s[i] == '*')
+        {
+            /* consecutive stars are one star */
+            if (pat->count == 0 || pat->ops[pat->count - 1].kind != PAT_STAR)
+            {
+                op->kind = PAT_STAR;
+                pat->count++;
+            }
+            i++;
+            continue;
+        }
+        if (s[i] == '?')
+        {
+            op->kind = PAT_ANY;
+            pat->count++;
+            i++;
+            continue;
+        }
+        if (s[i] == '[')
+        {
+            size_t used = compile_class(s + i, len - i, op);
+            if (used != 0)
+            {
+                pat->count++;
+                i += used;
+                continue;
+            }
+        }
+        if (s[i] == '\\' && i + 1 < len)
+        {
+            i++;
+        }
+        op->kind = PAT_CHAR;
+        op->ch = (unsigned char)s[i++];
+        pat->count++;
+    }
+
+    return 0;
+}
+
+static bool op_matches(const pat_op_t* op, unsigned char c)
+{
+    switch (op->kind)
+    {
+    case PAT_CHAR:
+        return op->ch == c;
+    case PAT_ANY:
+        return true;
+    case PAT_CLASS:
+        return (op->set[c >> 3] >> (c & 7)) & 1;
+    default:
+        return false;
+    }
+}
+
+/*
+ * Match with single-star backtracking: on a mismatch, resume right after
+ * the most recent '*', letting it absorb one more character. Linear for the
+ * common patterns and never exponential.
+ */
+static bool pattern_match(const pattern_t* pat, const char* name)
+{
+    /* a leading dot must be matched explicitly */
+    if (name[0] == '.' && (pat->count == 0 || pat->ops[0].kind != PAT_CHAR || pat->ops[0].ch != '.'))
+    {
+        return false;
+    }
+
+    size_t pi = 0;
+    const char* si = name;
+    size_t star_pi = SIZE_MAX;
+    const char* star_si = NULL;
+
+    while (*si != '\0')
+    {
+        if (pi < pat->count)
+        {
+            const pat_op_t* op = &pat->ops[pi];
+            if (op->kind == PAT_STAR)
+            {
+                star_pi = pi++;
+                star_si = si;
+                continue;
+            }
+            if (op_matches(op, (unsigned char)*si))
+            {
+                pi++;
+                si++;
+                continue;
+            }
+        }
+        if (star_pi == SIZE_MAX)
+        {
+            return false;
+        }
+        pi = star_pi + 1;
+        si = ++star_si;
+    }
+
+    while (pi < pat->count && pat->ops[pi].kind == PAT_STAR)
+    {
+        pi++;
+    }
+    return pi == pat->count;
+}
+
+/* --------------------------------------------------------------- listings */
+
+static const dir_listing_t* read_dir(glob_ctx_t* ctx, const char* path)
+{
+    for (dir_listing_t* l = ctx->listings; l != NULL; l = l->next)
+    {
+        if (strcmp(l->path, path) == 0)
+        {
+            return l;
+        }
+    }
+
+    dir_listing_t* l = arena_alloc(ctx, sizeof(*l));
+    if (l == NULL)
+    {
+        return NULL;
+    }
+    l->path = arena_join(ctx, path, strlen(path), "", 0, "", 0);
+    l->entries = NULL;
+    l->count = 0;
+    l->next = ctx->listings;
+    ctx->listings = l;
+
+    /* an unreadable directory is cached as empty */
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return l;
+    }
+
+    static char dents[DENTS_BUF_SIZE] __attribute__((aligned(8)));
+    size_t cap = 0;
+    for (;;)
+    {
+        long n = syscall(SYS_getdents64, fd, dents, sizeof(dents));
+        if (n <= 0)
+        {
+            break;
+        }
+        for (long off = 0; off < n;)
+        {
+            const struct linux_dirent64* d = (const struct linux_dirent64*)(dents + off);
+            off += d->d_reclen;
+
+            if (d->d_name[0] == '.' && (d->d_name[1] == '\0' || (d->d_name[1] == '.' && d->d_name[2] == '\0')))
+            {
+                continue;
+            }
+            if (l->count == cap)
+            {
+                cap = cap ? cap * 2 : 256;
+                dir_entry_t* tmp = realloc(l->entries, cap * sizeof(*tmp));
+                if (tmp == NULL)
+                {
+                    close(fd);
+                    return NULL;
+                }
+                l->entries = tmp;
+            }
+            const char* name = arena_join(ctx, d->d_name, strlen(d->d_name), "", 0, "", 0);
+            if (name == NULL)
+            {
+                close(fd);
+                return NULL;
+            }
+            l->entries[l->count].name = name;
+            l->entries[l->count].type = d->d_type;
+            l->count++;
+        }
+    }
+
+    close(fd);
+    return l;
+}
+
+static bool is_directory(const char* path, unsigned char type)
+{
+    if (type == DT_DIR)
+    {
+        return true;
+    }
+    if (type != DT_LNK && type != DT_UNKNOWN)
+    {
+        return false;
+    }
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+/* ---------------------------------------------------------------- expansion */
+
+static int compare_names(const void* a, const void* b)
+{
+    /* byte order, independent of the locale */
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+/*
+ * Expand one brace-free word component by component. Literal components are
+ * appended as they are; glob components are matched against the (cached)
+ * listing of every directory reached so far.
+ */
+static int glob_word(glob_ctx_t* ctx, char* word, str_vec_t* out)
+{
+    size_t wlen = strlen(word);
+    if (!has_glob_chars(word, wlen))
+    {
+        char* lit = literal_text(ctx, word, wlen);
+        return lit != NULL ? vec_push(out, lit) : -1;
+    }
+
+    str_vec_t cur = {0}, next = {0};
+    int rc = -1;
+    if (vec_push(&cur, word[0] == '/' ? "/" : "") != 0)
+    {
+        goto done;
+    }
+
+    bool globbed = false;
+    bool need_check = false; /* literal components after a glob must exist */
+    const char* p = word;
+    while (*p != '\0')
+    {
+        while (*p == '/')
+        {
+            p++;
+        }
+        if (*p == '\0')
+        {
+            break;
+        }
+        const char* end = strchr(p, '/');
+        size_t clen = end ? (size_t)(end - p) : strlen(p);
+        bool last = true;
+        for (const char* q = p + clen; *q != '\0'; ++q)
+        {
+            if (*q != '/')
+            {
+                last = false;
+                break;
+            }
+        }
+
+        next.len = 0;
+        if (!has_glob_chars(p, clen))
+        {
+            const char* lit = literal_text(ctx, p, clen);
+            if (lit == NULL)
+            {
+                goto done;
+            }
+            for (size_t i = 0; i < cur.len; ++i)
+            {
+                const char* prefix = cur.items[i];
+                size_t plen = strlen(prefix);
+                const char* sep = (plen == 0 || prefix[plen - 1] == '/') ? "" : "/";
+                char* s = arena_join(ctx, prefix, plen, sep, strlen(sep), lit, strlen(lit));
+                if (s == NULL || vec_push(&next, s) != 0)
+                {
+                    goto done;
+                }
+            }
+            need_check = need_check || globbed;
+        }
+        else
+        {
+            pattern_t pat;
+            if (compile_pattern(ctx, p, clen, &pat) != 0)
+            {
+                goto done;
+            }
+            for (size_t i = 0; i < cur.len; ++i)
+            {
+                const char* prefix = cur.items[i];
+                size_t plen = strlen(prefix);
+                const dir_listing_t* l = read_dir(ctx, plen == 0 ? "." : prefix);
+                if (l == NULL)
+                {
+                    goto done;
+                }
+                const char* sep = (plen == 0 || prefix[plen - 1] == '/') ? "" : "/";
+                for (size_t k = 0; k < l->count; ++k)
+                {
+                    if (!pattern_match(&pat, l->entries[k].name))
+                    {
+                        continue;
+                    }
+                    char* s = arena_join(ctx, prefix, plen, sep, strlen(sep), l->entries[k].name,
+                                         strlen(l->entries[k].name));
+                    if (s == NULL)
+                    {
+                        goto done;
+                    }
+                    if (!last && !is_directory(s, l->entries[k].type))
+                    {
+                        continue;
+                    }
+                    if (vec_push(&next, s) != 0)
+                    {
+                        goto done;
+                    }
+                }
+            }
+            globbed = true;
+        }
+
+        str_vec_t tmp = cur;
+        cur = next;
+        next = tmp;
+        p += clen;
+    }
+
+    size_t first = out->len;
+    bool trailing_slash = wlen > 0 && word[wlen - 1] == '/';
+    for (size_t i = 0; i < cur.len; ++i)
+    {
+        char* s = cur.items[i];
+        struct stat st;
+        if (need_check && lstat(s, &st) != 0)
+        {
+            continue;
+        }
+        if (trailing_slash)
+        {
+            if (!is_directory(s, DT_UNKNOWN))
+            {
+                continue;
+            }
+            s = arena_join(ctx, s, strlen(s), "/", 1, "", 0);
+            if (s == NULL)
+            {
+                goto done;
+            }
+        }
+        if (vec_push(out, s) != 0)
+        {
+            goto done;
+        }
+    }
+
+    if (out->len == first)
+    {
+        /* no match: POSIX keeps the pattern as it is, less the quoting */
+        char* lit = literal_text(ctx, word, wlen);
+        rc = lit != NULL ? vec_push(out, lit) : -1;
+        goto done;
+    }
+    if (ctx->sort)
+    {
+        qsort(out->items + first, out->len - first, sizeof(char*), compare_names);
+    }
+    rc = 0;
+
+done:
+    free(cur.items);
+    free(next.items);
+    return rc;
+}
+
+/*
+ * Brace expansion: "a{b,c{d,e}}f" -> abf acdf acef, in order and before
+ * globbing. Braces without a top-level comma are left alone, and escaped
+ * braces and commas (quoted or substituted text) do not count.
+ */
+static int brace_expand(glob_ctx_t* ctx, char* word, str_vec_t* out)
+{
+    size_t len = strlen(word);
+    for (size_t open = 0; open < len; ++open)
+    {
+        if (word[open] == '\\')
+        {
+            open++;
+            continue;
+        }
+        if (word[open] != '{')
+        {
+            continue;
+        }
+
+        int depth = 0;
+        size_t commas = 0;
+        size_t close = 0;
+        for (size_t i = open; i < len; ++i)
+        {
+            if (word[i] == '\\')
+            {
+                i++;
+            }
+            else if (word[i] == '{')
+            {
+                depth++;
+            }
+            else if (word[i] == '}' && --depth == 0)
+            {
+                close = i;
+                break;
+            }
+            else if (word[i] == ',' && depth == 1)
+            {
+                commas++;
+            }
+        }
+        if (close == 0 || commas == 0)
+        {
+            continue;
+        }
+
+        size_t start = open + 1;
+        depth = 0;
+        for (size_t i = open + 1; i <= close; ++i)
+        {
+            if (word[i] == '\\')
+            {
+                i++;
+            }
+            else if (word[i] == '{')
+            {
+                depth++;
+            }
+            else if (word[i] == '}' && depth > 0)
+            {
+                depth--;
+            }
+            else if ((word[i] == ',' && depth == 0) || i == close)
+            {
+                char* alt = arena_join(ctx, word, open, word + start, i - start, word + close + 1, len - close - 1);
+                if (alt == NULL || brace_expand(ctx, alt, out) != 0)
+                {
+                    return -1;
+                }
+                start = i + 1;
+            }
+        }
+        return 0;
+    }
+
+    return glob_word(ctx, word, out);
+}
+
+char** glob_expand_argv(glob_ctx_t* ctx, char** argv, size_t* argc)
+{
+    ctx->result.len = 0;
+    for (size_t i = 0; i < *argc; ++i)
+    {
+        if (brace_expand(ctx, argv[i], &ctx->result) != 0)
+        {
+            return NULL;
+        }
+    }
+
+    if (ctx->result.items == NULL && vec_push(&ctx->result, NULL) == 0)
+    {
+        ctx->result.len = 0;
+    }
+    *argc = ctx->result.len;
+    return ctx->result.items;
+}
@@ -0,0 +1,27 @@
+#ifndef PICO_GLOB_H
+#define PICO_GLOB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Pathname expansion for one command line: brace expansion followed by
+ * POSIX globbing (*, ?, [...]). Directory listings read while expanding are
+ * cached in the context, so several patterns over the same directory read it
+ * only once. Everything the expansion allocates is released with the context.
+ */
+typedef struct glob_ctx glob_ctx_t;
+
+glob_ctx_t* glob_ctx_new(bool sort);
+void glob_ctx_free(glob_ctx_t* ctx);
+
+/*
+ * Expand every word of argv. A backslash makes the next byte literal, so
+ * callers escape quoted and substituted text; the results carry no escapes.
+ * Words without a match are kept, with their escapes removed. Returns a
+ * NULL-terminated vector owned by ctx and stores its length in *argc, or
+ * NULL when out of memory.
+ */
+char** glob_expand_argv(glob_ctx_t* ctx, char** argv, size_t* argc);
+
+#endif /* PICO_GLOB_H */
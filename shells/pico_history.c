@@ -0,0 +1,296 @@
+#define _GNU_SOURCE
+
+#include "pico_history.h"
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "robust_io.h"
+
+#define TRIGRAM_BUCKETS (1u << 18) /* trigrams hash into this many posting lists */
+
+typedef struct
+{
+    const char* text; /* into the file mapping, or a heap copy for this session */
+    uint32_t len;
+    bool owned;
+} hist_entry_t;
+
+/* ids of the entries containing a trigram, in increasing order */
+typedef struct
+{
+    uint32_t* ids;
+    uint32_t len;
+    uint32_t cap;
+} posting_t;
+
+struct history
+{
+    int fd;             /* history file, opened O_APPEND */
+    void* map;
+    size_t map_len;
+    hist_entry_t* entries;
+    size_t count;
+    size_t cap;
+    posting_t* index;   /* TRIGRAM_BUCKETS lists, NULL until the first search */
+    size_t indexed;     /* entries [0, indexed) are in the index */
+};
+
+static int push_entry(history_t* hist, const char* text, size_t len, bool owned)
+{
+    if (hist->count == hist->cap)
+    {
+        size_t cap = hist->cap ? hist->cap * 2 : 1024;
+        hist_entry_t* tmp = realloc(hist->entries, cap * sizeof(*tmp));
+        if (tmp == NULL)
+        {
+            return -1;
+        }
+        hist->entries = tmp;
+        hist->cap = cap;
+    }
+    hist->entries[hist->count].text = text;
+    hist->entries[hist->count].len = (uint32_t)len;
+    hist->entries[hist->count].owned = owned;
+    hist->count++;
+    return 0;
+}
+
+history_t* history_open(const char* path)
+{
+    history_t* hist = calloc(1, sizeof(*hist));
+    if (hist == NULL)
+    {
+        return NULL;
+    }
+
+    hist->fd = path != NULL ? open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600) : -1;
+    struct stat st;
+    if (hist->fd == -1 || fstat(hist->fd, &st) == -1 || st.st_size == 0)
+    {
+        return hist;
+    }
+
+    hist->map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, hist->fd, 0);
+    if (hist->map == MAP_FAILED)
+    {
+        hist->map = NULL;
+        return hist;
+    }
+    hist->map_len = (size_t)st.st_size;
+    madvise(hist->map, hist->map_len, MADV_SEQUENTIAL);
+
+    /* entries are just (pointer, length) pairs into the mapping */
+    const char* p = hist->map;
+    const char* end = p + hist->map_len;
+    while (p < end)
+    {
+        const char* nl = memchr(p, '\n', (size_t)(end - p));
+        size_t len = (size_t)((nl ? nl : end) - p);
+        if (len > 0 && push_entry(hist, p, len, false) != 0)
+        {
+            history_close(hist);
+            return NULL;
+        }
+        p += len + 1;
+    }
+
+    return hist;
+}
+
+void history_close(history_t* hist)
+{
+    if (hist == NULL)
+    {
+        return;
+    }
+    for (size_t i = 0; i < hist->count; ++i)
+    {
+        if (hist->entries[i].owned)
+        {
+            free((char*)hist->entries[i].text);
+        }
+    }
+    if (hist->index != NULL)
+    {
+        for (size_t b = 0; b < TRIGRAM_BUCKETS; ++b)
+        {
+            free(hist->index[b].ids);
+        }
+        free(hist->index);
+    }
+    if (hist->map != NULL)
+    {
+        munmap(hist->map, hist->map_len);
+    }
+    if (hist->fd != -1)
+    {
+        close(hist->fd);
+    }
+    free(hist->entries);
+    free(hist);
+}
+
+size_t history_count(const history_t* hist)
+{
+    return hist->count;
+}
+
+const char* history_get(const history_t* hist, size_t idx, size_t* len)
+{
+    *len = hist->entries[idx].len;
+    return hist->entries[idx].text;
+}
+
+static uint32_t trigram_bucket(const char* p)
+{
+    uint32_t t = (uint32_t)(unsigned char)p[0] << 16 | (uint32_t)(unsigned char)p[1] << 8 | (unsigned char)p[2];
+    return (t * 2654435761u) >> (32 - 18);
+}
+
+static int index_entry(history_t* hist, uint32_t id)
+{
+    const hist_entry_t* e = &hist->entries[id];
+    for (uint32_t i = 0; i + 3 <= e->len; ++i)
+    {
+        posting_t* pl = &hist->index[trigram_bucket(e->text + i)];
+        if (pl->len > 0 && pl->ids[pl->len - 1] == id)
+        {
+            /* trigram repeated within the entry */
+            continue;
+        }
+        if (pl->len == pl->cap)
+        {
+            uint32_t cap = pl->cap ? pl->cap * 2 : 4;
+            uint32_t* tmp = realloc(pl->ids, cap * sizeof(*tmp));
+            if (tmp == NULL)
+            {
+                return -1;
+            }
+            pl->ids = tmp;
+            pl->cap = cap;
+        }
+        pl->ids[pl->len++] = id;
+    }
+    return 0;
+}
+
+/* bring the index up to date; built in full on the first search only */
+static int update_index(history_t* hist)
+{
+    if (hist->index == NULL)
+    {
+        hist->index = calloc(TRIGRAM_BUCKETS, sizeof(*hist->index));
+        if (hist->index == NULL)
+        {
+            return -1;
+        }
+    }
+    for (; hist->indexed < hist->count; ++hist->indexed)
+    {
+        if (index_entry(hist, (uint32_t)hist->indexed) != 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int history_add(history_t* hist, const char* line, size_t len)
+{
+    if (len == 0)
+    {
+        return 0;
+    }
+
+    /* keep the newline in the copy so the file gets the whole line in one write */
+    char* copy = malloc(len + 1);
+    if (copy == NULL)
+    {
+        return -1;
+    }
+    memcpy(copy, line, len);
+    copy[len] = '\n';
+
+    if (push_entry(hist, copy, len, true) != 0)
+    {
+        free(copy);
+        return -1;
+    }
+    if (hist->index != NULL && update_index(hist) != 0)
+    {
+        return -1;
+    }
+
+    if (hist->fd != -1 && rio_write_full(hist->fd, copy, len + 1) != 0)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+static bool entry_contains(const hist_entry_t* e, const char* query, size_t qlen)
+{
+    return memmem(e->text, e->len, query, qlen) != NULL;
+}
+
+long history_search(history_t* hist, const char* query, size_t qlen, size_t before)
+{
+    if (before > hist->count)
+    {
+        before = hist->count;
+    }
+
+    if (qlen < 3 || update_index(hist) != 0)
+    {
+        /* no trigram to look up: scan from the newest entry */
+        for (size_t i = before; i-- > 0;)
+        {
+            if (entry_contains(&hist->entries[i], query, qlen))
+            {
+                return (long)i;
+            }
+        }
+        return -1;
+    }
+
+    /* walk the shortest posting list of the query's trigrams, newest first */
+    const posting_t* best = NULL;
+    for (size_t i = 0; i + 3 <= qlen; ++i)
+    {
+        const posting_t* pl = &hist->index[trigram_bucket(query + i)];
+        if (best == NULL || pl->len < best->len)
+        {
+            best = pl;
+        }
+    }
+
+    /* binary search for the first id >= before, then go backwards */
+    uint32_t lo = 0, hi = best->len;
+    while (lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (best->ids[mid] < before)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    for (uint32_t k = lo; k-- > 0;)
+    {
+        if (entry_contains(&hist->entries[best->ids[k]], query, qlen))
+        {
+            return (long)best->ids[k];
+        }
+    }
+    return -1;
+}
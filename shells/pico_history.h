@@ -0,0 +1,33 @@
+#ifndef PICO_HISTORY_H
+#define PICO_HISTORY_H
+
+#include <stddef.h>
+
+/*
+ * Persistent command history. The history file is mmap'ed at startup and
+ * entries point straight into the mapping; new entries are appended with a
+ * single O_APPEND write, so concurrent shells never interleave partial lines.
+ * Substring search goes through a trigram index that is built on the first
+ * search and then kept up to date as entries are added.
+ */
+typedef struct history history_t;
+
+/* NULL only when out of memory; an unreadable file gives an empty history */
+history_t* history_open(const char* path);
+void history_close(history_t* hist);
+
+size_t history_count(const history_t* hist);
+
+/* entry idx (0 = oldest); not NUL-terminated, its length is stored in *len */
+const char* history_get(const history_t* hist, size_t idx, size_t* len);
+
+/* append line[0..len) to memory and to the history file; returns -1 on error */
+int history_add(history_t* hist, const char* line, size_t len);
+
+/*
+ * Index of the newest entry older than 'before' that contains query[0..qlen),
+ * or -1. Pass history_count() as 'before' to search from the newest entry.
+ */
+long history_search(history_t* hist, const char* query, size_t qlen, size_t before);
+
+#endif /* PICO_HISTORY_H */
@@ -0,0 +1,385 @@
+#define _GNU_SOURCE
+
+#include "pico_launch.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* from linux/ioprio.h, which glibc does not wrap */
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_RT 1
+#define IOPRIO_CLASS_BE 2
+#define IOPRIO_CLASS_IDLE 3
+
+#define NODE_CPULIST "/sys/devices/system/node/node%ld/cpulist"
+
+static bool parse_long(const char* s, long min, long max, long* out)
+{
+    char* end = NULL;
+    errno = 0;
+    long v = strtol(s, &end, 10);
+    if (end == s || *end != '\0' || errno != 0 || v < min || v > max)
+    {
+        return false;
+    }
+    *out = v;
+    return true;
+}
+
+/* "0-7,16,18-19" as used by taskset -c and sysfs */
+static int parse_cpulist(const char* list, uint64_t* cpus)
+{
+    const char* p = list;
+    bool any = false;
+    while (*p != '\0' && *p != '\n')
+    {
+        char* end = NULL;
+        long lo = strtol(p, &end, 10);
+        long hi = lo;
+        if (end == p)
+        {
+            return -1;
+        }
+        if (*end == '-')
+        {
+            p = end + 1;
+            hi = strtol(p, &end, 10);
+            if (end == p)
+            {
+                return -1;
+            }
+        }
+        if (lo < 0 || hi < lo || hi >= LAUNCH_MAX_CPUS)
+        {
+            return -1;
+        }
+        for (long c = lo; c <= hi; ++c)
+        {
+            cpus[c / 64] |= 1ULL << (c % 64);
+        }
+        any = true;
+
+        p = end;
+        if (*p == ',')
+        {
+            p++;
+        }
+        else if (*p != '\0' && *p != '\n')
+        {
+            return -1;
+        }
+    }
+    return any ? 0 : -1;
+}
+
+/* "nodeN": the cpus the kernel lists for that NUMA node */
+static int parse_node(const char* arg, uint64_t* cpus)
+{
+    long node;
+    if (!parse_long(arg + 4, 0, INT_MAX, &node))
+    {
+        return -1;
+    }
+
+    char path[64];
+    char list[4096];
+    snprintf(path, sizeof(path), NODE_CPULIST, node);
+    FILE* f = fopen(path, "r");
+    if (f == NULL)
+    {
+        return -1;
+    }
+    char* got = fgets(list, sizeof(list), f);
+    fclose(f);
+    return got != NULL ? parse_cpulist(list, cpus) : -1;
+}
+
+static int parse_io_class(const char* s)
+{
+    long v;
+    if (strcmp(s, "realtime") == 0)
+    {
+        return IOPRIO_CLASS_RT;
+    }
+    if (strcmp(s, "best-effort") == 0)
+    {
+        return IOPRIO_CLASS_BE;
+    }
+    if (strcmp(s, "idle") == 0)
+    {
+        return IOPRIO_CLASS_IDLE;
+    }
+    return parse_long(s, IOPRIO_CLASS_RT, IOPRIO_CLASS_IDLE, &v) ? (int)v : -1;
+}
+
+/*
+ * Match argv[*i] against the option -c (value attached, "-c3", or in the
+ * next word) or --name ("--name=V" or "--name V"). Returns the value and
+ * moves *i past it, or NULL when the word is not that option.
+ */
+static const char* match_option(char** argv, size_t argc, size_t* i, char c, const char* name)
+{
+    const char* word = argv[*i];
+    size_t nlen = strlen(name);
+    const char* value = NULL;
+    if (word[0] == '-' && word[1] == c)
+    {
+        value = word + 2;
+    }
+    else if (strncmp(word, "--", 2) == 0 && strncmp(word + 2, name, nlen) == 0
+             && (word[2 + nlen] == '=' || word[2 + nlen] == '\0'))
+    {
+        value = word[2 + nlen] == '=' ? word + 3 + nlen : word + 2 + nlen;
+    }
+    if (value == NULL)
+    {
+        return NULL;
+    }
+    if (*value == '\0')
+    {
+        if (*i + 1 >= argc)
+        {
+            return NULL;
+        }
+        value = argv[++*i];
+    }
+    ++*i;
+    return value;
+}
+
+/* pin CPULIST|nodeN; returns the words taken, 0 when argv is not this syntax */
+static size_t parse_pin(char** argv, size_t argc, launch_attrs_t* attrs)
+{
+    if (argc < 2)
+    {
+        return 0;
+    }
+    const char* arg = argv[1];
+    uint64_t cpus[LAUNCH_MAX_CPUS / 64] = {0};
+    int rc = strncmp(arg, "node", 4) == 0 ? parse_node(arg, cpus) : parse_cpulist(arg, cpus);
+    if (rc != 0)
+    {
+        return 0;
+    }
+    memcpy(attrs->cpus, cpus, sizeof(cpus));
+    attrs->has_cpus = true;
+    return 2;
+}
+
+/* nice [-n N | -nN | --adjustment=N | -N | --N] */
+static size_t parse_nice(char** argv, size_t argc, launch_attrs_t* attrs)
+{
+    long n = 10;
+    size_t i = 1;
+    if (i < argc && strcmp(argv[i], "--") == 0)
+    {
+        i++;
+    }
+    else if (i < argc && argv[i][0] == '-')
+    {
+        const char* value = match_option(argv, argc, &i, 'n', "adjustment");
+        if (value == NULL)
+        {
+            /* the historic forms: "-N", and "--N" for a negative N */
+            const char* word = argv[i];
+            if (!isdigit((unsigned char)word[1]) && !(word[1] == '-' && isdigit((unsigned char)word[2])))
+            {
+                return 0;
+            }
+            value = word + 1;
+            i++;
+        }
+        if (!parse_long(value, -40, 40, &n))
+        {
+            return 0;
+        }
+    }
+    attrs->has_nice = true;
+    attrs->nice = (int)n;
+    return i;
+}
+
+/* ionice [-c CLASS | -cCLASS | --class=CLASS] [-n N | -nN | --classdata=N] */
+static size_t parse_ionice(char** argv, size_t argc, launch_attrs_t* attrs)
+{
+    int io_class = IOPRIO_CLASS_BE;
+    long level = 4;
+    size_t i = 1;
+    while (i < argc && argv[i][0] == '-')
+    {
+        if (strcmp(argv[i], "--") == 0)
+        {
+            i++;
+            break;
+        }
+        const char* value;
+        if ((value = match_option(argv, argc, &i, 'c', "class")) != NULL)
+        {
+            io_class = parse_io_class(value);
+            if (io_class < 0)
+            {
+                return 0;
+            }
+        }
+        else if ((value = match_option(argv, argc, &i, 'n', "classdata")) != NULL)
+        {
+            if (!parse_long(value, 0, 7, &level))
+            {
+                return 0;
+            }
+        }
+        else
+        {
+            /* -p, -t, ... : not a prefix use of ionice */
+            return 0;
+        }
+    }
+    attrs->has_ioprio = true;
+    attrs->io_class = io_class;
+    attrs->io_level = (int)level;
+    return i;
+}
+
+/* sched batch|idle|other */
+static size_t parse_sched(char** argv, size_t argc, launch_attrs_t* attrs)
+{
+    static const struct
+    {
+        const char* name;
+        int policy;
+    } policies[] = {{"batch", SCHED_BATCH}, {"idle", SCHED_IDLE}, {"other", SCHED_OTHER}};
+
+    for (size_t k = 0; argc >= 2 && k < sizeof(policies) / sizeof(policies[0]); ++k)
+    {
+        if (strcmp(argv[1], policies[k].name) == 0)
+        {
+            attrs->policy = policies[k].policy;
+            attrs->has_policy = true;
+            return 2;
+        }
+    }
+    return 0;
+}
+
+int launch_parse(char** argv, size_t argc, launch_attrs_t* attrs)
+{
+    memset(attrs, 0, sizeof(*attrs));
+
+    size_t i = 0;
+    while (i < argc)
+    {
+        /* attrs only changes when the whole modifier parsed and a command follows it */
+        launch_attrs_t next = *attrs;
+        size_t used = 0;
+        if (strcmp(argv[i], "pin") == 0)
+        {
+            used = parse_pin(argv + i, argc - i, &next);
+        }
+        else if (strcmp(argv[i], "nice") == 0)
+        {
+            used = parse_nice(argv + i, argc - i, &next);
+        }
+        else if (strcmp(argv[i], "ionice") == 0)
+        {
+            used = parse_ionice(argv + i, argc - i, &next);
+        }
+        else if (strcmp(argv[i], "sched") == 0)
+        {
+            used = parse_sched(argv + i, argc - i, &next);
+        }
+        if (used == 0 || i + used >= argc)
+        {
+            break;
+        }
+        *attrs = next;
+        i += used;
+    }
+
+    return (int)i;
+}
+
+void launch_spread(launch_attrs_t* attrs, size_t slot)
+{
+    cpu_set_t allowed;
+    int count;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1 || (count = CPU_COUNT(&allowed)) == 0)
+    {
+        return;
+    }
+
+    /* the (slot % count)-th cpu this process may run on */
+    size_t skip = slot % (size_t)count;
+    for (int cpu = 0; cpu < LAUNCH_MAX_CPUS; ++cpu)
+    {
+        if (CPU_ISSET(cpu, &allowed) && skip-- == 0)
+        {
+            memset(attrs->cpus, 0, sizeof(attrs->cpus));
+            attrs->cpus[cpu / 64] |= 1ULL << (cpu % 64);
+            attrs->has_cpus = true;
+            return;
+        }
+    }
+}
+
+int launch_apply(const launch_attrs_t* attrs)
+{
+    if (attrs->has_policy)
+    {
+        struct sched_param param = {0};
+        if (sched_setscheduler(0, attrs->policy, &param) == -1)
+        {
+            perror("sched");
+            return -1;
+        }
+    }
+
+    if (attrs->has_nice)
+    {
+        errno = 0;
+        int prio = getpriority(PRIO_PROCESS, 0);
+        if ((prio == -1 && errno != 0) || setpriority(PRIO_PROCESS, 0, prio + attrs->nice) == -1)
+        {
+            perror("nice");
+            return -1;
+        }
+    }
+
+    if (attrs->has_ioprio)
+    {
+        int level = attrs->io_class == IOPRIO_CLASS_IDLE ? 0 : attrs->io_level;
+        if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, attrs->io_class << IOPRIO_CLASS_SHIFT | level) == -1)
+        {
+            perror("ionice");
+            return -1;
+        }
+    }
+
+    if (attrs->has_cpus)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int c = 0; c < LAUNCH_MAX_CPUS; ++c)
+        {
+            if (attrs->cpus[c / 64] & (1ULL << (c % 64)))
+            {
+                CPU_SET(c, &set);
+            }
+        }
+        if (sched_setaffinity(0, sizeof(set), &set) == -1)
+        {
+            perror("pin");
+            return -1;
+        }
+    }
+
+    return 0;
+}
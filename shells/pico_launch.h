@@ -0,0 +1,55 @@
+#ifndef PICO_LAUNCH_H
+#define PICO_LAUNCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define LAUNCH_MAX_CPUS 1024 /* same as glibc's CPU_SETSIZE */
+
+/*
+ * Placement and scheduling for a command the shell forks, collected from
+ * the prefix modifiers in front of it:
+ *
+ *   pin CPULIST|nodeN cmd       CPU affinity ("0-7,16", or a NUMA node's cpus)
+ *   nice [-n N] cmd             niceness increment, 10 by default
+ *   ionice [-c CLASS] [-n N] cmd  I/O class realtime|best-effort|idle (or 1-3)
+ *   sched batch|idle|other cmd  scheduling policy
+ *
+ * nice and ionice also take the option spellings of nice(1) and ionice(1)
+ * ("nice -5", "--adjustment=5", "ionice -c3"). Modifiers chain ("pin 0-3
+ * nice sched batch make") and are applied in the child between fork and
+ * exec.
+ */
+typedef struct
+{
+    bool has_cpus;
+    uint64_t cpus[LAUNCH_MAX_CPUS / 64];
+    bool has_nice;
+    int nice;
+    bool has_ioprio;
+    int io_class;
+    int io_level;
+    bool has_policy;
+    int policy;
+} launch_attrs_t;
+
+/*
+ * Parse the modifiers at the start of argv into attrs (which is reset
+ * first) and return the number of words they take. A modifier word with
+ * arguments that do not parse, or with no command after it, is not taken:
+ * it is left to run as a command of that name, so "ionice -p 1" or a bare
+ * "nice" still reach the real tools.
+ */
+int launch_parse(char** argv, size_t argc, launch_attrs_t* attrs);
+
+/*
+ * Pin attrs to the slot-th CPU (modulo their number) that the shell itself
+ * may run on. Used for "set -o spreadcpus", where slot is the serve worker.
+ */
+void launch_spread(launch_attrs_t* attrs, size_t slot);
+
+/* apply attrs to the calling process; returns -1 after printing an error */
+int launch_apply(const launch_attrs_t* attrs);
+
+#endif /* PICO_LAUNCH_H */
@@ -0,0 +1,494 @@
+#define _GNU_SOURCE
+
+#include "pico_lineedit.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "robust_io.h"
+
+#define CTRL_KEY(c) ((c) & 0x1f)
+#define KEY_BACKSPACE 127
+#define SEARCH_MAX 256 /* longest reverse-search query */
+
+/* keys that arrive as escape sequences, above the byte range */
+enum
+{
+    KEY_EOF = -1,
+    KEY_NONE = -2, /* sequence we do not handle */
+    KEY_UP = 256,
+    KEY_DOWN,
+    KEY_RIGHT,
+    KEY_LEFT,
+    KEY_HOME,
+    KEY_END,
+    KEY_DELETE
+};
+
+typedef struct
+{
+    char* buf;
+    size_t len;
+    size_t cap;
+    size_t pos; /* cursor, byte offset into buf */
+} editbuf_t;
+
+static int enable_raw(struct termios* saved)
+{
+    if (tcgetattr(STDIN_FILENO, saved) == -1)
+    {
+        return -1;
+    }
+
+    struct termios raw = *saved;
+    raw.c_iflag &= ~(tcflag_t)(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+    raw.c_lflag &= ~(tcflag_t)(ECHO | ICANON | IEXTEN | ISIG);
+    raw.c_cflag |= CS8;
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    /* TCSADRAIN, not TCSAFLUSH: keep whatever was typed ahead while a command ran */
+    return tcsetattr(STDIN_FILENO, TCSADRAIN, &raw);
+}
+
+static void write_str(const char* s)
+{
+    rio_write_full(STDOUT_FILENO, s, strlen(s));
+}
+
+/* 1 on success, 0 at end of input, -1 on error */
+static int read_byte(unsigned char* c)
+{
+    ssize_t n = rio_read(STDIN_FILENO, c, 1);
+    return n == 1 ? 1 : (n == 0 ? 0 : -1);
+}
+
+/* one key press: a byte, or a KEY_* code for an escape sequence */
+static int read_key(void)
+{
+    unsigned char c;
+    if (read_byte(&c) != 1)
+    {
+        return KEY_EOF;
+    }
+    if (c != '\x1b')
+    {
+        return c;
+    }
+
+    unsigned char seq[2];
+    if (read_byte(&seq[0]) != 1 || read_byte(&seq[1]) != 1)
+    {
+        return KEY_EOF;
+    }
+
+    if (seq[0] == '[' && seq[1] >= '0' && seq[1] <= '9')
+    {
+        /* ESC [ n ~ */
+        unsigned char tilde;
+        if (read_byte(&tilde) != 1)
+        {
+            return KEY_EOF;
+        }
+        if (tilde != '~')
+        {
+            return KEY_NONE;
+        }
+        switch (seq[1])
+        {
+        case '1':
+        case '7':
+            return KEY_HOME;
+        case '3':
+            return KEY_DELETE;
+        case '4':
+        case '8':
+            return KEY_END;
+        default:
+            return KEY_NONE;
+        }
+    }
+
+    if (seq[0] == '[' || seq[0] == 'O')
+    {
+        switch (seq[1])
+        {
+        case 'A':
+            return KEY_UP;
+        case 'B':
+            return KEY_DOWN;
+        case 'C':
+            return KEY_RIGHT;
+        case 'D':
+            return KEY_LEFT;
+        case 'H':
+            return KEY_HOME;
+        case 'F':
+            return KEY_END;
+        default:
+            return KEY_NONE;
+        }
+    }
+    return KEY_NONE;
+}
+
+/* terminal columns taken by s[0..len): UTF-8 continuation bytes take none */
+static size_t columns(const char* s, size_t len)
+{
+    size_t cols = 0;
+    for (size_t i = 0; i < len; ++i)
+    {
+        cols += ((unsigned char)s[i] & 0xc0) != 0x80;
+    }
+    return cols;
+}
+
+/* redraw prompt + text on the current row and put the cursor at byte 'cursor' of text */
+static void refresh(const char* prompt, const char* text, size_t len, size_t cursor)
+{
+    char move[32] = "";
+    size_t col = columns(prompt, strlen(prompt)) + columns(text, cursor);
+    if (col > 0)
+    {
+        snprintf(move, sizeof(move), "\x1b[%zuC", col);
+    }
+
+    struct iovec iov[] = {
+        {"\r", 1},
+        {(void*)prompt, strlen(prompt)},
+        {(void*)text, len},
+        {"\x1b[K\r", 4},
+        {move, strlen(move)},
+    };
+    /* one write per redraw so the terminal never shows a half-drawn line */
+    while (writev(STDOUT_FILENO, iov, sizeof(iov) / sizeof(iov[0])) == -1 && errno == EINTR)
+    {
+    }
+}
+
+static int eb_reserve(editbuf_t* eb, size_t need)
+{
+    if (need + 1 <= eb->cap)
+    {
+        return 0;
+    }
+    size_t cap = eb->cap ? eb->cap : 128;
+    while (cap < need + 1)
+    {
+        cap *= 2;
+    }
+    char* buf = realloc(eb->buf, cap);
+    if (buf == NULL)
+    {
+        return -1;
+    }
+    eb->buf = buf;
+    eb->cap = cap;
+    return 0;
+}
+
+static int eb_insert(editbuf_t* eb, char c)
+{
+    if (eb_reserve(eb, eb->len + 1) != 0)
+    {
+        return -1;
+    }
+    memmove(eb->buf + eb->pos + 1, eb->buf + eb->pos, eb->len - eb->pos);
+    eb->buf[eb->pos++] = c;
+    eb->len++;
+    return 0;
+}
+
+static int eb_assign(editbuf_t* eb, const char* s, size_t len)
+{
+    if (eb_reserve(eb, len) != 0)
+    {
+        return -1;
+    }
+    memmove(eb->buf, s, len);
+    eb->len = len;
+    eb->pos = len;
+    return 0;
+}
+
+/* remove bytes [from, to) */
+static void eb_erase(editbuf_t* eb, size_t from, size_t to)
+{
+    memmove(eb->buf + from, eb->buf + to, eb->len - to);
+    eb->len -= to - from;
+    eb->pos = from;
+}
+
+/* cursor movement by whole UTF-8 characters */
+static size_t prev_char(const editbuf_t* eb, size_t pos)
+{
+    while (pos > 0 && ((unsigned char)eb->buf[--pos] & 0xc0) == 0x80)
+    {
+    }
+    return pos;
+}
+
+static size_t next_char(const editbuf_t* eb, size_t pos)
+{
+    while (pos < eb->len && ((unsigned char)eb->buf[++pos] & 0xc0) == 0x80)
+    {
+    }
+    return pos < eb->len ? pos : eb->len;
+}
+
+/*
+ * Ctrl-R mode. eb is only touched when a match is accepted; the key that
+ * ended the search is returned so the caller can act on it (Enter runs the
+ * match, an arrow key starts editing it), KEY_NONE after Ctrl-G / Ctrl-C.
+ */
+static int reverse_search(history_t* hist, editbuf_t* eb)
+{
+    char query[SEARCH_MAX];
+    size_t qlen = 0;
+    long match = -1;
+    bool failed = false;
+
+    for (;;)
+    {
+        const char* text = "";
+        size_t len = 0, cursor = 0;
+        if (match >= 0)
+        {
+            text = history_get(hist, (size_t)match, &len);
+            const char* hit = memmem(text, len, query, qlen);
+            cursor = hit != NULL ? (size_t)(hit - text) : 0;
+        }
+
+        char prompt[SEARCH_MAX + 32];
+        snprintf(prompt, sizeof(prompt), "(%sreverse-i-search)`%.*s': ", failed ? "failed " : "", (int)qlen, query);
+        refresh(prompt, text, len, cursor);
+
+        int key = read_key();
+        if (key == CTRL_KEY('R'))
+        {
+            /* next older match */
+            if (qlen > 0)
+            {
+                long m = history_search(hist, query, qlen, match >= 0 ? (size_t)match : history_count(hist));
+                failed = m < 0;
+                match = m >= 0 ? m : match;
+            }
+        }
+        else if (key == KEY_BACKSPACE || key == CTRL_KEY('H'))
+        {
+            if (qlen > 0)
+            {
+                qlen--;
+            }
+            match = qlen > 0 ? history_search(hist, query, qlen, history_count(hist)) : -1;
+            failed = qlen > 0 && match < 0;
+        }
+        else if (key == CTRL_KEY('G') || key == CTRL_KEY('C'))
+        {
+            return KEY_NONE;
+        }
+        else if (key >= 32 && key < 256 && key != KEY_BACKSPACE)
+        {
+            if (qlen < sizeof(query))
+            {
+                query[qlen++] = (char)key;
+            }
+            /* a longer query can still match the current entry */
+            long m = history_search(hist, query, qlen, match >= 0 ? (size_t)match + 1 : history_count(hist));
+            failed = m < 0;
+            match = m >= 0 ? m : match;
+        }
+        else
+        {
+            if (match >= 0 && eb_assign(eb, text, len) != 0)
+            {
+                return KEY_EOF;
+            }
+            return key;
+        }
+    }
+}
+
+ssize_t lineedit_read(history_t* hist, const char* prompt, char** line, size_t* cap)
+{
+    struct termios saved;
+    if (enable_raw(&saved) == -1)
+    {
+        return -1;
+    }
+
+    editbuf_t eb = {*line, 0, *cap, 0};
+    size_t hist_idx = history_count(hist);
+    char* scratch = NULL; /* the line being typed while browsing history */
+    size_t scratch_len = 0;
+    ssize_t result = 0;
+    bool done = false;
+
+    if (eb_reserve(&eb, 0) != 0)
+    {
+        result = -1;
+        done = true;
+    }
+
+    while (!done)
+    {
+        eb.buf[eb.len] = '\0';
+        refresh(prompt, eb.buf, eb.len, eb.pos);
+
+        int key = read_key();
+        if (key == CTRL_KEY('R'))
+        {
+            key = reverse_search(hist, &eb);
+        }
+
+        switch (key)
+        {
+        case KEY_EOF:
+            result = -1;
+            done = true;
+            break;
+        case KEY_NONE:
+            break;
+        case '\r':
+        case '\n':
+            eb.pos = eb.len;
+            eb.buf[eb.len] = '\0';
+            refresh(prompt, eb.buf, eb.len, eb.pos);
+            write_str("\r\n");
+            result = (ssize_t)eb.len;
+            done = true;
+            break;
+        case CTRL_KEY('C'):
+            write_str("^C\r\n");
+            eb.len = 0;
+            done = true;
+            break;
+        case CTRL_KEY('D'):
+            if (eb.len == 0)
+            {
+                write_str("\r\n");
+                result = -1;
+                done = true;
+            }
+            else if (eb.pos < eb.len)
+            {
+                eb_erase(&eb, eb.pos, next_char(&eb, eb.pos));
+            }
+            break;
+        case KEY_DELETE:
+            if (eb.pos < eb.len)
+            {
+                eb_erase(&eb, eb.pos, next_char(&eb, eb.pos));
+            }
+            break;
+        case KEY_BACKSPACE:
+        case CTRL_KEY('H'):
+            if (eb.pos > 0)
+            {
+                eb_erase(&eb, prev_char(&eb, eb.pos), eb.pos);
+            }
+            break;
+        case KEY_LEFT:
+        case CTRL_KEY('B'):
+            eb.pos = prev_char(&eb, eb.pos);
+            break;
+        case KEY_RIGHT:
+        case CTRL_KEY('F'):
+            eb.pos = next_char(&eb, eb.pos);
+            break;
+        case KEY_HOME:
+        case CTRL_KEY('A'):
+            eb.pos = 0;
+            break;
+        case KEY_END:
+        case CTRL_KEY('E'):
+            eb.pos = eb.len;
+            break;
+        case CTRL_KEY('K'):
+            eb.len = eb.pos;
+            break;
+        case CTRL_KEY('U'):
+            eb_erase(&eb, 0, eb.pos);
+            break;
+        case CTRL_KEY('L'):
+            write_str("\x1b[H\x1b[2J");
+            break;
+        case KEY_UP:
+        case CTRL_KEY('P'):
+            if (hist_idx == 0)
+            {
+                break;
+            }
+            if (hist_idx == history_count(hist))
+            {
+                free(scratch);
+                scratch = malloc(eb.len + 1);
+                if (scratch == NULL)
+                {
+                    result = -1;
+                    done = true;
+                    break;
+                }
+                memcpy(scratch, eb.buf, eb.len);
+                scratch_len = eb.len;
+            }
+            {
+                size_t len;
+                const char* text = history_get(hist, --hist_idx, &len);
+                if (eb_assign(&eb, text, len) != 0)
+                {
+                    result = -1;
+                    done = true;
+                }
+            }
+            break;
+        case KEY_DOWN:
+        case CTRL_KEY('N'):
+            if (hist_idx >= history_count(hist))
+            {
+                break;
+            }
+            if (++hist_idx == history_count(hist))
+            {
+                if (eb_assign(&eb, scratch, scratch_len) != 0)
+                {
+                    result = -1;
+                    done = true;
+                }
+            }
+            else
+            {
+                size_t len;
+                const char* text = history_get(hist, hist_idx, &len);
+                if (eb_assign(&eb, text, len) != 0)
+                {
+                    result = -1;
+                    done = true;
+                }
+            }
+            break;
+        default:
+            if (key >= 32 && key < 256 && eb_insert(&eb, (char)key) != 0)
+            {
+                result = -1;
+                done = true;
+            }
+            break;
+        }
+    }
+
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &saved);
+    free(scratch);
+    if (eb.buf != NULL)
+    {
+        eb.buf[result > 0 ? eb.len : 0] = '\0';
+    }
+    *line = eb.buf;
+    *cap = eb.cap;
+    return result;
+}
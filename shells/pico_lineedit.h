@@ -0,0 +1,17 @@
+#ifndef PICO_LINEEDIT_H
+#define PICO_LINEEDIT_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "pico_history.h"
+
+/*
+ * Read one line from a terminal in raw mode: left/right, Home/End,
+ * up/down through hist and Ctrl-R incremental reverse search. The line is
+ * stored NUL-terminated, without a newline, in the growable buffer
+ * *line / *cap (getline-style). Returns its length, or -1 at end of input.
+ */
+ssize_t lineedit_read(history_t* hist, const char* prompt, char** line, size_t* cap);
+
+#endif /* PICO_LINEEDIT_H */
@@ -0,0 +1,437 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "pico_memo.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "robust_io.h"
+
+#define MEMO_MAGIC "PICOMEMO"
+#define MEMO_BUF_SIZE (64 * 1024)
+#define MEMO_NAME_LEN 16           /* hex digits of the 64-bit key hash */
+#define MEMO_STALE_TMP_SEC 3600    /* temp files older than this were left by a dead shell */
+
+/* entry file: header, key, stdout bytes, stderr bytes */
+typedef struct
+{
+    char magic[8];
+    uint32_t key_len;
+    int32_t status;
+    uint64_t out_len;
+    uint64_t err_len;
+} memo_header_t;
+
+struct memo_key
+{
+    char* data;
+    size_t len;
+    size_t cap;
+};
+
+typedef struct
+{
+    char name[MEMO_NAME_LEN + 1];
+    off_t size;
+    struct timespec mtime;
+} memo_entry_t;
+
+static int buf_append(char** data, size_t* len, size_t* cap, const void* src, size_t n)
+{
+    if (*len + n > *cap)
+    {
+        size_t new_cap = *cap ? *cap : 256;
+        while (new_cap < *len + n)
+        {
+            new_cap *= 2;
+        }
+        char* tmp = realloc(*data, new_cap);
+        if (tmp == NULL)
+        {
+            return -1;
+        }
+        *data = tmp;
+        *cap = new_cap;
+    }
+    memcpy(*data + *len, src, n);
+    *len += n;
+    return 0;
+}
+
+memo_key_t* memo_key_new(void)
+{
+    return calloc(1, sizeof(memo_key_t));
+}
+
+void memo_key_free(memo_key_t* key)
+{
+    if (key != NULL)
+    {
+        free(key->data);
+        free(key);
+    }
+}
+
+int memo_key_add(memo_key_t* key, char tag, const void* data, size_t len)
+{
+    /* tag and length prefix keep ("ab", "c") and ("a", "bc") apart */
+    uint32_t len32 = (uint32_t)len;
+    if (buf_append(&key->data, &key->len, &key->cap, &tag, 1) != 0
+        || buf_append(&key->data, &key->len, &key->cap, &len32, sizeof(len32)) != 0)
+    {
+        return -1;
+    }
+    return buf_append(&key->data, &key->len, &key->cap, data, len);
+}
+
+int memo_key_add_file(memo_key_t* key, const char* path)
+{
+    if (memo_key_add(key, 'f', path, strlen(path)) != 0)
+    {
+        return -1;
+    }
+
+    struct stat st;
+    if (stat(path, &st) == -1)
+    {
+        return memo_key_add(key, 'm', "", 0);
+    }
+    uint64_t id[4] = {
+        (uint64_t)st.st_dev,
+        (uint64_t)st.st_ino,
+        (uint64_t)st.st_size,
+        (uint64_t)st.st_mtim.tv_sec * 1000000000u + (uint64_t)st.st_mtim.tv_nsec,
+    };
+    return memo_key_add(key, 's', id, sizeof(id));
+}
+
+/* FNV-1a, 64 bit */
+static uint64_t hash_key(const memo_key_t* key)
+{
+    uint64_t h = 14695981039346656037u;
+    for (size_t i = 0; i < key->len; ++i)
+    {
+        h ^= (unsigned char)key->data[i];
+        h *= 1099511628211u;
+    }
+    return h;
+}
+
+static int entry_path(char* path, size_t size, const char* dir, const memo_key_t* key)
+{
+    int n = snprintf(path, size, "%s/%016llx", dir, (unsigned long long)hash_key(key));
+    if (n < 0 || (size_t)n >= size)
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return 0;
+}
+
+int memo_dir_prepare(const char* dir)
+{
+    /* the default lives in ~/.cache/pico_memo, and ~/.cache may not exist yet */
+    char parent[4096];
+    const char* slash = strrchr(dir, '/');
+    if (slash != NULL && slash != dir && (size_t)(slash - dir) < sizeof(parent))
+    {
+        memcpy(parent, dir, (size_t)(slash - dir));
+        parent[slash - dir] = '\0';
+        if (mkdir(parent, 0700) == -1 && errno != EEXIST)
+        {
+            return -1;
+        }
+    }
+    if (mkdir(dir, 0700) == -1 && errno != EEXIST)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/* send len bytes of fd starting at off to out */
+static void replay_range(int fd, off_t off, uint64_t len, int out)
+{
+    char buf[MEMO_BUF_SIZE];
+    while (len > 0)
+    {
+        size_t want = len < sizeof(buf) ? (size_t)len : sizeof(buf);
+        ssize_t n = rio_pread_full(fd, buf, want, off);
+        if (n <= 0 || rio_write_full(out, buf, (size_t)n) != 0)
+        {
+            return;
+        }
+        off += n;
+        len -= (uint64_t)n;
+    }
+}
+
+int memo_replay(const char* dir, const memo_key_t* key, int* status)
+{
+    char path[4096];
+    if (entry_path(path, sizeof(path), dir, key) != 0)
+    {
+        return 0;
+    }
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return 0;
+    }
+
+    memo_header_t hdr;
+    struct stat st;
+    char* stored = malloc(key->len ? key->len : 1);
+    bool hit = stored != NULL
+               && pread(fd, &hdr, sizeof(hdr), 0) == (ssize_t)sizeof(hdr)
+               && memcmp(hdr.magic, MEMO_MAGIC, sizeof(hdr.magic)) == 0
+               && hdr.key_len == key->len
+               && fstat(fd, &st) == 0
+               && (uint64_t)st.st_size == sizeof(hdr) + hdr.key_len + hdr.out_len + hdr.err_len
+               && pread(fd, stored, key->len, sizeof(hdr)) == (ssize_t)key->len
+               && memcmp(stored, key->data, key->len) == 0;
+    free(stored);
+
+    if (hit)
+    {
+        off_t off = (off_t)(sizeof(hdr) + hdr.key_len);
+        replay_range(fd, off, hdr.out_len, STDOUT_FILENO);
+        replay_range(fd, off + (off_t)hdr.out_len, hdr.err_len, STDERR_FILENO);
+        *status = hdr.status;
+        /* the mtime is the LRU clock */
+        futimens(fd, NULL);
+    }
+    close(fd);
+    return hit ? 1 : 0;
+}
+
+static int compare_mtime(const void* a, const void* b)
+{
+    const struct timespec* x = &((const memo_entry_t*)a)->mtime;
+    const struct timespec* y = &((const memo_entry_t*)b)->mtime;
+    if (x->tv_sec != y->tv_sec)
+    {
+        return x->tv_sec < y->tv_sec ? -1 : 1;
+    }
+    return (x->tv_nsec > y->tv_nsec) - (x->tv_nsec < y->tv_nsec);
+}
+
+/*
+ * Drop least recently used entries until the cache is back under 90% of
+ * max_bytes, keeping the entry named keep that was just inserted. Another
+ * shell may be trimming at the same time, so entries that are already gone
+ * are simply skipped.
+ */
+static void evict(const char* dir, const char* keep, size_t max_bytes)
+{
+    int dfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR* d = dfd != -1 ? fdopendir(dfd) : NULL;
+    if (d == NULL)
+    {
+        if (dfd != -1)
+        {
+            close(dfd);
+        }
+        return;
+    }
+
+    memo_entry_t* entries = NULL;
+    size_t count = 0, cap = 0;
+    uint64_t total = 0;
+    time_t now = time(NULL);
+
+    struct dirent* de;
+    while ((de = readdir(d)) != NULL)
+    {
+        struct stat st;
+        if (fstatat(dfd, de->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1 || !S_ISREG(st.st_mode))
+        {
+            continue;
+        }
+        if (de->d_name[0] == '.')
+        {
+            if (strncmp(de->d_name, ".tmp.", 5) == 0 && now - st.st_mtime > MEMO_STALE_TMP_SEC)
+            {
+                unlinkat(dfd, de->d_name, 0);
+            }
+            continue;
+        }
+        if (strlen(de->d_name) != MEMO_NAME_LEN)
+        {
+            continue;
+        }
+        if (count == cap)
+        {
+            size_t new_cap = cap ? cap * 2 : 256;
+            memo_entry_t* tmp = realloc(entries, new_cap * sizeof(*tmp));
+            if (tmp == NULL)
+            {
+                break;
+            }
+            entries = tmp;
+            cap = new_cap;
+        }
+        memcpy(entries[count].name, de->d_name, MEMO_NAME_LEN + 1);
+        entries[count].size = st.st_size;
+        entries[count].mtime = st.st_mtim;
+        total += (uint64_t)st.st_size;
+        count++;
+    }
+
+    if (total > max_bytes)
+    {
+        qsort(entries, count, sizeof(*entries), compare_mtime);
+        uint64_t target = max_bytes / 10 * 9;
+        for (size_t i = 0; i < count && total > target; ++i)
+        {
+            if (strcmp(entries[i].name, keep) == 0)
+            {
+                continue;
+            }
+            if (unlinkat(dfd, entries[i].name, 0) == 0 || errno == ENOENT)
+            {
+                total -= (uint64_t)entries[i].size;
+            }
+        }
+    }
+
+    free(entries);
+    closedir(d);
+}
+
+int memo_record(const char* dir, const memo_key_t* key, int out_fd, int err_fd, pid_t pid, size_t max_bytes)
+{
+    char tmp_path[4096];
+    int n = snprintf(tmp_path, sizeof(tmp_path), "%s/.tmp.XXXXXX", dir);
+    int tmp_fd = (n > 0 && (size_t)n < sizeof(tmp_path)) ? mkstemp(tmp_path) : -1;
+
+    /* stdout goes straight into the entry after header and key, stderr is kept in memory */
+    memo_header_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    off_t off = (off_t)(sizeof(hdr) + key->len);
+    bool store = tmp_fd != -1 && pwrite(tmp_fd, key->data, key->len, sizeof(hdr)) == (ssize_t)key->len;
+    char* err_data = NULL;
+    size_t err_len = 0, err_cap = 0;
+
+    struct pollfd pfd[2] = {{out_fd, POLLIN, 0}, {err_fd, POLLIN, 0}};
+    char buf[MEMO_BUF_SIZE];
+    while (pfd[0].fd != -1 || pfd[1].fd != -1)
+    {
+        if (poll(pfd, 2, -1) == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("memo: poll");
+            break;
+        }
+        for (int i = 0; i < 2; ++i)
+        {
+            if (pfd[i].fd == -1 || pfd[i].revents == 0)
+            {
+                continue;
+            }
+            ssize_t got = read(pfd[i].fd, buf, sizeof(buf));
+            if (got == -1 && errno == EINTR)
+            {
+                continue;
+            }
+            if (got <= 0)
+            {
+                close(pfd[i].fd);
+                pfd[i].fd = -1;
+                continue;
+            }
+            rio_write_full(i == 0 ? STDOUT_FILENO : STDERR_FILENO, buf, (size_t)got);
+            if (!store)
+            {
+                continue;
+            }
+            if ((uint64_t)hdr.out_len + err_len + (size_t)got > max_bytes)
+            {
+                /* would not fit in the cache anyway */
+                store = false;
+            }
+            else if (i == 0)
+            {
+                store = pwrite(tmp_fd, buf, (size_t)got, off + (off_t)hdr.out_len) == got;
+                hdr.out_len += (uint64_t)got;
+            }
+            else
+            {
+                store = buf_append(&err_data, &err_len, &err_cap, buf, (size_t)got) == 0;
+            }
+        }
+    }
+    for (int i = 0; i < 2; ++i)
+    {
+        if (pfd[i].fd != -1)
+        {
+            close(pfd[i].fd);
+        }
+    }
+
+    char path[4096];
+    int wstatus = 0;
+    int status = 1;
+    while (waitpid(pid, &wstatus, 0) == -1)
+    {
+        if (errno != EINTR)
+        {
+            perror("memo: waitpid");
+            store = false;
+            break;
+        }
+    }
+    if (WIFEXITED(wstatus))
+    {
+        status = WEXITSTATUS(wstatus);
+    }
+    else if (WIFSIGNALED(wstatus))
+    {
+        status = 128 + WTERMSIG(wstatus);
+        store = false;
+    }
+    /* "command not found" is not a result worth keeping */
+    store = store && status != 127;
+
+    if (store)
+    {
+        memcpy(hdr.magic, MEMO_MAGIC, sizeof(hdr.magic));
+        hdr.key_len = (uint32_t)key->len;
+        hdr.status = status;
+        hdr.err_len = err_len;
+        store = pwrite(tmp_fd, err_data, err_len, off + (off_t)hdr.out_len) == (ssize_t)err_len
+                && pwrite(tmp_fd, &hdr, sizeof(hdr), 0) == (ssize_t)sizeof(hdr)
+                && entry_path(path, sizeof(path), dir, key) == 0
+                /* readers see either the old entry or the complete new one */
+                && rename(tmp_path, path) == 0;
+    }
+    if (tmp_fd != -1)
+    {
+        if (!store)
+        {
+            unlink(tmp_path);
+        }
+        close(tmp_fd);
+    }
+    free(err_data);
+
+    if (store)
+    {
+        evict(dir, strrchr(path, '/') + 1, max_bytes);
+    }
+    return status;
+}
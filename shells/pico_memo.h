@@ -0,0 +1,46 @@
+#ifndef PICO_MEMO_H
+#define PICO_MEMO_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * Result cache for the "memo" builtin. A key is the serialized description
+ * of a command run (argv, environment, input file identities); its FNV-1a
+ * hash names the entry file and the full key is stored in the entry and
+ * compared on lookup, so a hash collision is a miss rather than a wrong
+ * replay. Entries are written to a temporary file and renamed into place,
+ * and least-recently-used entries are evicted once the directory grows
+ * past its size limit, so several shells can share one cache directory.
+ */
+typedef struct memo_key memo_key_t;
+
+memo_key_t* memo_key_new(void);
+void memo_key_free(memo_key_t* key);
+
+/* append one tagged field; returns -1 when out of memory */
+int memo_key_add(memo_key_t* key, char tag, const void* data, size_t len);
+
+/* append path and its (dev, ino, size, mtime_ns), or a "missing" marker */
+int memo_key_add_file(memo_key_t* key, const char* path);
+
+/* create dir (and its parent) if needed; returns -1 with errno set */
+int memo_dir_prepare(const char* dir);
+
+/*
+ * Look the key up in dir. On a hit the stored stdout and stderr are written
+ * to fds 1 and 2, *status gets the stored exit status and 1 is returned;
+ * 0 is returned on a miss.
+ */
+int memo_replay(const char* dir, const memo_key_t* key, int* status);
+
+/*
+ * Forward out_fd / err_fd (read ends of the child's stdout / stderr pipes)
+ * to fds 1 and 2 until both hit EOF, wait for pid and store the result
+ * under key unless the child was killed by a signal or exited with 127.
+ * The cache is then trimmed to max_bytes. Returns the child's exit status
+ * in shell convention.
+ */
+int memo_record(const char* dir, const memo_key_t* key, int out_fd, int err_fd, pid_t pid, size_t max_bytes);
+
+#endif /* PICO_MEMO_H */
@@ -0,0 +1,1917 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "pico_script.h"
+#include "robust_io.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SCRIPT_MAGIC 0x31545341u  /* "AST1" */
+#define CACHE_MAGIC "PICOAST1"
+#define CACHE_VERSION 3           /* bump whenever a node layout changes */
+#define MAX_FD 9                  /* redirected descriptors stay below SAVED_FD_MIN */
+
+typedef enum
+{
+    TOK_EOF,
+    TOK_WORD,
+    TOK_NEWLINE,
+    TOK_SEMI,
+    TOK_AND,
+    TOK_OR,
+    TOK_LPAREN,
+    TOK_RPAREN,
+    TOK_REDIR
+} tok_type_t;
+
+/* reserved words, as bits so a list can be told where it ends */
+enum
+{
+    RW_NONE = 0,
+    RW_IF = 1 << 0,
+    RW_THEN = 1 << 1,
+    RW_ELIF = 1 << 2,
+    RW_ELSE = 1 << 3,
+    RW_FI = 1 << 4,
+    RW_WHILE = 1 << 5,
+    RW_UNTIL = 1 << 6,
+    RW_DO = 1 << 7,
+    RW_DONE = 1 << 8,
+    RW_FOR = 1 << 9,
+    RW_IN = 1 << 10,
+    RW_LBRACE = 1 << 11,
+    RW_RBRACE = 1 << 12,
+    RW_BANG = 1 << 13
+};
+
+static const struct
+{
+    const char* word;
+    int rw;
+} reserved_words[] = {
+    {"if", RW_IF}, {"then", RW_THEN}, {"elif", RW_ELIF}, {"else", RW_ELSE}, {"fi", RW_FI},
+    {"while", RW_WHILE}, {"until", RW_UNTIL}, {"do", RW_DO}, {"done", RW_DONE},
+    {"for", RW_FOR}, {"in", RW_IN}, {"{", RW_LBRACE}, {"}", RW_RBRACE}, {"!", RW_BANG},
+};
+
+typedef struct
+{
+    tok_type_t type;
+    word_t word;
+    sref_t plain;      /* TOK_WORD without quotes or expansions: its text */
+    int assign_eq;     /* offset of the '=' of a NAME=VALUE word, else -1 */
+    redir_kind_t redir;
+    int fd;
+    int line;
+} token_t;
+
+typedef struct
+{
+    const char* src;
+    size_t len;
+    size_t pos;
+    int line;
+    script_t* s;
+    script_status_t status;
+    token_t tok;
+    sref_t* names;     /* name table under construction */
+    uint32_t nnames;
+    uint32_t names_cap;
+    part_t* parts;     /* parts of the word being lexed */
+    size_t nparts;
+    size_t parts_cap;
+    char* lit;         /* literal text of the part being lexed */
+    size_t lit_len;
+    size_t lit_cap;
+    bool lit_quoted;   /* lit came from quotes or escapes: becomes PART_QUOTED */
+} parser_t;
+
+static void syntax_error(parser_t* p, const char* fmt, ...)
+{
+    if (p->status != SCRIPT_OK)
+    {
+        return;
+    }
+    va_list ap;
+    va_start(ap, fmt);
+    fprintf(stderr, "syntax error on line %d: ", p->line);
+    vfprintf(stderr, fmt, ap);
+    fputc('\n', stderr);
+    va_end(ap);
+    p->status = SCRIPT_SYNTAX;
+}
+
+static void incomplete(parser_t* p)
+{
+    if (p->status == SCRIPT_OK)
+    {
+        p->status = SCRIPT_INCOMPLETE;
+    }
+}
+
+/* zeroed, 8-byte aligned; 0 when out of memory */
+static sref_t arena_alloc(parser_t* p, size_t size)
+{
+    script_t* s = p->s;
+    size_t off = (s->len + 7) & ~(size_t)7;
+    if (off + size > UINT32_MAX)
+    {
+        p->status = SCRIPT_NOMEM;
+        return 0;
+    }
+    if (off + size > s->cap)
+    {
+        size_t cap = s->cap * 2;
+        while (cap < off + size)
+        {
+            cap *= 2;
+        }
+        char* arena = realloc(s->arena, cap);
+        if (arena == NULL)
+        {
+            p->status = SCRIPT_NOMEM;
+            return 0;
+        }
+        s->arena = arena;
+        s->cap = cap;
+    }
+    memset(s->arena + s->len, 0, off + size - s->len);
+    s->len = off + size;
+    return (sref_t)off;
+}
+
+static void* at(parser_t* p, sref_t ref)
+{
+    return p->s->arena + ref;
+}
+
+static sref_t arena_str(parser_t* p, const char* str, size_t len)
+{
+    /* str may itself live in the arena, which can move while growing */
+    bool inside = str >= p->s->arena && str < p->s->arena + p->s->len;
+    size_t from = inside ? (size_t)(str - p->s->arena) : 0;
+    sref_t ref = arena_alloc(p, len + 1);
+    if (ref != 0)
+    {
+        memcpy(at(p, ref), inside ? p->s->arena + from : str, len);
+    }
+    return ref;
+}
+
+/* index of name[0..len) in the name table, added if new */
+static uint32_t name_index(parser_t* p, const char* name, size_t len)
+{
+    for (uint32_t i = 0; i < p->nnames; ++i)
+    {
+        const char* n = at(p, p->names[i]);
+        if (strncmp(n, name, len) == 0 && n[len] == '\0')
+        {
+            return i;
+        }
+    }
+    if (p->nnames == p->names_cap)
+    {
+        uint32_t cap = p->names_cap ? p->names_cap * 2 : 16;
+        sref_t* names = realloc(p->names, cap * sizeof(*names));
+        if (names == NULL)
+        {
+            p->status = SCRIPT_NOMEM;
+            return 0;
+        }
+        p->names = names;
+        p->names_cap = cap;
+    }
+    sref_t ref = arena_str(p, name, len);
+    if (ref == 0)
+    {
+        return 0;
+    }
+    p->names[p->nnames] = ref;
+    return p->nnames++;
+}
+
+/* ---- lexer ---- */
+
+static int peek_at(const parser_t* p, size_t ahead)
+{
+    return p->pos + ahead < p->len ? (unsigned char)p->src[p->pos + ahead] : -1;
+}
+
+static bool is_name_start(int c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+static bool is_name_char(int c)
+{
+    return is_name_start(c) || (c >= '0' && c <= '9');
+}
+
+static void lit_push(parser_t* p, char c)
+{
+    if (p->lit_len + 1 >= p->lit_cap)
+    {
+        size_t cap = p->lit_cap ? p->lit_cap * 2 : 64;
+        char* lit = realloc(p->lit, cap);
+        if (lit == NULL)
+        {
+            p->status = SCRIPT_NOMEM;
+            return;
+        }
+        p->lit = lit;
+        p->lit_cap = cap;
+    }
+    p->lit[p->lit_len++] = c;
+}
+
+static void part_push(parser_t* p, part_t part)
+{
+    if (p->nparts == p->parts_cap)
+    {
+        size_t cap = p->parts_cap ? p->parts_cap * 2 : 8;
+        part_t* parts = realloc(p->parts, cap * sizeof(*parts));
+        if (parts == NULL)
+        {
+            p->status = SCRIPT_NOMEM;
+            return;
+        }
+        p->parts = parts;
+        p->parts_cap = cap;
+    }
+    p->parts[p->nparts++] = part;
+}
+
+static void lit_flush(parser_t* p)
+{
+    if (p->lit_len == 0)
+    {
+        return;
+    }
+    part_t part = {p->lit_quoted ? PART_QUOTED : PART_LIT, (uint32_t)p->lit_len, arena_str(p, p->lit, p->lit_len)};
+    p->lit_len = 0;
+    part_push(p, part);
+}
+
+/* append c to the literal, starting a new part where quoting changes so globbing can tell them apart */
+static void lit_push_as(parser_t* p, char c, bool quoted)
+{
+    if (p->lit_len > 0 && p->lit_quoted != quoted)
+    {
+        lit_flush(p);
+    }
+    p->lit_quoted = quoted;
+    lit_push(p, c);
+}
+
+/* ---- arithmetic, parsed out of $(( ... )) ---- */
+
+typedef struct
+{
+    parser_t* p;
+    const char* s;
+    size_t len;
+    size_t pos;
+} arith_parser_t;
+
+static sref_t arith_or(arith_parser_t* a);
+
+static void arith_skip(arith_parser_t* a)
+{
+    while (a->pos < a->len && (a->s[a->pos] == ' ' || a->s[a->pos] == '\t' || a->s[a->pos] == '\n'))
+    {
+        a->pos++;
+    }
+}
+
+/* consume op if it comes next (and is not the start of a longer operator) */
+static bool arith_accept(arith_parser_t* a, const char* op)
+{
+    arith_skip(a);
+    size_t n = strlen(op);
+    if (a->pos + n > a->len || strncmp(a->s + a->pos, op, n) != 0)
+    {
+        return false;
+    }
+    char next = a->pos + n < a->len ? a->s[a->pos + n] : '\0';
+    if (n == 1 && (op[0] == '<' || op[0] == '>' || op[0] == '!') && next == '=')
+    {
+        return false;
+    }
+    a->pos += n;
+    return true;
+}
+
+static sref_t arith_node(arith_parser_t* a, arith_op_t op, sref_t left, sref_t right)
+{
+    if (left == 0 || (right == 0 && op != ARITH_NEG && op != ARITH_NOT))
+    {
+        return 0;
+    }
+    sref_t ref = arena_alloc(a->p, sizeof(arith_t));
+    if (ref != 0)
+    {
+        arith_t* n = at(a->p, ref);
+        n->op = op;
+        n->left = left;
+        n->right = right;
+    }
+    return ref;
+}
+
+static sref_t arith_primary(arith_parser_t* a)
+{
+    arith_skip(a);
+    if (arith_accept(a, "("))
+    {
+        sref_t inner = arith_or(a);
+        if (!arith_accept(a, ")"))
+        {
+            return 0;
+        }
+        return inner;
+    }
+
+    size_t start = a->pos;
+    if (a->pos < a->len && a->s[a->pos] >= '0' && a->s[a->pos] <= '9')
+    {
+        int64_t v = 0;
+        while (a->pos < a->len && a->s[a->pos] >= '0' && a->s[a->pos] <= '9')
+        {
+            int digit = a->s[a->pos++] - '0';
+            if (v > (INT64_MAX - digit) / 10)
+            {
+                while (a->pos < a->len && a->s[a->pos] >= '0' && a->s[a->pos] <= '9')
+                {
+                    a->pos++;
+                }
+                syntax_error(a->p, "%.*s: number out of range", (int)(a->pos - start), a->s + start);
+                return 0;
+            }
+            v = v * 10 + digit;
+        }
+        sref_t ref = arena_alloc(a->p, sizeof(arith_t));
+        if (ref != 0)
+        {
+            arith_t* n = at(a->p, ref);
+            n->op = ARITH_NUM;
+            n->num = v;
+        }
+        return ref;
+    }
+
+    /* NAME, $NAME, or $1... / $# */
+    if (a->pos < a->len && a->s[a->pos] == '$')
+    {
+        start = ++a->pos;
+        char c = a->pos < a->len ? a->s[a->pos] : '\0';
+        if ((c >= '0' && c <= '9') || c == '#' || c == '?')
+        {
+            a->pos++;
+            sref_t ref = arena_alloc(a->p, sizeof(arith_t));
+            if (ref != 0)
+            {
+                arith_t* n = at(a->p, ref);
+                n->op = ARITH_PARAM;
+                n->var = (uint32_t)c;
+            }
+            return ref;
+        }
+    }
+    while (a->pos < a->len && is_name_char((unsigned char)a->s[a->pos]))
+    {
+        a->pos++;
+    }
+    if (a->pos == start || !is_name_start((unsigned char)a->s[start]))
+    {
+        return 0;
+    }
+    uint32_t idx = name_index(a->p, a->s + start, a->pos - start);
+    sref_t ref = arena_alloc(a->p, sizeof(arith_t));
+    if (ref != 0)
+    {
+        arith_t* n = at(a->p, ref);
+        n->op = ARITH_VAR;
+        n->var = idx;
+    }
+    return ref;
+}
+
+static sref_t arith_unary(arith_parser_t* a)
+{
+    if (arith_accept(a, "-"))
+    {
+        return arith_node(a, ARITH_NEG, arith_unary(a), 0);
+    }
+    if (arith_accept(a, "!"))
+    {
+        return arith_node(a, ARITH_NOT, arith_unary(a), 0);
+    }
+    if (arith_accept(a, "+"))
+    {
+        return arith_unary(a);
+    }
+    return arith_primary(a);
+}
+
+/* one precedence level: left-associative ops[i] -> codes[i] over 'next' */
+static sref_t arith_level(arith_parser_t* a, sref_t (*next)(arith_parser_t*), const char* const* ops,
+                          const arith_op_t* codes, size_t nops)
+{
+    sref_t left = next(a);
+    for (;;)
+    {
+        size_t i = 0;
+        while (i < nops && !arith_accept(a, ops[i]))
+        {
+            i++;
+        }
+        if (i == nops || left == 0)
+        {
+            return left;
+        }
+        left = arith_node(a, codes[i], left, next(a));
+    }
+}
+
+static sref_t arith_mul(arith_parser_t* a)
+{
+    static const char* const ops[] = {"*", "/", "%"};
+    static const arith_op_t codes[] = {ARITH_MUL, ARITH_DIV, ARITH_MOD};
+    return arith_level(a, arith_unary, ops, codes, 3);
+}
+
+static sref_t arith_add(arith_parser_t* a)
+{
+    static const char* const ops[] = {"+", "-"};
+    static const arith_op_t codes[] = {ARITH_ADD, ARITH_SUB};
+    return arith_level(a, arith_mul, ops, codes, 2);
+}
+
+static sref_t arith_rel(arith_parser_t* a)
+{
+    static const char* const ops[] = {"<=", ">=", "<", ">"};
+    static const arith_op_t codes[] = {ARITH_LE, ARITH_GE, ARITH_LT, ARITH_GT};
+    return arith_level(a, arith_add, ops, codes, 4);
+}
+
+static sref_t arith_eq(arith_parser_t* a)
+{
+    static const char* const ops[] = {"==", "!="};
+    static const arith_op_t codes[] = {ARITH_EQ, ARITH_NE};
+    return arith_level(a, arith_rel, ops, codes, 2);
+}
+
+static sref_t arith_and(arith_parser_t* a)
+{
+    static const char* const ops[] = {"&&"};
+    static const arith_op_t codes[] = {ARITH_AND};
+    return arith_level(a, arith_eq, ops, codes, 1);
+}
+
+static sref_t arith_or(arith_parser_t* a)
+{
+    static const char* const ops[] = {"||"};
+    static const arith_op_t codes[] = {ARITH_OR};
+    return arith_level(a, arith_and, ops, codes, 1);
+}
+
+/* $((expr)) starting at p->pos (just past "$(("); adds a PART_ARITH */
+static void lex_arith(parser_t* p)
+{
+    size_t start = p->pos;
+    int depth = 0;
+    while (p->pos < p->len)
+    {
+        char c = p->src[p->pos];
+        if (c == '(')
+        {
+            depth++;
+        }
+        else if (c == ')')
+        {
+            if (depth == 0)
+            {
+                break;
+            }
+            depth--;
+        }
+        p->pos++;
+    }
+    if (p->pos + 1 >= p->len)
+    {
+        incomplete(p);
+        return;
+    }
+    if (p->src[p->pos + 1] != ')')
+    {
+        syntax_error(p, "missing '))'");
+        return;
+    }
+
+    arith_parser_t a = {p, p->src + start, p->pos - start, 0};
+    sref_t expr = arith_or(&a);
+    arith_skip(&a);
+    if (expr == 0 || a.pos != a.len)
+    {
+        syntax_error(p, "bad arithmetic expression '%.*s'", (int)(p->pos - start), p->src + start);
+        return;
+    }
+    p->pos += 2;
+    part_t part = {PART_ARITH, 0, expr};
+    part_push(p, part);
+}
+
+/* a '$' expansion, p->pos just past the '$' */
+static void lex_dollar(parser_t* p, uint32_t* flags)
+{
+    int c = peek_at(p, 0);
+    if (c == '(' && peek_at(p, 1) == '(')
+    {
+        lit_flush(p);
+        p->pos += 2;
+        lex_arith(p);
+        *flags &= ~(uint32_t)WORD_ALL_ARGS;
+        return;
+    }
+    if (c == '(')
+    {
+        syntax_error(p, "command substitution is not supported");
+        return;
+    }
+    if (c == '{')
+    {
+        size_t start = p->pos + 1;
+        const char* close = memchr(p->src + start, '}', p->len - start);
+        if (close == NULL)
+        {
+            incomplete(p);
+            return;
+        }
+        size_t n = (size_t)(close - (p->src + start));
+        const char* name = p->src + start;
+        lit_flush(p);
+        if (n == 1 && strchr("?$#@*0123456789", name[0]) != NULL)
+        {
+            part_t part = {PART_SPECIAL, (uint32_t)(unsigned char)name[0], 0};
+            part_push(p, part);
+        }
+        else if (n > 0 && is_name_start((unsigned char)name[0]))
+        {
+            for (size_t i = 1; i < n; ++i)
+            {
+                if (!is_name_char((unsigned char)name[i]))
+                {
+                    syntax_error(p, "bad substitution '${%.*s}'", (int)n, name);
+                    return;
+                }
+            }
+            part_t part = {PART_VAR, name_index(p, name, n), 0};
+            part_push(p, part);
+        }
+        else
+        {
+            syntax_error(p, "bad substitution '${%.*s}'", (int)n, name);
+            return;
+        }
+        p->pos = start + n + 1;
+        return;
+    }
+    if (c != -1 && is_name_start(c))
+    {
+        size_t start = p->pos;
+        while (is_name_char(peek_at(p, 0)))
+        {
+            p->pos++;
+        }
+        lit_flush(p);
+        part_t part = {PART_VAR, name_index(p, p->src + start, p->pos - start), 0};
+        part_push(p, part);
+        return;
+    }
+    if (c != -1 && strchr("?$#@*0123456789", c) != NULL)
+    {
+        lit_flush(p);
+        part_t part = {PART_SPECIAL, (uint32_t)c, 0};
+        part_push(p, part);
+        p->pos++;
+        return;
+    }
+    /* a lone '$' is literal */
+    lit_push(p, '$');
+}
+
+/* [n]< [n]> [n]>> [n]<& [n]>& at p->pos; fd is -1 when no number was given */
+static void lex_redir(parser_t* p, int fd)
+{
+    char op = p->src[p->pos++];
+    p->tok.type = TOK_REDIR;
+    p->tok.fd = fd >= 0 ? fd : (op == '<' ? 0 : 1);
+    if (op == '>' && peek_at(p, 0) == '>')
+    {
+        p->pos++;
+        p->tok.redir = REDIR_APPEND;
+    }
+    else if (peek_at(p, 0) == '&')
+    {
+        p->pos++;
+        p->tok.redir = REDIR_DUP;
+    }
+    else
+    {
+        p->tok.redir = op == '<' ? REDIR_IN : REDIR_OUT;
+    }
+    if (p->tok.fd > MAX_FD)
+    {
+        syntax_error(p, "%d: bad file descriptor", p->tok.fd);
+    }
+}
+
+static void lex_word(parser_t* p)
+{
+    uint32_t flags = 0;
+    bool simple = true; /* no quotes or expansions yet: may still be NAME=VALUE or an fd number */
+    int assign_eq = -1;
+    bool dquote = false;
+    bool open_bracket = false; /* '[' and '{' only make a pattern once closed */
+    bool open_brace = false;
+    p->nparts = 0;
+    p->lit_len = 0;
+
+    while (p->status == SCRIPT_OK)
+    {
+        int c = peek_at(p, 0);
+        if (c == -1)
+        {
+            if (dquote)
+            {
+                incomplete(p);
+            }
+            break;
+        }
+
+        if (dquote)
+        {
+            p->pos++;
+            if (c == '"')
+            {
+                dquote = false;
+            }
+            else if (c == '\\' && peek_at(p, 0) != -1 && strchr("\"\\$`\n", peek_at(p, 0)) != NULL)
+            {
+                if (peek_at(p, 0) != '\n')
+                {
+                    lit_push_as(p, p->src[p->pos], true);
+                }
+                p->pos++;
+            }
+            else if (c == '$')
+            {
+                lex_dollar(p, &flags);
+            }
+            else
+            {
+                if (c == '\n')
+                {
+                    p->line++;
+                }
+                lit_push_as(p, (char)c, true);
+            }
+            continue;
+        }
+
+        if (c == ' ' || c == '\t' || c == '\n' || c == ';' || c == '(' || c == ')'
+            || (c == '&' && peek_at(p, 1) == '&') || (c == '|' && peek_at(p, 1) == '|'))
+        {
+            break;
+        }
+
+        if (c == '<' || c == '>')
+        {
+            /* "2>" makes the word an fd number; "word>" ends the word */
+            bool digits = simple && p->nparts == 0 && p->lit_len > 0;
+            for (size_t i = 0; digits && i < p->lit_len; ++i)
+            {
+                digits = p->lit[i] >= '0' && p->lit[i] <= '9';
+            }
+            if (digits || (p->nparts == 0 && p->lit_len == 0 && flags == 0))
+            {
+                int fd = -1;
+                if (digits)
+                {
+                    p->lit[p->lit_len] = '\0';
+                    errno = 0;
+                    long n = strtol(p->lit, NULL, 10);
+                    if (errno == ERANGE || n > MAX_FD)
+                    {
+                        syntax_error(p, "%s: bad file descriptor", p->lit);
+                        return;
+                    }
+                    fd = (int)n;
+                }
+                lex_redir(p, fd);
+                return;
+            }
+            break;
+        }
+
+        p->pos++;
+        if (c == '\'')
+        {
+            const char* close = memchr(p->src + p->pos, '\'', p->len - p->pos);
+            if (close == NULL)
+            {
+                incomplete(p);
+                break;
+            }
+            for (const char* q = p->src + p->pos; q < close; ++q)
+            {
+                p->line += *q == '\n';
+                lit_push_as(p, *q, true);
+            }
+            p->pos = (size_t)(close - p->src) + 1;
+            flags |= WORD_QUOTED;
+            simple = false;
+        }
+        else if (c == '"')
+        {
+            dquote = true;
+            flags |= WORD_QUOTED;
+            simple = false;
+        }
+        else if (c == '\\')
+        {
+            int next = peek_at(p, 0);
+            if (next == -1)
+            {
+                incomplete(p);
+                break;
+            }
+            p->pos++;
+            if (next == '\n')
+            {
+                /* line continuation */
+                p->line++;
+                continue;
+            }
+            lit_push_as(p, (char)next, true);
+            flags |= WORD_QUOTED;
+            simple = false;
+        }
+        else if (c == '$')
+        {
+            simple = false;
+            lex_dollar(p, &flags);
+        }
+        else
+        {
+            if (c == '=' && simple && assign_eq < 0 && p->nparts == 0)
+            {
+                assign_eq = (int)p->lit_len;
+            }
+            if (c == '*' || c == '?' || (c == ']' && open_bracket) || (c == '}' && open_brace))
+            {
+                flags |= WORD_GLOB;
+            }
+            open_bracket = open_bracket || c == '[';
+            open_brace = open_brace || c == '{';
+            lit_push_as(p, (char)c, false);
+        }
+    }
+    lit_flush(p);
+    if (p->status != SCRIPT_OK)
+    {
+        return;
+    }
+
+    /* "$@" alone: one word per positional parameter */
+    if (p->nparts == 1 && p->parts[0].kind == PART_SPECIAL && p->parts[0].val == '@')
+    {
+        flags |= WORD_ALL_ARGS;
+    }
+
+    sref_t parts = arena_alloc(p, p->nparts * sizeof(part_t) + 1);
+    if (parts == 0)
+    {
+        return;
+    }
+    memcpy(at(p, parts), p->parts, p->nparts * sizeof(part_t));
+
+    p->tok.type = TOK_WORD;
+    p->tok.word.nparts = (uint32_t)p->nparts;
+    p->tok.word.flags = flags;
+    p->tok.word.parts = parts;
+    p->tok.plain = (simple && p->nparts == 1) ? p->parts[0].data : 0;
+    p->tok.assign_eq = -1;
+    if (assign_eq > 0 && p->parts[0].kind == PART_LIT && vars_valid_name(at(p, p->parts[0].data), (size_t)assign_eq))
+    {
+        p->tok.assign_eq = assign_eq;
+    }
+}
+
+static void next_token(parser_t* p)
+{
+    memset(&p->tok, 0, sizeof(p->tok));
+    p->tok.assign_eq = -1;
+    if (p->status != SCRIPT_OK)
+    {
+        p->tok.type = TOK_EOF;
+        return;
+    }
+
+    for (;;)
+    {
+        int c = peek_at(p, 0);
+        if (c == ' ' || c == '\t')
+        {
+            p->pos++;
+        }
+        else if (c == '\\' && peek_at(p, 1) == '\n')
+        {
+            p->pos += 2;
+            p->line++;
+        }
+        else if (c == '#')
+        {
+            while (peek_at(p, 0) != -1 && peek_at(p, 0) != '\n')
+            {
+                p->pos++;
+            }
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    p->tok.line = p->line;
+    int c = peek_at(p, 0);
+    switch (c)
+    {
+    case -1:
+        p->tok.type = TOK_EOF;
+        return;
+    case '\n':
+        p->pos++;
+        p->line++;
+        p->tok.type = TOK_NEWLINE;
+        return;
+    case ';':
+        p->pos++;
+        p->tok.type = TOK_SEMI;
+        return;
+    case '(':
+        p->pos++;
+        p->tok.type = TOK_LPAREN;
+        return;
+    case ')':
+        p->pos++;
+        p->tok.type = TOK_RPAREN;
+        return;
+    default:
+        break;
+    }
+    if (c == '&' && peek_at(p, 1) == '&')
+    {
+        p->pos += 2;
+        p->tok.type = TOK_AND;
+        return;
+    }
+    if (c == '|' && peek_at(p, 1) == '|')
+    {
+        p->pos += 2;
+        p->tok.type = TOK_OR;
+        return;
+    }
+    lex_word(p);
+    if (p->status != SCRIPT_OK)
+    {
+        p->tok.type = TOK_EOF;
+    }
+}
+
+/* ---- parser ---- */
+
+static int reserved(parser_t* p)
+{
+    if (p->tok.type != TOK_WORD || p->tok.plain == 0)
+    {
+        return RW_NONE;
+    }
+    const char* w = at(p, p->tok.plain);
+    for (size_t i = 0; i < sizeof(reserved_words) / sizeof(reserved_words[0]); ++i)
+    {
+        if (strcmp(w, reserved_words[i].word) == 0)
+        {
+            return reserved_words[i].rw;
+        }
+    }
+    return RW_NONE;
+}
+
+static const char* token_text(parser_t* p)
+{
+    switch (p->tok.type)
+    {
+    case TOK_EOF:
+        return "end of file";
+    case TOK_NEWLINE:
+        return "newline";
+    case TOK_SEMI:
+        return ";";
+    case TOK_AND:
+        return "&&";
+    case TOK_OR:
+        return "||";
+    case TOK_LPAREN:
+        return "(";
+    case TOK_RPAREN:
+        return ")";
+    case TOK_REDIR:
+        return "redirection";
+    case TOK_WORD:
+        break;
+    }
+    return p->tok.plain != 0 ? at(p, p->tok.plain) : "word";
+}
+
+/* report the current token as unexpected, or ask for more input at the end */
+static void unexpected(parser_t* p)
+{
+    if (p->tok.type == TOK_EOF)
+    {
+        incomplete(p);
+    }
+    else
+    {
+        syntax_error(p, "unexpected '%s'", token_text(p));
+    }
+}
+
+static bool expect_reserved(parser_t* p, int rw)
+{
+    if (reserved(p) != rw)
+    {
+        unexpected(p);
+        return false;
+    }
+    next_token(p);
+    return true;
+}
+
+static void skip_newlines(parser_t* p)
+{
+    while (p->tok.type == TOK_NEWLINE)
+    {
+        next_token(p);
+    }
+}
+
+static sref_t parse_list(parser_t* p, int stop);
+static sref_t parse_command(parser_t* p);
+
+static sref_t make_binary(parser_t* p, node_kind_t kind, sref_t left, sref_t right)
+{
+    sref_t ref = arena_alloc(p, sizeof(binary_node_t));
+    if (ref != 0)
+    {
+        binary_node_t* n = at(p, ref);
+        n->kind = kind;
+        n->left = left;
+        n->right = right;
+    }
+    return ref;
+}
+
+static sref_t parse_pipeline(parser_t* p)
+{
+    if (reserved(p) == RW_BANG)
+    {
+        next_token(p);
+        sref_t child = parse_command(p);
+        return child != 0 ? make_binary(p, NODE_NOT, child, 0) : 0;
+    }
+    return parse_command(p);
+}
+
+static sref_t parse_and_or(parser_t* p)
+{
+    sref_t left = parse_pipeline(p);
+    while (left != 0 && (p->tok.type == TOK_AND || p->tok.type == TOK_OR))
+    {
+        node_kind_t kind = p->tok.type == TOK_AND ? NODE_AND : NODE_OR;
+        next_token(p);
+        skip_newlines(p);
+        sref_t right = parse_pipeline(p);
+        left = right != 0 ? make_binary(p, kind, left, right) : 0;
+    }
+    return left;
+}
+
+/* commands up to a reserved word in stop (or the end of input when stop is 0) */
+static sref_t parse_list(parser_t* p, int stop)
+{
+    sref_t* items = NULL;
+    uint32_t count = 0, cap = 0;
+
+    for (;;)
+    {
+        while (p->tok.type == TOK_NEWLINE || p->tok.type == TOK_SEMI)
+        {
+            next_token(p);
+        }
+        if (p->status != SCRIPT_OK)
+        {
+            break;
+        }
+        if (p->tok.type == TOK_EOF)
+        {
+            if (stop != RW_NONE)
+            {
+                incomplete(p);
+            }
+            break;
+        }
+        if ((reserved(p) & stop) != 0)
+        {
+            break;
+        }
+
+        sref_t item = parse_and_or(p);
+        if (item == 0)
+        {
+            break;
+        }
+        if (count == cap)
+        {
+            cap = cap ? cap * 2 : 8;
+            sref_t* tmp = realloc(items, cap * sizeof(*tmp));
+            if (tmp == NULL)
+            {
+                p->status = SCRIPT_NOMEM;
+                break;
+            }
+            items = tmp;
+        }
+        items[count++] = item;
+
+        if (p->tok.type != TOK_NEWLINE && p->tok.type != TOK_SEMI && p->tok.type != TOK_EOF
+            && (reserved(p) & stop) == 0)
+        {
+            unexpected(p);
+            break;
+        }
+    }
+
+    sref_t ref = 0;
+    if (p->status == SCRIPT_OK)
+    {
+        ref = arena_alloc(p, sizeof(list_node_t));
+        sref_t arr = ref != 0 ? arena_alloc(p, count * sizeof(sref_t) + 1) : 0;
+        if (arr != 0)
+        {
+            memcpy(at(p, arr), items, count * sizeof(sref_t));
+            list_node_t* n = at(p, ref);
+            n->kind = NODE_LIST;
+            n->count = count;
+            n->items = arr;
+        }
+        else
+        {
+            ref = 0;
+        }
+    }
+    free(items);
+    return ref;
+}
+
+/* after "if" or "elif": cond; then list [elif ...|else list] fi */
+static sref_t parse_if_tail(parser_t* p)
+{
+    sref_t cond = parse_list(p, RW_THEN);
+    if (cond == 0 || !expect_reserved(p, RW_THEN))
+    {
+        return 0;
+    }
+    sref_t then_part = parse_list(p, RW_ELIF | RW_ELSE | RW_FI);
+    if (then_part == 0)
+    {
+        return 0;
+    }
+
+    sref_t else_part = 0;
+    int rw = reserved(p);
+    next_token(p);
+    if (rw == RW_ELIF)
+    {
+        else_part = parse_if_tail(p);
+        if (else_part == 0)
+        {
+            return 0;
+        }
+    }
+    else if (rw == RW_ELSE)
+    {
+        else_part = parse_list(p, RW_FI);
+        if (else_part == 0 || !expect_reserved(p, RW_FI))
+        {
+            return 0;
+        }
+    }
+
+    sref_t ref = arena_alloc(p, sizeof(if_node_t));
+    if (ref != 0)
+    {
+        if_node_t* n = at(p, ref);
+        n->kind = NODE_IF;
+        n->cond = cond;
+        n->then_part = then_part;
+        n->else_part = else_part;
+    }
+    return ref;
+}
+
+static sref_t parse_loop(parser_t* p, node_kind_t kind)
+{
+    sref_t cond = parse_list(p, RW_DO);
+    if (cond == 0 || !expect_reserved(p, RW_DO))
+    {
+        return 0;
+    }
+    sref_t body = parse_list(p, RW_DONE);
+    if (body == 0 || !expect_reserved(p, RW_DONE))
+    {
+        return 0;
+    }
+
+    sref_t ref = arena_alloc(p, sizeof(loop_node_t));
+    if (ref != 0)
+    {
+        loop_node_t* n = at(p, ref);
+        n->kind = kind;
+        n->cond = cond;
+        n->body = body;
+    }
+    return ref;
+}
+
+/* copy the words of tokens into one word_t array */
+static sref_t push_word(parser_t* p, word_t** words, uint32_t* count, uint32_t* cap, word_t w)
+{
+    if (*count == *cap)
+    {
+        *cap = *cap ? *cap * 2 : 8;
+        word_t* tmp = realloc(*words, *cap * sizeof(*tmp));
+        if (tmp == NULL)
+        {
+            p->status = SCRIPT_NOMEM;
+            return 0;
+        }
+        *words = tmp;
+    }
+    (*words)[(*count)++] = w;
+    return 1;
+}
+
+static sref_t store_array(parser_t* p, const void* items, size_t size)
+{
+    sref_t ref = arena_alloc(p, size + 1);
+    if (ref != 0 && size > 0)
+    {
+        memcpy(at(p, ref), items, size);
+    }
+    return ref;
+}
+
+/* after "for": NAME [in words...] ; do list done */
+static sref_t parse_for(parser_t* p)
+{
+    if (p->tok.type != TOK_WORD || p->tok.plain == 0 || !vars_valid_name(at(p, p->tok.plain), strlen(at(p, p->tok.plain))))
+    {
+        if (p->tok.type == TOK_EOF)
+        {
+            incomplete(p);
+        }
+        else
+        {
+            syntax_error(p, "bad for loop variable '%s'", token_text(p));
+        }
+        return 0;
+    }
+    const char* name = at(p, p->tok.plain);
+    uint32_t var = name_index(p, name, strlen(name));
+    next_token(p);
+    skip_newlines(p);
+
+    word_t* words = NULL;
+    uint32_t count = 0, cap = 0;
+    bool has_in = reserved(p) == RW_IN;
+    if (has_in)
+    {
+        next_token(p);
+        while (p->tok.type == TOK_WORD && p->status == SCRIPT_OK)
+        {
+            push_word(p, &words, &count, &cap, p->tok.word);
+            next_token(p);
+        }
+    }
+    else
+    {
+        /* no "in": loop over "$@" */
+        part_t all = {PART_SPECIAL, '@', 0};
+        word_t w = {1, WORD_ALL_ARGS, store_array(p, &all, sizeof(all))};
+        push_word(p, &words, &count, &cap, w);
+    }
+    if (p->tok.type != TOK_SEMI && p->tok.type != TOK_NEWLINE && (has_in || reserved(p) != RW_DO))
+    {
+        unexpected(p);
+    }
+    while (p->tok.type == TOK_SEMI || p->tok.type == TOK_NEWLINE)
+    {
+        next_token(p);
+    }
+
+    sref_t body = 0;
+    if (p->status == SCRIPT_OK && expect_reserved(p, RW_DO))
+    {
+        body = parse_list(p, RW_DONE);
+        if (body != 0 && !expect_reserved(p, RW_DONE))
+        {
+            body = 0;
+        }
+    }
+
+    sref_t ref = 0;
+    if (body != 0)
+    {
+        sref_t arr = store_array(p, words, count * sizeof(word_t));
+        ref = arr != 0 ? arena_alloc(p, sizeof(for_node_t)) : 0;
+        if (ref != 0)
+        {
+            for_node_t* n = at(p, ref);
+            n->kind = NODE_FOR;
+            n->var = var;
+            n->nwords = count;
+            n->words = arr;
+            n->body = body;
+        }
+    }
+    free(words);
+    return ref;
+}
+
+static sref_t parse_group(parser_t* p)
+{
+    next_token(p);
+    sref_t body = parse_list(p, RW_RBRACE);
+    if (body == 0 || !expect_reserved(p, RW_RBRACE))
+    {
+        return 0;
+    }
+    return body;
+}
+
+/* NAME ( ) { list } with NAME already consumed */
+static sref_t parse_function(parser_t* p, sref_t name)
+{
+    next_token(p);
+    if (p->tok.type != TOK_RPAREN)
+    {
+        unexpected(p);
+        return 0;
+    }
+    next_token(p);
+    skip_newlines(p);
+    if (reserved(p) != RW_LBRACE)
+    {
+        unexpected(p);
+        return 0;
+    }
+    sref_t body = parse_group(p);
+    if (body == 0)
+    {
+        return 0;
+    }
+
+    sref_t ref = arena_alloc(p, sizeof(func_node_t));
+    if (ref != 0)
+    {
+        func_node_t* n = at(p, ref);
+        n->kind = NODE_FUNC;
+        n->name = name;
+        n->body = body;
+    }
+    return ref;
+}
+
+static sref_t parse_simple(parser_t* p)
+{
+    word_t* words = NULL;
+    uint32_t nwords = 0, words_cap = 0;
+    assign_t* assigns = NULL;
+    uint32_t nassign = 0, assigns_cap = 0;
+    sredir_t* redirs = NULL;
+    uint32_t nredir = 0, redirs_cap = 0;
+    sref_t ref = 0;
+
+    while (p->status == SCRIPT_OK && (p->tok.type == TOK_WORD || p->tok.type == TOK_REDIR))
+    {
+        if (p->tok.type == TOK_REDIR)
+        {
+            sredir_t r = {p->tok.redir, p->tok.fd, {0, 0, 0}};
+            next_token(p);
+            if (p->tok.type != TOK_WORD)
+            {
+                syntax_error(p, "missing target for redirection");
+                break;
+            }
+            r.target = p->tok.word;
+            if (nredir == redirs_cap)
+            {
+                redirs_cap = redirs_cap ? redirs_cap * 2 : 4;
+                sredir_t* tmp = realloc(redirs, redirs_cap * sizeof(*tmp));
+                if (tmp == NULL)
+                {
+                    p->status = SCRIPT_NOMEM;
+                    break;
+                }
+                redirs = tmp;
+            }
+            redirs[nredir++] = r;
+        }
+        else if (nwords == 0 && p->tok.assign_eq >= 0)
+        {
+            /* NAME=VALUE: the value is the word minus its "NAME=" prefix */
+            word_t w = p->tok.word;
+            part_t* parts = at(p, w.parts);
+            const char* text = at(p, parts[0].data);
+            assign_t a = {name_index(p, text, (size_t)p->tok.assign_eq), w};
+            parts = at(p, w.parts);
+            parts[0].data += (uint32_t)p->tok.assign_eq + 1;
+            parts[0].val -= (uint32_t)p->tok.assign_eq + 1;
+            a.value.flags |= WORD_QUOTED;
+            a.value.flags &= ~(uint32_t)(WORD_GLOB | WORD_ALL_ARGS);
+            if (nassign == assigns_cap)
+            {
+                assigns_cap = assigns_cap ? assigns_cap * 2 : 4;
+                assign_t* tmp = realloc(assigns, assigns_cap * sizeof(*tmp));
+                if (tmp == NULL)
+                {
+                    p->status = SCRIPT_NOMEM;
+                    break;
+                }
+                assigns = tmp;
+            }
+            assigns[nassign++] = a;
+        }
+        else
+        {
+            if (nwords == 0 && nassign == 0 && nredir == 0 && p->tok.plain != 0)
+            {
+                /* NAME() starts a function definition */
+                sref_t name = p->tok.plain;
+                word_t first = p->tok.word;
+                next_token(p);
+                if (p->tok.type == TOK_LPAREN)
+                {
+                    if (!vars_valid_name(at(p, name), strlen(at(p, name))))
+                    {
+                        syntax_error(p, "bad function name '%s'", (const char*)at(p, name));
+                        break;
+                    }
+                    ref = parse_function(p, name);
+                    goto out;
+                }
+                /* the lookahead already moved on: keep the word it looked at */
+                push_word(p, &words, &nwords, &words_cap, first);
+                continue;
+            }
+            push_word(p, &words, &nwords, &words_cap, p->tok.word);
+        }
+        next_token(p);
+    }
+
+    if (p->status == SCRIPT_OK && nwords + nassign + nredir == 0)
+    {
+        unexpected(p);
+    }
+    if (p->status == SCRIPT_OK)
+    {
+        sref_t w = store_array(p, words, nwords * sizeof(word_t));
+        sref_t a = store_array(p, assigns, nassign * sizeof(assign_t));
+        sref_t r = store_array(p, redirs, nredir * sizeof(sredir_t));
+        ref = (w != 0 && a != 0 && r != 0) ? arena_alloc(p, sizeof(cmd_node_t)) : 0;
+        if (ref != 0)
+        {
+            cmd_node_t* n = at(p, ref);
+            n->kind = NODE_CMD;
+            n->nwords = nwords;
+            n->nassign = nassign;
+            n->nredir = nredir;
+            n->words = w;
+            n->assigns = a;
+            n->redirs = r;
+        }
+    }
+
+out:
+    free(words);
+    free(assigns);
+    free(redirs);
+    return p->status == SCRIPT_OK ? ref : 0;
+}
+
+static sref_t parse_command(parser_t* p)
+{
+    switch (reserved(p))
+    {
+    case RW_IF:
+        next_token(p);
+        return parse_if_tail(p);
+    case RW_WHILE:
+        next_token(p);
+        return parse_loop(p, NODE_WHILE);
+    case RW_UNTIL:
+        next_token(p);
+        return parse_loop(p, NODE_UNTIL);
+    case RW_FOR:
+        next_token(p);
+        return parse_for(p);
+    case RW_LBRACE:
+        return parse_group(p);
+    case RW_NONE:
+        break;
+    default:
+        unexpected(p);
+        return 0;
+    }
+    if (p->tok.type == TOK_LPAREN)
+    {
+        syntax_error(p, "subshells are not supported");
+        return 0;
+    }
+    return parse_simple(p);
+}
+
+script_status_t script_compile(const char* src, size_t len, script_t** out)
+{
+    *out = NULL;
+    script_t* s = calloc(1, sizeof(*s));
+    if (s == NULL)
+    {
+        return SCRIPT_NOMEM;
+    }
+    s->cap = 4096;
+    s->arena = malloc(s->cap);
+    s->refs = 1;
+    if (s->arena == NULL)
+    {
+        free(s);
+        return SCRIPT_NOMEM;
+    }
+
+    parser_t p;
+    memset(&p, 0, sizeof(p));
+    p.src = src;
+    p.len = len;
+    p.line = 1;
+    p.s = s;
+    p.status = SCRIPT_OK;
+
+    arena_alloc(&p, sizeof(script_header_t));
+    next_token(&p);
+    sref_t root = parse_list(&p, RW_NONE);
+    if (p.status == SCRIPT_OK && p.tok.type != TOK_EOF)
+    {
+        unexpected(&p);
+    }
+
+    sref_t names = p.status == SCRIPT_OK ? store_array(&p, p.names, p.nnames * sizeof(sref_t)) : 0;
+    if (p.status == SCRIPT_OK)
+    {
+        script_header_t* h = at(&p, 0);
+        h->magic = SCRIPT_MAGIC;
+        h->nnames = p.nnames;
+        h->names = names;
+        h->root = root;
+    }
+
+    free(p.names);
+    free(p.parts);
+    free(p.lit);
+    if (p.status != SCRIPT_OK)
+    {
+        script_release(s);
+        return p.status;
+    }
+    *out = s;
+    return SCRIPT_OK;
+}
+
+int script_link(script_t* script, vars_t* vars)
+{
+    const script_header_t* h = script_header(script);
+    const sref_t* names = script_at(script, h->names);
+    int* slots = malloc((h->nnames + 1) * sizeof(*slots));
+    if (slots == NULL)
+    {
+        return -1;
+    }
+    for (uint32_t i = 0; i < h->nnames; ++i)
+    {
+        const char* name = script_at(script, names[i]);
+        slots[i] = vars_slot(vars, name, strlen(name));
+        if (slots[i] < 0)
+        {
+            free(slots);
+            return -1;
+        }
+    }
+    free(script->slots);
+    script->slots = slots;
+    return 0;
+}
+
+void script_retain(script_t* script)
+{
+    script->refs++;
+}
+
+void script_release(script_t* script)
+{
+    if (script != NULL && --script->refs == 0)
+    {
+        free(script->arena);
+        free(script->slots);
+        free(script);
+    }
+}
+
+/* ---- on-disk cache ---- */
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t mtime_ns;
+    uint64_t size;
+    uint64_t path_len;
+    uint64_t arena_len;
+} cache_header_t;
+
+/*
+ * A cached arena comes from a file anyone with access to the cache
+ * directory may have damaged, so before it is used every reference is
+ * checked to stay inside it, every string to end inside it and every name
+ * index to be in the table. Node and arithmetic trees are walked once with
+ * a mark per 8-byte slot, which also rejects cycles that would make the
+ * shell recurse forever and a slot used both as a node and as arithmetic.
+ */
+#define MARK_NODE 1  /* node being checked; + 1 once checked */
+#define MARK_ARITH 3 /* arithmetic being checked; + 1 once checked */
+
+typedef struct
+{
+    const script_t* s;
+    uint32_t nnames;
+    unsigned char* mark; /* per 8-byte slot: 0 unseen, or MARK_* */
+} verify_t;
+
+/* count items of size bytes at ref, aligned and inside the arena */
+static bool verify_span(const verify_t* v, sref_t ref, size_t count, size_t size)
+{
+    if (count == 0)
+    {
+        return true;
+    }
+    return ref >= sizeof(script_header_t) && ref % 4 == 0 && ref < v->s->len
+           && count <= (v->s->len - ref) / size;
+}
+
+/* NUL-terminated text of len bytes at ref, or of any length when len is SIZE_MAX */
+static bool verify_str(const verify_t* v, sref_t ref, size_t len)
+{
+    if (ref < sizeof(script_header_t) || ref >= v->s->len)
+    {
+        return false;
+    }
+    if (len == SIZE_MAX)
+    {
+        return memchr(v->s->arena + ref, '\0', v->s->len - ref) != NULL;
+    }
+    return len < v->s->len - ref && v->s->arena[ref + len] == '\0';
+}
+
+/*
+ * 1 to check the item at ref now, 0 when it was checked as the same type
+ * before, -1 for a bad reference, a cycle or a type mismatch
+ */
+static int verify_enter(verify_t* v, sref_t ref, size_t size, unsigned char busy)
+{
+    if (ref < sizeof(script_header_t) || ref % 8 != 0 || ref >= v->s->len || size > v->s->len - ref)
+    {
+        return -1;
+    }
+    unsigned char m = v->mark[ref / 8];
+    if (m != 0)
+    {
+        return m == busy + 1 ? 0 : -1;
+    }
+    v->mark[ref / 8] = busy;
+    return 1;
+}
+
+static bool verify_arith(verify_t* v, sref_t ref)
+{
+    int rc = verify_enter(v, ref, sizeof(arith_t), MARK_ARITH);
+    if (rc <= 0)
+    {
+        return rc == 0;
+    }
+    const arith_t* a = script_at(v->s, ref);
+    bool ok;
+    switch ((arith_op_t)a->op)
+    {
+    case ARITH_NUM:
+    case ARITH_PARAM:
+        ok = true;
+        break;
+    case ARITH_VAR:
+        ok = a->var < v->nnames;
+        break;
+    case ARITH_NEG:
+    case ARITH_NOT:
+        ok = verify_arith(v, a->left);
+        break;
+    default:
+        ok = a->op <= ARITH_OR && verify_arith(v, a->left) && verify_arith(v, a->right);
+        break;
+    }
+    v->mark[ref / 8] = MARK_ARITH + 1;
+    return ok;
+}
+
+static bool verify_word(verify_t* v, const word_t* w)
+{
+    if (!verify_span(v, w->parts, w->nparts, sizeof(part_t)))
+    {
+        return false;
+    }
+    const part_t* parts = script_at(v->s, w->parts);
+    for (uint32_t i = 0; i < w->nparts; ++i)
+    {
+        const part_t* p = &parts[i];
+        bool ok = ((p->kind == PART_LIT || p->kind == PART_QUOTED) && verify_str(v, p->data, p->val))
+                  || (p->kind == PART_VAR && p->val < v->nnames) || p->kind == PART_SPECIAL
+                  || (p->kind == PART_ARITH && verify_arith(v, p->data));
+        if (!ok)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool verify_words(verify_t* v, sref_t ref, uint32_t count)
+{
+    if (!verify_span(v, ref, count, sizeof(word_t)))
+    {
+        return false;
+    }
+    const word_t* words = script_at(v->s, ref);
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        if (!verify_word(v, &words[i]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool verify_cmd(verify_t* v, const cmd_node_t* n)
+{
+    if (!verify_words(v, n->words, n->nwords) || !verify_span(v, n->assigns, n->nassign, sizeof(assign_t))
+        || !verify_span(v, n->redirs, n->nredir, sizeof(sredir_t)))
+    {
+        return false;
+    }
+    const assign_t* assigns = script_at(v->s, n->assigns);
+    for (uint32_t i = 0; i < n->nassign; ++i)
+    {
+        if (assigns[i].name >= v->nnames || !verify_word(v, &assigns[i].value))
+        {
+            return false;
+        }
+    }
+    const sredir_t* redirs = script_at(v->s, n->redirs);
+    for (uint32_t i = 0; i < n->nredir; ++i)
+    {
+        if (redirs[i].kind > REDIR_DUP || redirs[i].fd < -1 || redirs[i].fd > MAX_FD
+            || !verify_word(v, &redirs[i].target))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool verify_node(verify_t* v, sref_t ref)
+{
+    if (ref == 0)
+    {
+        return true;
+    }
+    int rc = verify_enter(v, ref, sizeof(node_t), MARK_NODE);
+    if (rc <= 0)
+    {
+        return rc == 0;
+    }
+
+    const node_t* node = script_at(v->s, ref);
+    size_t room = v->s->len - ref;
+    bool ok = false;
+    switch ((node_kind_t)node->kind)
+    {
+    case NODE_CMD:
+        ok = room >= sizeof(cmd_node_t) && verify_cmd(v, (const cmd_node_t*)node);
+        break;
+    case NODE_LIST:
+    {
+        const list_node_t* n = (const list_node_t*)node;
+        ok = room >= sizeof(*n) && verify_span(v, n->items, n->count, sizeof(sref_t));
+        const sref_t* items = ok ? script_at(v->s, n->items) : NULL;
+        for (uint32_t i = 0; ok && i < n->count; ++i)
+        {
+            ok = verify_node(v, items[i]);
+        }
+        break;
+    }
+    case NODE_AND:
+    case NODE_OR:
+    case NODE_NOT:
+    {
+        const binary_node_t* n = (const binary_node_t*)node;
+        ok = room >= sizeof(*n) && verify_node(v, n->left) && verify_node(v, n->right);
+        break;
+    }
+    case NODE_IF:
+    {
+        const if_node_t* n = (const if_node_t*)node;
+        ok = room >= sizeof(*n) && verify_node(v, n->cond) && verify_node(v, n->then_part)
+             && verify_node(v, n->else_part);
+        break;
+    }
+    case NODE_WHILE:
+    case NODE_UNTIL:
+    {
+        const loop_node_t* n = (const loop_node_t*)node;
+        ok = room >= sizeof(*n) && verify_node(v, n->cond) && verify_node(v, n->body);
+        break;
+    }
+    case NODE_FOR:
+    {
+        const for_node_t* n = (const for_node_t*)node;
+        ok = room >= sizeof(*n) && n->var < v->nnames && verify_words(v, n->words, n->nwords)
+             && verify_node(v, n->body);
+        break;
+    }
+    case NODE_FUNC:
+    {
+        const func_node_t* n = (const func_node_t*)node;
+        ok = room >= sizeof(*n) && verify_str(v, n->name, SIZE_MAX) && verify_node(v, n->body);
+        break;
+    }
+    }
+    v->mark[ref / 8] = MARK_NODE + 1;
+    return ok;
+}
+
+static bool script_verify(const script_t* s)
+{
+    const script_header_t* h = script_header(s);
+    verify_t v = {s, h->nnames, calloc(s->len / 8 + 1, 1)};
+    bool ok = v.mark != NULL && h->magic == SCRIPT_MAGIC && verify_span(&v, h->names, h->nnames, sizeof(sref_t));
+    const sref_t* names = ok ? script_at(s, h->names) : NULL;
+    for (uint32_t i = 0; ok && i < h->nnames; ++i)
+    {
+        ok = verify_str(&v, names[i], SIZE_MAX);
+    }
+    ok = ok && verify_node(&v, h->root);
+    free(v.mark);
+    return ok;
+}
+
+static int cache_path(char* out, size_t size, const char* dir, const char* path)
+{
+    /* FNV-1a of the script path names the cache file; the path itself is stored to catch collisions */
+    uint64_t h = 14695981039346656037u;
+    for (const char* c = path; *c != '\0'; ++c)
+    {
+        h ^= (unsigned char)*c;
+        h *= 1099511628211u;
+    }
+    int n = snprintf(out, size, "%s/%016llx", dir, (unsigned long long)h);
+    return (n < 0 || (size_t)n >= size) ? -1 : 0;
+}
+
+static uint64_t mtime_ns(const struct stat* st)
+{
+    return (uint64_t)st->st_mtim.tv_sec * 1000000000u + (uint64_t)st->st_mtim.tv_nsec;
+}
+
+script_t* script_cache_load(const char* dir, const char* path, const struct stat* st)
+{
+    char file[PATH_MAX];
+    if (cache_path(file, sizeof(file), dir, path) != 0)
+    {
+        return NULL;
+    }
+    int fd = open(file, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return NULL;
+    }
+
+    /* any mismatch is a miss: the caller compiles the source and stores a fresh entry */
+    cache_header_t hdr;
+    struct stat cst;
+    size_t path_len = strlen(path);
+    char* stored = malloc(path_len + 1);
+    script_t* s = calloc(1, sizeof(*s));
+    bool ok = stored != NULL && s != NULL
+              && rio_read_full(fd, &hdr, sizeof(hdr)) == (ssize_t)sizeof(hdr)
+              && memcmp(hdr.magic, CACHE_MAGIC, sizeof(hdr.magic)) == 0
+              && hdr.version == CACHE_VERSION
+              && hdr.mtime_ns == mtime_ns(st)
+              && hdr.size == (uint64_t)st->st_size
+              && hdr.path_len == path_len
+              && hdr.arena_len >= sizeof(script_header_t) && hdr.arena_len <= UINT32_MAX
+              && fstat(fd, &cst) == 0
+              && (uint64_t)cst.st_size == sizeof(hdr) + hdr.path_len + hdr.arena_len
+              && rio_read_full(fd, stored, path_len) == (ssize_t)path_len
+              && memcmp(stored, path, path_len) == 0;
+    if (ok)
+    {
+        s->arena = malloc(hdr.arena_len);
+        s->len = s->cap = hdr.arena_len;
+        ok = s->arena != NULL
+             && rio_read_full(fd, s->arena, hdr.arena_len) == (ssize_t)hdr.arena_len
+             && script_verify(s);
+    }
+    free(stored);
+    close(fd);
+
+    if (!ok)
+    {
+        if (s != NULL)
+        {
+            free(s->arena);
+            free(s);
+        }
+        return NULL;
+    }
+    s->refs = 1;
+    return s;
+}
+
+void script_cache_store(const char* dir, const char* path, const struct stat* st, const script_t* script)
+{
+    char file[PATH_MAX];
+    char tmp[PATH_MAX];
+    int n = snprintf(tmp, sizeof(tmp), "%s/.tmp.XXXXXX", dir);
+    if (cache_path(file, sizeof(file), dir, path) != 0 || n < 0 || (size_t)n >= sizeof(tmp))
+    {
+        return;
+    }
+    int fd = mkstemp(tmp);
+    if (fd == -1)
+    {
+        return;
+    }
+
+    cache_header_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, CACHE_MAGIC, sizeof(hdr.magic));
+    hdr.version = CACHE_VERSION;
+    hdr.mtime_ns = mtime_ns(st);
+    hdr.size = (uint64_t)st->st_size;
+    hdr.path_len = strlen(path);
+    hdr.arena_len = script->len;
+
+    bool ok = rio_write_full(fd, &hdr, sizeof(hdr)) == 0 && rio_write_full(fd, path, hdr.path_len) == 0
+              && rio_write_full(fd, script->arena, script->len) == 0;
+    close(fd);
+    /* whole entries only: a concurrent reader sees the old file or the new one */
+    if (!ok || rename(tmp, file) != 0)
+    {
+        unlink(tmp);
+    }
+}
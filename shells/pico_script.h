@@ -0,0 +1,236 @@
+#ifndef PICO_SCRIPT_H
+#define PICO_SCRIPT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "pico_vars.h"
+
+/*
+ * Compiled form of pico_shell input. A script is parsed once into a flat
+ * arena of nodes that refer to each other by byte offset (sref_t), so the
+ * arena can be written to disk and loaded back as is. Words are split into
+ * literal, variable and arithmetic parts at parse time, so loop bodies run
+ * without lexing again, and every variable name is numbered in a per-script
+ * name table that script_link() maps onto vars_t slots once.
+ *
+ * Supported syntax: simple commands with redirections and NAME=VALUE
+ * prefixes, ';' and newlines, && and ||, '!', { list; },
+ * if/elif/else/fi, while/until ... do ... done, for NAME in words; do ...
+ * done, NAME() { list; }, '...' and "..." quoting, backslash escapes,
+ * $NAME ${NAME} $? $$ $# $@ $* $0-$9 and $((arithmetic)).
+ */
+
+typedef uint32_t sref_t; /* byte offset into the arena, 0 for "none" */
+
+typedef enum
+{
+    NODE_CMD,
+    NODE_LIST,
+    NODE_AND,
+    NODE_OR,
+    NODE_NOT,
+    NODE_IF,
+    NODE_WHILE,
+    NODE_UNTIL,
+    NODE_FOR,
+    NODE_FUNC
+} node_kind_t;
+
+typedef enum
+{
+    REDIR_IN,     /* [n]<file   */
+    REDIR_OUT,    /* [n]>file   */
+    REDIR_APPEND, /* [n]>>file  */
+    REDIR_DUP     /* [n]>&m, [n]<&m */
+} redir_kind_t;
+
+typedef enum
+{
+    PART_LIT,     /* data: NUL-terminated text, val: its length */
+    PART_VAR,     /* val: name index */
+    PART_SPECIAL, /* val: one of ?$#@*0123456789 */
+    PART_ARITH,   /* data: arith_t tree */
+    PART_QUOTED   /* like PART_LIT, for text from quotes or a backslash: never a pattern */
+} part_kind_t;
+
+#define WORD_QUOTED 0x1 /* some part was quoted: never dropped when empty */
+#define WORD_GLOB 0x2   /* unquoted * ? [ or { : goes through pathname expansion */
+#define WORD_ALL_ARGS 0x4 /* the word is exactly $@: one word per parameter */
+
+typedef struct
+{
+    uint32_t kind;
+    uint32_t val;
+    sref_t data;
+} part_t;
+
+typedef struct
+{
+    uint32_t nparts;
+    uint32_t flags;
+    sref_t parts; /* part_t[nparts] */
+} word_t;
+
+typedef struct
+{
+    uint32_t name; /* name index */
+    word_t value;
+} assign_t;
+
+typedef struct
+{
+    uint32_t kind; /* redir_kind_t */
+    int32_t fd;
+    word_t target; /* file name, or descriptor number for REDIR_DUP */
+} sredir_t;
+
+typedef enum
+{
+    ARITH_NUM,
+    ARITH_VAR,
+    ARITH_PARAM,
+    ARITH_NEG,
+    ARITH_NOT,
+    ARITH_MUL,
+    ARITH_DIV,
+    ARITH_MOD,
+    ARITH_ADD,
+    ARITH_SUB,
+    ARITH_LT,
+    ARITH_LE,
+    ARITH_GT,
+    ARITH_GE,
+    ARITH_EQ,
+    ARITH_NE,
+    ARITH_AND,
+    ARITH_OR
+} arith_op_t;
+
+typedef struct
+{
+    uint32_t op;
+    uint32_t var; /* name index for ARITH_VAR, the character of $N / $# for ARITH_PARAM */
+    int64_t num;
+    sref_t left;
+    sref_t right;
+} arith_t;
+
+typedef struct
+{
+    uint32_t kind;
+} node_t;
+
+typedef struct
+{
+    uint32_t kind;
+    uint32_t nwords;
+    uint32_t nassign;
+    uint32_t nredir;
+    sref_t words;   /* word_t[nwords] */
+    sref_t assigns; /* assign_t[nassign] */
+    sref_t redirs;  /* sredir_t[nredir] */
+} cmd_node_t;
+
+typedef struct
+{
+    uint32_t kind;
+    uint32_t count;
+    sref_t items; /* sref_t[count] */
+} list_node_t;
+
+/* NODE_AND, NODE_OR, and NODE_NOT (left only) */
+typedef struct
+{
+    uint32_t kind;
+    sref_t left;
+    sref_t right;
+} binary_node_t;
+
+typedef struct
+{
+    uint32_t kind;
+    sref_t cond;
+    sref_t then_part;
+    sref_t else_part; /* 0, another NODE_IF for elif, or a list */
+} if_node_t;
+
+/* NODE_WHILE and NODE_UNTIL */
+typedef struct
+{
+    uint32_t kind;
+    sref_t cond;
+    sref_t body;
+} loop_node_t;
+
+typedef struct
+{
+    uint32_t kind;
+    uint32_t var; /* name index */
+    uint32_t nwords;
+    sref_t words; /* word_t[nwords] */
+    sref_t body;
+} for_node_t;
+
+typedef struct
+{
+    uint32_t kind;
+    sref_t name; /* NUL-terminated */
+    sref_t body;
+} func_node_t;
+
+/* always at offset 0 of the arena */
+typedef struct
+{
+    uint32_t magic;
+    uint32_t nnames;
+    sref_t names; /* sref_t[nnames], each a NUL-terminated name */
+    sref_t root;  /* 0 for an empty script */
+} script_header_t;
+
+typedef struct
+{
+    char* arena;
+    size_t len;
+    size_t cap;
+    int* slots;   /* name index -> vars slot, filled by script_link() */
+    int refs;
+} script_t;
+
+typedef enum
+{
+    SCRIPT_OK,
+    SCRIPT_INCOMPLETE, /* input ended inside a quote or an open construct */
+    SCRIPT_SYNTAX,     /* error already reported on stderr */
+    SCRIPT_NOMEM
+} script_status_t;
+
+/* compile src[0..len) into *out (refs = 1) */
+script_status_t script_compile(const char* src, size_t len, script_t** out);
+
+/* resolve the name table against vars; -1 when out of memory */
+int script_link(script_t* script, vars_t* vars);
+
+void script_retain(script_t* script);
+void script_release(script_t* script);
+
+/*
+ * On-disk cache of compiled script files in dir, keyed by the script's
+ * path and validated against its mtime and size. Loading returns NULL on
+ * a miss; storing is best effort.
+ */
+script_t* script_cache_load(const char* dir, const char* path, const struct stat* st);
+void script_cache_store(const char* dir, const char* path, const struct stat* st, const script_t* script);
+
+static inline const void* script_at(const script_t* script, sref_t ref)
+{
+    return script->arena + ref;
+}
+
+static inline const script_header_t* script_header(const script_t* script)
+{
+    return (const script_header_t*)script->arena;
+}
+
+#endif /* PICO_SCRIPT_H */
@@ -0,0 +1,681 @@
+#define _GNU_SOURCE
+
+#include "pico_serve.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "robust_io.h"
+
+#define SERVE_BACKLOG 128
+#define SERVE_EVENTS 64 /* epoll events taken per wakeup */
+
+typedef enum
+{
+    CONN_HEADER,  /* reading a request header and the descriptors sent with it */
+    CONN_BODY,    /* reading the command text */
+    CONN_QUEUED,  /* complete, waiting for a free worker */
+    CONN_RUNNING  /* a worker is running it */
+} conn_state_t;
+
+typedef struct conn
+{
+    int sock;
+    conn_state_t state;
+    serve_request_t req;
+    size_t got;              /* bytes of the header, then of the body, read so far */
+    int fds[3];              /* the client's stdin, stdout and stderr, -1 until received */
+    char* body;
+    struct conn* prev;       /* every open connection, so workers can close them */
+    struct conn* next;
+    struct conn* queue_next; /* FIFO of CONN_QUEUED requests */
+} conn_t;
+
+typedef struct
+{
+    int listen_fd;
+    int epoll_fd;
+    int signal_fd;
+    bool listening;       /* listen_fd is in the epoll set; off while out of descriptors */
+    size_t max_workers;
+    size_t running;
+    conn_t** workers;     /* [max_workers], the connection each running worker serves */
+    pid_t* pids;          /* [max_workers] */
+    conn_t* conns;
+    conn_t* queue_head;
+    conn_t* queue_tail;
+    serve_run_fn run;
+    void* ctx;
+    sigset_t old_mask;    /* restored in workers, along with the actions below */
+    struct sigaction old_int;
+    struct sigaction old_term;
+} server_t;
+
+/* a socket file left behind by a server that is gone refuses connections */
+static bool stale_socket(const char* path, const struct sockaddr_un* addr)
+{
+    struct stat st;
+    if (lstat(path, &st) == -1 || !S_ISSOCK(st.st_mode))
+    {
+        return false;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+    {
+        return false;
+    }
+    bool stale = connect(fd, (const struct sockaddr*)addr, sizeof(*addr)) == -1 && errno == ECONNREFUSED;
+    close(fd);
+    return stale;
+}
+
+static int open_listener(const char* path)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    size_t len = strlen(path);
+    if (len >= sizeof(addr.sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memcpy(addr.sun_path, path, len + 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+    {
+        return -1;
+    }
+
+    /* owner only: whoever can connect can run commands as this user */
+    mode_t mask = umask(077);
+    int rc = bind(fd, (const struct sockaddr*)&addr, sizeof(addr));
+    if (rc == -1 && errno == EADDRINUSE && stale_socket(path, &addr))
+    {
+        unlink(path);
+        rc = bind(fd, (const struct sockaddr*)&addr, sizeof(addr));
+    }
+    umask(mask);
+
+    if (rc == -1 || listen(fd, SERVE_BACKLOG) == -1)
+    {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+
+static void close_fds(conn_t* c)
+{
+    for (int i = 0; i < 3; ++i)
+    {
+        if (c->fds[i] != -1)
+        {
+            close(c->fds[i]);
+            c->fds[i] = -1;
+        }
+    }
+}
+
+static void set_listening(server_t* srv, bool on)
+{
+    if (srv->listening == on || srv->listen_fd == -1)
+    {
+        return;
+    }
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = &srv->listen_fd};
+    if (epoll_ctl(srv->epoll_fd, on ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, srv->listen_fd, &ev) == 0)
+    {
+        srv->listening = on;
+    }
+}
+
+static void close_conn(server_t* srv, conn_t* c)
+{
+    /* workers may still hold a copy of the socket, so remove it from the set explicitly */
+    epoll_ctl(srv->epoll_fd, EPOLL_CTL_DEL, c->sock, NULL);
+    close(c->sock);
+    close_fds(c);
+    free(c->body);
+
+    if (c->prev != NULL)
+    {
+        c->prev->next = c->next;
+    }
+    else
+    {
+        srv->conns = c->next;
+    }
+    if (c->next != NULL)
+    {
+        c->next->prev = c->prev;
+    }
+    free(c);
+
+    /* a descriptor is free again */
+    set_listening(srv, true);
+}
+
+static void accept_connections(server_t* srv)
+{
+    for (;;)
+    {
+        int sock = accept4(srv->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (sock == -1)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                /* e.g. EMFILE: stop polling the listener until a connection closes */
+                rio_error("serve: accept", NULL);
+                set_listening(srv, false);
+            }
+            return;
+        }
+
+        struct ucred cred;
+        socklen_t cred_len = sizeof(cred);
+        if (getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) == -1 || cred.uid != geteuid())
+        {
+            close(sock);
+            continue;
+        }
+
+        conn_t* c = calloc(1, sizeof(*c));
+        struct epoll_event ev = {.events = EPOLLIN, .data.ptr = c};
+        if (c == NULL || epoll_ctl(srv->epoll_fd, EPOLL_CTL_ADD, sock, &ev) == -1)
+        {
+            rio_error("serve: connection", NULL);
+            free(c);
+            close(sock);
+            continue;
+        }
+        c->sock = sock;
+        c->state = CONN_HEADER;
+        c->fds[0] = c->fds[1] = c->fds[2] = -1;
+        c->next = srv->conns;
+        if (srv->conns != NULL)
+        {
+            srv->conns->prev = c;
+        }
+        srv->conns = c;
+    }
+}
+
+/* take the descriptors of an SCM_RIGHTS message; exactly one set of three per request */
+static int take_fds(conn_t* c, struct msghdr* msg)
+{
+    int rc = (msg->msg_flags & MSG_CTRUNC) ? -1 : 0;
+    for (struct cmsghdr* cm = CMSG_FIRSTHDR(msg); cm != NULL; cm = CMSG_NXTHDR(msg, cm))
+    {
+        if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS)
+        {
+            continue;
+        }
+        size_t n = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        if (n == 3 && c->fds[0] == -1)
+        {
+            memcpy(c->fds, CMSG_DATA(cm), sizeof(c->fds));
+            continue;
+        }
+        for (size_t i = 0; i < n; ++i)
+        {
+            int fd;
+            memcpy(&fd, CMSG_DATA(cm) + i * sizeof(int), sizeof(fd));
+            close(fd);
+        }
+        rc = -1;
+    }
+    return rc;
+}
+
+/* 1 when a whole request is in, 0 when more is needed, -1 to drop the connection */
+static int read_request(conn_t* c)
+{
+    if (c->state == CONN_HEADER)
+    {
+        union
+        {
+            char buf[CMSG_SPACE(3 * sizeof(int))];
+            struct cmsghdr align;
+        } ctrl;
+        struct iovec iov = {(char*)&c->req + c->got, sizeof(c->req) - c->got};
+        struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = ctrl.buf,
+                             .msg_controllen = sizeof(ctrl.buf)};
+
+        ssize_t n = recvmsg(c->sock, &msg, MSG_CMSG_CLOEXEC);
+        if (n == -1)
+        {
+            return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+        }
+        if (take_fds(c, &msg) != 0 || n == 0)
+        {
+            return -1;
+        }
+        c->got += (size_t)n;
+        if (c->got < sizeof(c->req))
+        {
+            return 0;
+        }
+
+        if (c->req.magic != SERVE_MAGIC || c->req.len > SERVE_MAX_COMMAND || c->fds[0] == -1)
+        {
+            return -1;
+        }
+        c->body = malloc((size_t)c->req.len + 1);
+        if (c->body == NULL)
+        {
+            return -1;
+        }
+        c->got = 0;
+        c->state = CONN_BODY;
+    }
+
+    while (c->got < c->req.len)
+    {
+        ssize_t n = read(c->sock, c->body + c->got, c->req.len - c->got);
+        if (n == -1)
+        {
+            return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+        }
+        if (n == 0)
+        {
+            return -1;
+        }
+        c->got += (size_t)n;
+    }
+    c->body[c->req.len] = '\0';
+    return 1;
+}
+
+/* back to reading the next request once the status went out */
+static void finish_request(server_t* srv, conn_t* c, int status)
+{
+    serve_reply_t reply = {status};
+    close_fds(c);
+    free(c->body);
+    c->body = NULL;
+    c->got = 0;
+    c->state = CONN_HEADER;
+
+    /* the client sends nothing until it has the reply, so the socket buffer has room */
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = c};
+    if (send(c->sock, &reply, sizeof(reply), MSG_NOSIGNAL | MSG_DONTWAIT) != (ssize_t)sizeof(reply)
+        || epoll_ctl(srv->epoll_fd, EPOLL_CTL_ADD, c->sock, &ev) == -1)
+    {
+        close_conn(srv, c);
+    }
+}
+
+/* in the forked worker: become the client's shell for one request, never returns */
+static void run_worker(server_t* srv, conn_t* c, size_t slot)
+{
+    sigaction(SIGINT, &srv->old_int, NULL);
+    sigaction(SIGTERM, &srv->old_term, NULL);
+    sigprocmask(SIG_SETMASK, &srv->old_mask, NULL);
+
+    /* move the client's descriptors above 0-2 first so the dup2s cannot clobber each other */
+    int fds[3];
+    for (int i = 0; i < 3; ++i)
+    {
+        fds[i] = fcntl(c->fds[i], F_DUPFD_CLOEXEC, 3);
+        if (fds[i] == -1)
+        {
+            _exit(126);
+        }
+    }
+    for (int i = 0; i < 3; ++i)
+    {
+        if (dup2(fds[i], i) == -1)
+        {
+            _exit(126);
+        }
+        close(fds[i]);
+    }
+
+    /* a command that outlives its connection must not keep other clients' sockets open */
+    close(srv->listen_fd);
+    close(srv->epoll_fd);
+    close(srv->signal_fd);
+    for (conn_t* other = srv->conns; other != NULL; other = other->next)
+    {
+        close(other->sock);
+        close_fds(other);
+    }
+
+    exit(srv->run(srv->ctx, slot, c->body, c->req.len));
+}
+
+/* start queued requests while workers are free */
+static void dispatch(server_t* srv)
+{
+    while (srv->running < srv->max_workers && srv->queue_head != NULL)
+    {
+        conn_t* c = srv->queue_head;
+        srv->queue_head = c->queue_next;
+        if (srv->queue_head == NULL)
+        {
+            srv->queue_tail = NULL;
+        }
+
+        size_t slot = 0;
+        while (srv->workers[slot] != NULL)
+        {
+            ++slot;
+        }
+
+        fflush(NULL);
+        pid_t pid = fork();
+        if (pid == -1)
+        {
+            rio_error("serve: fork", NULL);
+            finish_request(srv, c, errno);
+            continue;
+        }
+        if (pid == 0)
+        {
+            run_worker(srv, c, slot);
+        }
+
+        /* the worker has its own copies; the client must see EOF on them once it is done */
+        close_fds(c);
+        c->state = CONN_RUNNING;
+        srv->workers[slot] = c;
+        srv->pids[slot] = pid;
+        srv->running++;
+    }
+}
+
+static void conn_event(server_t* srv, conn_t* c)
+{
+    int rc = read_request(c);
+    if (rc < 0)
+    {
+        close_conn(srv, c);
+        return;
+    }
+    if (rc == 0)
+    {
+        return;
+    }
+
+    /* nothing more is read from this client until it has its reply */
+    epoll_ctl(srv->epoll_fd, EPOLL_CTL_DEL, c->sock, NULL);
+    c->state = CONN_QUEUED;
+    c->queue_next = NULL;
+    if (srv->queue_tail != NULL)
+    {
+        srv->queue_tail->queue_next = c;
+    }
+    else
+    {
+        srv->queue_head = c;
+    }
+    srv->queue_tail = c;
+    dispatch(srv);
+}
+
+/* true when asked to shut down */
+static bool signal_event(server_t* srv)
+{
+    bool stop = false;
+    struct signalfd_siginfo si;
+    while (read(srv->signal_fd, &si, sizeof(si)) == (ssize_t)sizeof(si))
+    {
+        stop = stop || si.ssi_signo != SIGCHLD;
+    }
+
+    /* several exits may have been merged into one SIGCHLD */
+    int status = 0;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+    {
+        for (size_t slot = 0; slot < srv->max_workers; ++slot)
+        {
+            if (srv->workers[slot] != NULL && srv->pids[slot] == pid)
+            {
+                conn_t* c = srv->workers[slot];
+                srv->workers[slot] = NULL;
+                srv->running--;
+                finish_request(srv, c, WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status));
+                break;
+            }
+        }
+    }
+    dispatch(srv);
+    return stop;
+}
+
+static int setup(server_t* srv, const char* path)
+{
+    srv->workers = calloc(srv->max_workers, sizeof(*srv->workers));
+    srv->pids = calloc(srv->max_workers, sizeof(*srv->pids));
+    if (srv->workers == NULL || srv->pids == NULL)
+    {
+        rio_error("serve", NULL);
+        return -1;
+    }
+
+    /* SIGINT is ignored by the shell, which would also keep it from the signalfd */
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = SIG_DFL;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, &srv->old_int);
+    sigaction(SIGTERM, &sa, &srv->old_term);
+
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigprocmask(SIG_BLOCK, &mask, &srv->old_mask);
+
+    srv->signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (srv->signal_fd == -1)
+    {
+        rio_error("serve: signalfd", NULL);
+        return -1;
+    }
+    srv->listen_fd = open_listener(path);
+    if (srv->listen_fd == -1)
+    {
+        rio_error("serve: cannot listen on", path);
+        return -1;
+    }
+    srv->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = &srv->signal_fd};
+    if (srv->epoll_fd == -1 || epoll_ctl(srv->epoll_fd, EPOLL_CTL_ADD, srv->signal_fd, &ev) == -1)
+    {
+        rio_error("serve: epoll", NULL);
+        return -1;
+    }
+    set_listening(srv, true);
+    if (!srv->listening)
+    {
+        rio_error("serve: epoll", NULL);
+        return -1;
+    }
+    return 0;
+}
+
+static void teardown(server_t* srv, const char* path)
+{
+    if (srv->listen_fd != -1)
+    {
+        set_listening(srv, false);
+        close(srv->listen_fd);
+        srv->listen_fd = -1;
+        unlink(path);
+    }
+    /* running workers finish on their own; their clients then see the connection close */
+    while (srv->conns != NULL)
+    {
+        close_conn(srv, srv->conns);
+    }
+    if (srv->epoll_fd != -1)
+    {
+        close(srv->epoll_fd);
+    }
+    if (srv->signal_fd != -1)
+    {
+        close(srv->signal_fd);
+    }
+    free(srv->workers);
+    free(srv->pids);
+
+    sigprocmask(SIG_SETMASK, &srv->old_mask, NULL);
+    sigaction(SIGINT, &srv->old_int, NULL);
+    sigaction(SIGTERM, &srv->old_term, NULL);
+}
+
+int serve_loop(const char* path, size_t max_workers, serve_run_fn run, void* ctx)
+{
+    server_t srv = {.listen_fd = -1, .epoll_fd = -1, .signal_fd = -1, .max_workers = max_workers > 0 ? max_workers : 1,
+                    .run = run, .ctx = ctx};
+    sigprocmask(SIG_SETMASK, NULL, &srv.old_mask);
+    sigaction(SIGINT, NULL, &srv.old_int);
+    sigaction(SIGTERM, NULL, &srv.old_term);
+
+    if (setup(&srv, path) != 0)
+    {
+        teardown(&srv, path);
+        return -1;
+    }
+
+    bool stop = false;
+    struct epoll_event events[SERVE_EVENTS];
+    while (!stop)
+    {
+        int n = epoll_wait(srv.epoll_fd, events, SERVE_EVENTS, -1);
+        if (n == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            rio_error("serve: epoll_wait", NULL);
+            break;
+        }
+
+        /* a connection only leaves the set (or is freed) while handling its own event */
+        for (int i = 0; i < n; ++i)
+        {
+            void* p = events[i].data.ptr;
+            if (p == &srv.listen_fd)
+            {
+                accept_connections(&srv);
+            }
+            else if (p == &srv.signal_fd)
+            {
+                stop = signal_event(&srv) || stop;
+            }
+            else
+            {
+                conn_event(&srv, p);
+            }
+        }
+    }
+
+    teardown(&srv, path);
+    return 0;
+}
+
+int serve_connect(const char* path)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    size_t len = strlen(path);
+    if (len >= sizeof(addr.sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memcpy(addr.sun_path, path, len + 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+    {
+        return -1;
+    }
+    while (connect(fd, (const struct sockaddr*)&addr, sizeof(addr)) == -1)
+    {
+        if (errno != EINTR)
+        {
+            int err = errno;
+            close(fd);
+            errno = err;
+            return -1;
+        }
+    }
+    return fd;
+}
+
+int serve_submit(int sock, const char* src, size_t len, const int fds[3], int* status)
+{
+    if (len > SERVE_MAX_COMMAND)
+    {
+        errno = E2BIG;
+        return -1;
+    }
+
+    serve_request_t req = {SERVE_MAGIC, (uint32_t)len};
+    union
+    {
+        char buf[CMSG_SPACE(3 * sizeof(int))];
+        struct cmsghdr align;
+    } ctrl;
+    memset(&ctrl, 0, sizeof(ctrl));
+    struct iovec iov = {&req, sizeof(req)};
+    struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = ctrl.buf,
+                         .msg_controllen = sizeof(ctrl.buf)};
+    struct cmsghdr* cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(3 * sizeof(int));
+    memcpy(CMSG_DATA(cm), fds, 3 * sizeof(int));
+
+    ssize_t n;
+    while ((n = sendmsg(sock, &msg, MSG_NOSIGNAL)) == -1 && errno == EINTR)
+    {
+    }
+    if (n == -1)
+    {
+        return -1;
+    }
+
+    /* the descriptors travel with the first byte, the rest is plain data */
+    if (rio_write_full(sock, (const char*)&req + n, sizeof(req) - (size_t)n) == -1
+        || rio_write_full(sock, src, len) == -1)
+    {
+        return -1;
+    }
+
+    serve_reply_t reply;
+    ssize_t got = rio_read_full(sock, &reply, sizeof(reply));
+    if (got != (ssize_t)sizeof(reply))
+    {
+        if (got >= 0)
+        {
+            errno = ECONNRESET; /* the server went away */
+        }
+        return -1;
+    }
+    *status = reply.status;
+    return 0;
+}
@@ -0,0 +1,63 @@
+#ifndef PICO_SERVE_H
+#define PICO_SERVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * "pico --serve SOCKET": a long-lived shell that runs command lines
+ * submitted over an AF_UNIX stream socket, so a caller that would start a
+ * fresh shell per short batch pays for fork/exec/startup only once.
+ *
+ * Wire format, per request: a serve_request_t sent with sendmsg() together
+ * with the client's stdin, stdout and stderr as SCM_RIGHTS, then len bytes
+ * of command text. The server answers each request with a serve_reply_t.
+ * A connection carries any number of requests, one at a time.
+ *
+ * The server is a single epoll loop that accepts connections, reads
+ * requests and hands complete ones to a bounded pool of workers. A worker
+ * is a child forked from the already initialised server, with the
+ * client's descriptors on 0-2, so requests cannot see each other's cd,
+ * variables or redirections. Requests beyond the pool size wait in FIFO
+ * order. Only clients running as the same user are accepted.
+ */
+
+#define SERVE_MAGIC 0x52455350u         /* "PSER" */
+#define SERVE_MAX_COMMAND (1u << 20)    /* longest accepted command text */
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t len; /* bytes of command text following the header */
+} serve_request_t;
+
+typedef struct
+{
+    int32_t status; /* exit status in shell convention, 128 + signal when killed */
+} serve_reply_t;
+
+/*
+ * Runs in the worker with fds 0-2 already set to the client's; returns the
+ * exit status of the command text src[0..len). slot is below max_workers
+ * and differs between requests that run at the same time.
+ */
+typedef int (*serve_run_fn)(void* ctx, size_t slot, const char* src, size_t len);
+
+/*
+ * Listen on path and serve requests with up to max_workers of them running
+ * at once. Returns 0 after SIGINT or SIGTERM (the socket is removed), or
+ * -1 after reporting an error that kept the server from starting.
+ */
+int serve_loop(const char* path, size_t max_workers, serve_run_fn run, void* ctx);
+
+/* client side: connect to a server, -1 with errno set on failure */
+int serve_connect(const char* path);
+
+/*
+ * Send src[0..len) with fds[0..2] as the command's stdin, stdout and
+ * stderr, and wait for its exit status. Returns -1 with errno set when the
+ * request could not be sent or the server closed the connection.
+ */
+int serve_submit(int sock, const char* src, size_t len, const int fds[3], int* status);
+
+#endif /* PICO_SERVE_H */
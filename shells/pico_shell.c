@@ -1,312 +1,2206 @@
-#define _POSIX_C_SOURCE 200809L
+#define _XOPEN_SOURCE 700 /* realpath */
 
 #include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
 #include <limits.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include "pico_glob.h"
+#include "pico_history.h"
+#include "pico_launch.h"
+#include "pico_lineedit.h"
+#include "pico_memo.h"
+#include "pico_script.h"
+#include "pico_serve.h"
+#include "pico_vars.h"
+#include "robust_io.h"
+
 #ifndef PATH_MAX
 #define PATH_MAX 4096
 #endif
 
 #define PROMPT "PS> "
-#define INITIAL_TOK_CAP 8
+#define PROMPT2 "> "    /* while a construct or quote is still open */
 #define END_MSG "Good Bye!\n"
+#define MAX_REDIRS 16
+#define SAVED_FD_MIN 10 /* saved copies of redirected fds live above the user range */
+#define INLINE_WORDS 16 /* words of a command kept on the stack before going to the heap */
+#define ECHO_BUF 4096   /* echo output up to this size goes out in one write() */
+#define MAX_CALL_DEPTH 1000
+#define HISTORY_FILE ".pico_history" /* under $HOME unless $HISTFILE is set */
+#define MEMO_DIR "pico_memo"          /* under $XDG_CACHE_HOME or ~/.cache unless $PICO_MEMO_DIR is set */
+#define MEMO_MAX_DEFAULT (256UL << 20) /* cache size limit unless $PICO_MEMO_MAX is set */
+
+typedef struct
+{
+    redir_kind_t kind;
+    int fd;             /* descriptor being redirected */
+    int dup_fd;         /* source descriptor for REDIR_DUP */
+    const char* target; /* file name for the other kinds */
+} redirection_t;
+
+typedef struct
+{
+    redirection_t items[MAX_REDIRS];
+    size_t count;
+} redir_list_t;
+
+/* a function defined with NAME() { ... }; holds a reference on its script */
+typedef struct
+{
+    const char* name;
+    script_t* script;
+    sref_t body;
+} func_t;
+
+typedef struct
+{
+    int last_status;
+    bool should_exit;
+    bool glob_sort;   /* sort pathname expansions, off with "set -o nosortglob" */
+    vars_t* vars;     /* shell and environment variables */
+    bool spread_cpus; /* pin forked commands to the serve worker's cpu, "set -o spreadcpus" */
+    long serve_slot;  /* slot of the serve worker running this shell, -1 outside --serve */
+    launch_attrs_t launch; /* pin / nice / ionice / sched of the current command */
+    char** params;    /* positional parameters $1..., borrowed from argv or the calling command */
+    size_t nparams;
+    const char* arg0; /* $0 */
+    char pid[24];     /* $$ */
+    func_t* funcs;
+    size_t nfuncs;
+    size_t funcs_cap;
+    int loop_depth;   /* loops around the running command in the current function */
+    int call_depth;
+    int breaking;     /* loops still to leave after "break n" */
+    int continuing;   /* loops still to leave after "continue n", the last one continues */
+    bool returning;   /* "return" ran and the function body is unwinding */
+} shell_t;
+
+/* words of one command: a small stack array that moves to the heap when it fills up */
+typedef struct
+{
+    char** items;
+    size_t count;
+    size_t cap;
+    char* inline_items[INLINE_WORDS];
+} strvec_t;
+
+extern char** environ;
 
 static void setup_signals(void);
-static char** tokenize_input(char* input, size_t* argc_out);
-static void free_tokens(char** tokens);
+static history_t* open_history(const vars_t* vars);
+static int run_source(shell_t* sh, const char* src, size_t len);
+static int run_file(shell_t* sh, const char* path);
+static size_t serve_workers(const vars_t* vars);
+static int serve_command(void* ctx, size_t slot, const char* src, size_t len);
+static int run_script(shell_t* sh, script_t* script);
+static int run_node(shell_t* sh, script_t* s, sref_t ref);
+static int run_loop(shell_t* sh, script_t* s, const loop_node_t* n);
+static int run_for(shell_t* sh, script_t* s, const for_node_t* n);
+static int run_command(shell_t* sh, script_t* s, const cmd_node_t* cmd);
+static bool loop_done(shell_t* sh);
+static int define_function(shell_t* sh, script_t* s, const func_node_t* n);
+static const func_t* find_function(const shell_t* sh, const char* name);
+static int call_function(shell_t* sh, const func_t* f, char** argv, size_t argc);
+static void free_functions(shell_t* sh);
+
+static int expand_words(shell_t* sh, script_t* s, const word_t* words, size_t n, strvec_t* out, strvec_t* owned,
+                        glob_ctx_t** gctx);
+static int expand_word(shell_t* sh, script_t* s, const word_t* w, bool pattern, char** out, strvec_t* owned);
+static int expand_redirections(shell_t* sh, script_t* s, const cmd_node_t* cmd, redir_list_t* redirs,
+                               strvec_t* owned);
+static int eval_arith(shell_t* sh, script_t* s, sref_t ref, int64_t* out);
+
+static void strvec_init(strvec_t* v);
+static int strvec_push(strvec_t* v, char* str);
+static void strvec_free(strvec_t* v, bool free_items);
+
+static int run_external(shell_t* sh, char** argv, const redir_list_t* redirs, char** assigns, size_t nassign);
+static void exec_command(char** argv, char** envp, char** assigns, size_t nassign);
+static const launch_attrs_t* prepare_launch(shell_t* sh);
+static bool split_assignment(char* word, char** value);
+
+static int apply_redirections(const redir_list_t* redirs, int* saved, size_t* applied);
+static void restore_redirections(const redir_list_t* redirs, int* saved, size_t applied);
 
-static bool run_builtin(char** argv, size_t argc, int* should_exit, int* exit_code);
+static bool is_builtin(const char* name, size_t argc);
+
+static bool run_builtin(shell_t* sh, char** argv, size_t argc, char** assigns, size_t nassign);
 static int builtin_echo(char** argv);
 static int builtin_pwd(void);
-static int builtin_cd(char** argv, size_t argc);
+static int builtin_cd(shell_t* sh, char** argv, size_t argc);
 static int builtin_exit(char** argv, size_t argc, int last_status);
+static int builtin_set(shell_t* sh, char** argv, size_t argc);
+static int builtin_export(shell_t* sh, char** argv, size_t argc);
+static int builtin_unset(shell_t* sh, char** argv, size_t argc);
+static int builtin_env(shell_t* sh);
+static int builtin_memo(shell_t* sh, char** argv, size_t argc, char** assigns, size_t nassign);
+static int builtin_test(char** argv, size_t argc);
+static int builtin_break(shell_t* sh, char** argv, size_t argc);
+static int builtin_return(shell_t* sh, char** argv, size_t argc);
+static int builtin_shift(shell_t* sh, char** argv, size_t argc);
 
-int main(void)
+/*
+ * pico                  interactive, or commands from stdin
+ * pico FILE [ARGS...]   run a script with $1... set to ARGS
+ * pico --serve SOCKET   run command lines submitted with picoc, see pico_serve.h
+ */
+int main(int argc, char** argv)
 {
     char* line = NULL;
     size_t line_cap = 0;
-    int shell_exit_code = EXIT_SUCCESS;
-    int should_exit = 0;
+    shell_t sh = {.last_status = EXIT_SUCCESS, .glob_sort = true, .serve_slot = -1};
+
+    sh.vars = vars_new(environ);
+    if (sh.vars == NULL)
+    {
+        perror("vars");
+        return ENOMEM;
+    }
+    snprintf(sh.pid, sizeof(sh.pid), "%ld", (long)getpid());
+    sh.arg0 = argv[0];
 
     setup_signals();
 
-    while (!should_exit)
+    if (argc > 1 && strcmp(argv[1], "--serve") == 0)
     {
-        ssize_t nread;
-        char** argv = NULL;
-        size_t argc = 0;
-
-        if (write(STDOUT_FILENO, PROMPT, strlen(PROMPT)) < 0)
+        if (argc != 3)
         {
-            perror("write");
-            shell_exit_code = errno;
-            break;
+            fprintf(stderr, "usage: %s --serve SOCKET\n", argv[0]);
+            vars_free(sh.vars);
+            return 2;
         }
+        int rc = serve_loop(argv[2], serve_workers(sh.vars), serve_command, &sh);
+        vars_free(sh.vars);
+        return rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
 
-        nread = getline(&line, &line_cap, stdin);
-        if (nread == -1)
+    if (argc > 1)
+    {
+        sh.arg0 = argv[1];
+        sh.params = argv + 2;
+        sh.nparams = (size_t)argc - 2;
+        if (run_file(&sh, argv[1]) != 0)
         {
-            if (feof(stdin))
-            {
-                break;
-            }
-            perror("getline");
-            shell_exit_code = errno;
-            continue;
+            sh.last_status = ENOMEM;
         }
+        free_functions(&sh);
+        vars_free(sh.vars);
+        return sh.last_status;
+    }
 
-        argv = tokenize_input(line, &argc);
-        if (argv == NULL)
-        {
-            shell_exit_code = ENOMEM;
-            break;
-        }
+    /* line editing and history only when a user is typing at a terminal */
+    history_t* hist = NULL;
+    if (isatty(STDIN_FILENO) && isatty(STDOUT_FILENO))
+    {
+        hist = open_history(sh.vars);
+    }
 
-        if (argc == 0)
-        {
-            free_tokens(argv);
-            continue;
-        }
+    /* lines are collected until they form complete commands */
+    char* src = NULL;
+    size_t src_len = 0;
+    size_t src_cap = 0;
 
-        if (run_builtin(argv, argc, &should_exit, &shell_exit_code))
-        {
-            free_tokens(argv);
-            continue;
-        }
+    while (!sh.should_exit)
+    {
+        const char* prompt = src_len == 0 ? PROMPT : PROMPT2;
+        ssize_t nread;
 
-        pid_t pid = fork();
-        if (pid == -1)
+        if (hist != NULL)
         {
-            perror("fork");
-            shell_exit_code = errno;
-            free_tokens(argv);
-            continue;
+            nread = lineedit_read(hist, prompt, &line, &line_cap);
+            if (nread == -1)
+            {
+                break;
+            }
+            if (nread > 0 && history_add(hist, line, (size_t)nread) != 0)
+            {
+                perror("history");
+            }
         }
-
-        if (pid == 0)
+        else
         {
-            execvp(argv[0], argv);
-            if (errno == ENOENT)
+            if (rio_write_full(STDOUT_FILENO, prompt, strlen(prompt)) < 0)
             {
-                dprintf(STDERR_FILENO, "%s: command not found\n", argv[0]);
+                rio_error("write", NULL);
+                sh.last_status = errno;
+                break;
             }
-            else
+
+            nread = getline(&line, &line_cap, stdin);
+            if (nread == -1)
             {
-                perror(argv[0]);
+                if (feof(stdin))
+                {
+                    break;
+                }
+                perror("getline");
+                sh.last_status = errno;
+                continue;
             }
-            _exit(127);
         }
 
-        int status = 0;
-        if (waitpid(pid, &status, 0) == -1)
+        if (src_len + (size_t)nread + 2 > src_cap)
+        {
+            size_t cap = (src_len + (size_t)nread + 2) * 2;
+            char* tmp = realloc(src, cap);
+            if (tmp == NULL)
+            {
+                perror("realloc");
+                sh.last_status = ENOMEM;
+                break;
+            }
+            src = tmp;
+            src_cap = cap;
+        }
+        memcpy(src + src_len, line, (size_t)nread);
+        src_len += (size_t)nread;
+        if (src_len == 0 || src[src_len - 1] != '\n')
         {
-            perror("waitpid");
-            shell_exit_code = errno;
+            src[src_len++] = '\n';
         }
-        else if (WIFEXITED(status))
+
+        int rc = run_source(&sh, src, src_len);
+        if (rc < 0)
         {
-            shell_exit_code = WEXITSTATUS(status);
+            sh.last_status = ENOMEM;
+            break;
         }
-        else if (WIFSIGNALED(status))
+        if (rc == 0)
         {
-            shell_exit_code = 128 + WTERMSIG(status);
+            src_len = 0;
         }
+    }
 
-        free_tokens(argv);
+    if (src_len > 0 && !sh.should_exit)
+    {
+        fprintf(stderr, "syntax error: unexpected end of file\n");
+        sh.last_status = 2;
     }
 
+    history_close(hist);
+    free(src);
     free(line);
-    return shell_exit_code;
+    free_functions(&sh);
+    vars_free(sh.vars);
+    return sh.last_status;
 }
 
-static bool run_builtin(char** argv, size_t argc, int* should_exit, int* exit_code)
+/*
+ * Compile and run src. Returns 1 when src ends inside an open construct
+ * and more input is needed, -1 only when the shell ran out of memory.
+ */
+static int run_source(shell_t* sh, const char* src, size_t len)
 {
-    if (strcmp(argv[0], "echo") == 0)
+    script_t* script = NULL;
+    switch (script_compile(src, len, &script))
     {
-        *exit_code = builtin_echo(argv);
-        return true;
+    case SCRIPT_OK:
+        break;
+    case SCRIPT_INCOMPLETE:
+        return 1;
+    case SCRIPT_SYNTAX:
+        sh->last_status = 2;
+        return 0;
+    case SCRIPT_NOMEM:
+        perror("compile");
+        return -1;
     }
+    return run_script(sh, script);
+}
 
-    if (strcmp(argv[0], "pwd") == 0)
+/* $PICO_SERVE_WORKERS, or one worker per online cpu */
+static size_t serve_workers(const vars_t* vars)
+{
+    const char* s = vars_get(vars, "PICO_SERVE_WORKERS");
+    char* end = NULL;
+    unsigned long n = s != NULL ? strtoul(s, &end, 10) : 0;
+    if (s != NULL && *s != '\0' && *end == '\0' && n > 0)
     {
-        *exit_code = builtin_pwd();
-        return true;
+        return (size_t)n;
     }
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    return ncpu > 0 ? (size_t)ncpu : 1;
+}
 
-    if (strcmp(argv[0], "cd") == 0)
+/*
+ * --serve: one submitted command line, in a worker forked from the server
+ * with the client's stdin, stdout and stderr in place.
+ */
+static int serve_command(void* ctx, size_t slot, const char* src, size_t len)
+{
+    shell_t* sh = ctx;
+    snprintf(sh->pid, sizeof(sh->pid), "%ld", (long)getpid());
+    sh->serve_slot = (long)slot;
+
+    int rc = run_source(sh, src, len);
+    if (rc < 0)
     {
-        *exit_code = builtin_cd(argv, argc);
-        return true;
+        return ENOMEM;
     }
-
-    if (strcmp(argv[0], "exit") == 0)
+    if (rc > 0)
     {
-        *exit_code = builtin_exit(argv, argc, *exit_code);
-        *should_exit = 1;
-        return true;
+        fprintf(stderr, "syntax error: unexpected end of file\n");
+        return 2;
     }
-
-    return false;
+    return sh->last_status;
 }
 
-static int builtin_echo(char** argv)
+/*
+ * Run a script file. With $PICO_SCRIPT_CACHE naming a directory, the
+ * compiled form is cached there and reused while the file's mtime and size
+ * stay the same, so the file is not even read again.
+ */
+static int run_file(shell_t* sh, const char* path)
 {
-    for (size_t i = 1; argv[i] != NULL; ++i)
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1)
     {
-        if (i > 1)
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        sh->last_status = 127;
+        if (fd != -1)
         {
-            if (write(STDOUT_FILENO, " ", 1) < 0)
-            {
-                perror("write");
-                return 1;
-            }
+            close(fd);
         }
-        if (write(STDOUT_FILENO, argv[i], strlen(argv[i])) < 0)
+        return 0;
+    }
+
+    const char* cache = vars_get(sh->vars, "PICO_SCRIPT_CACHE");
+    char real[PATH_MAX];
+    bool cached = cache != NULL && *cache != '\0' && realpath(path, real) != NULL;
+    script_t* script = cached ? script_cache_load(cache, real, &st) : NULL;
+    if (script != NULL)
+    {
+        close(fd);
+        return run_script(sh, script);
+    }
+
+    size_t cap = st.st_size > 0 ? (size_t)st.st_size + 1 : 4096;
+    size_t len = 0;
+    char* src = malloc(cap);
+    ssize_t n = 0;
+    while (src != NULL && (n = rio_read(fd, src + len, cap - len)) > 0)
+    {
+        len += (size_t)n;
+        if (len == cap)
         {
-            perror("write");
-            return 1;
+            char* tmp = realloc(src, cap * 2);
+            if (tmp == NULL)
+            {
+                free(src);
+                src = NULL;
+                break;
+            }
+            src = tmp;
+            cap *= 2;
         }
     }
+    close(fd);
+    if (src == NULL)
+    {
+        perror("malloc");
+        return -1;
+    }
+    if (n == -1)
+    {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        sh->last_status = 1;
+        free(src);
+        return 0;
+    }
 
-    if (write(STDOUT_FILENO, "\n", 1) < 0)
+    script_status_t status = script_compile(src, len, &script);
+    free(src);
+    switch (status)
     {
-        perror("write");
-        return 1;
+    case SCRIPT_OK:
+        break;
+    case SCRIPT_INCOMPLETE:
+        fprintf(stderr, "%s: syntax error: unexpected end of file\n", path);
+        /* fall through */
+    case SCRIPT_SYNTAX:
+        sh->last_status = 2;
+        return 0;
+    case SCRIPT_NOMEM:
+        perror("compile");
+        return -1;
     }
 
-    return 0;
+    if (cached)
+    {
+        script_cache_store(cache, real, &st, script);
+    }
+    return run_script(sh, script);
 }
 
-static int builtin_pwd(void)
+/* link a compiled script to the shell's variables, run it and drop the caller's reference */
+static int run_script(shell_t* sh, script_t* script)
 {
-    char cwd[PATH_MAX];
-
-    if (getcwd(cwd, sizeof(cwd)) == NULL)
+    if (script_link(script, sh->vars) != 0)
     {
-        perror("getcwd");
-        return 1;
+        perror("link");
+        script_release(script);
+        return -1;
     }
+    int rc = run_node(sh, script, script_header(script)->root);
+    script_release(script);
+
+    /* break / continue outside of any loop have nothing left to unwind */
+    sh->breaking = 0;
+    sh->continuing = 0;
+    return rc;
+}
+
+static bool interrupted(const shell_t* sh)
+{
+    return sh->should_exit || sh->breaking > 0 || sh->continuing > 0 || sh->returning;
+}
 
-    if (write(STDOUT_FILENO, cwd, strlen(cwd)) < 0)
+/*
+ * Evaluate one node. Statuses go to sh->last_status; the return value is
+ * -1 only when the shell ran out of memory.
+ */
+static int run_node(shell_t* sh, script_t* s, sref_t ref)
+{
+    if (ref == 0 || interrupted(sh))
     {
-        perror("write");
-        return 1;
+        return 0;
     }
-    if (write(STDOUT_FILENO, "\n", 1) < 0)
+
+    const node_t* node = script_at(s, ref);
+    switch ((node_kind_t)node->kind)
     {
-        perror("write");
-        return 1;
-    }
+    case NODE_CMD:
+        return run_command(sh, s, (const cmd_node_t*)node);
 
-    return 0;
-}
+    case NODE_LIST:
+    {
+        const list_node_t* n = (const list_node_t*)node;
+        const sref_t* items = script_at(s, n->items);
+        for (uint32_t i = 0; i < n->count && !interrupted(sh); ++i)
+        {
+            if (run_node(sh, s, items[i]) != 0)
+            {
+                return -1;
+            }
+        }
+        return 0;
+    }
 
-static int builtin_cd(char** argv, size_t argc)
-{
-    const char* target = NULL;
-    if (argc < 2)
+    case NODE_AND:
+    case NODE_OR:
     {
-        target = getenv("HOME");
-        if (target == NULL)
+        const binary_node_t* n = (const binary_node_t*)node;
+        if (run_node(sh, s, n->left) != 0)
         {
-            fprintf(stderr, "cd: HOME not set\n");
-            return 1;
+            return -1;
+        }
+        if ((sh->last_status == 0) == (n->kind == NODE_AND))
+        {
+            return run_node(sh, s, n->right);
         }
+        return 0;
     }
-    else
+
+    case NODE_NOT:
     {
-        target = argv[1];
+        const binary_node_t* n = (const binary_node_t*)node;
+        int rc = run_node(sh, s, n->left);
+        sh->last_status = sh->last_status == 0;
+        return rc;
     }
 
-    if (chdir(target) != 0)
+    case NODE_IF:
     {
-        fprintf(stderr, "cd: %s: %s\n", target, strerror(errno));
-        return 1;
+        const if_node_t* n = (const if_node_t*)node;
+        if (run_node(sh, s, n->cond) != 0)
+        {
+            return -1;
+        }
+        if (interrupted(sh))
+        {
+            return 0;
+        }
+        if (sh->last_status == 0)
+        {
+            return run_node(sh, s, n->then_part);
+        }
+        sh->last_status = 0;
+        return run_node(sh, s, n->else_part);
     }
 
+    case NODE_WHILE:
+    case NODE_UNTIL:
+        return run_loop(sh, s, (const loop_node_t*)node);
+
+    case NODE_FOR:
+        return run_for(sh, s, (const for_node_t*)node);
+
+    case NODE_FUNC:
+        return define_function(sh, s, (const func_node_t*)node);
+    }
     return 0;
 }
 
-static int builtin_exit(char** argv, size_t argc, int last_status)
+/*
+ * After a loop body or condition: true when this loop has to stop, either
+ * for a pending break / continue aimed further out or for exit / return.
+ */
+static bool loop_done(shell_t* sh)
 {
-    if (write(STDOUT_FILENO, END_MSG, strlen(END_MSG)) < 0)
+    if (sh->breaking > 0)
+    {
+        sh->breaking--;
+        return true;
+    }
+    if (sh->continuing > 0)
     {
-        perror("write");
+        /* "continue n" leaves n - 1 loops and continues the last one */
+        return --sh->continuing > 0;
     }
+    return sh->should_exit || sh->returning;
+}
 
-    if (argc < 2)
+static int run_loop(shell_t* sh, script_t* s, const loop_node_t* n)
+{
+    int status = 0;
+    int rc = 0;
+    sh->loop_depth++;
+    for (;;)
     {
-        return last_status;
+        rc = run_node(sh, s, n->cond);
+        if (rc != 0 || loop_done(sh) || (sh->last_status == 0) == (n->kind == NODE_UNTIL))
+        {
+            break;
+        }
+        rc = run_node(sh, s, n->body);
+        status = sh->last_status;
+        if (rc != 0 || loop_done(sh))
+        {
+            break;
+        }
     }
+    sh->loop_depth--;
+    sh->last_status = status;
+    return rc;
+}
 
-    char* endptr = NULL;
-    long code = strtol(argv[1], &endptr, 10);
-    if (endptr == argv[1] || *endptr != '\0')
+static int run_for(shell_t* sh, script_t* s, const for_node_t* n)
+{
+    strvec_t items, owned;
+    strvec_init(&items);
+    strvec_init(&owned);
+    glob_ctx_t* gctx = NULL;
+
+    int rc = expand_words(sh, s, script_at(s, n->words), n->nwords, &items, &owned, &gctx);
+    if (rc > 0)
     {
-        return EXIT_FAILURE;
+        sh->last_status = 1;
+        rc = 0;
+    }
+    else if (rc == 0)
+    {
+        int slot = s->slots[n->var];
+        sh->last_status = 0;
+        sh->loop_depth++;
+        for (size_t i = 0; i < items.count; ++i)
+        {
+            if (vars_slot_set(sh->vars, slot, items.items[i], false) != 0)
+            {
+                perror("for");
+                rc = -1;
+                break;
+            }
+            rc = run_node(sh, s, n->body);
+            if (rc != 0 || loop_done(sh))
+            {
+                break;
+            }
+        }
+        sh->loop_depth--;
     }
 
-    return (int)(code & 0xFF);
+    glob_ctx_free(gctx);
+    strvec_free(&items, false);
+    strvec_free(&owned, true);
+    return rc;
 }
 
-static char** tokenize_input(char* input, size_t* argc_out)
+/*
+ * One simple command: expand its words, assignments and redirection
+ * targets, then run a function, a builtin or an external command.
+ */
+static int run_command(shell_t* sh, script_t* s, const cmd_node_t* cmd)
 {
-    size_t cap = INITIAL_TOK_CAP;
-    size_t argc = 0;
-    char** tokens = malloc(cap * sizeof(*tokens));
-    if (tokens == NULL)
+    strvec_t args, owned, assigns;
+    strvec_init(&args);
+    strvec_init(&owned);
+    strvec_init(&assigns);
+    glob_ctx_t* gctx = NULL;
+    redir_list_t redirs;
+
+    int rc = expand_words(sh, s, script_at(s, cmd->words), cmd->nwords, &args, &owned, &gctx);
+    if (rc == 0)
     {
-        perror("malloc");
-        return NULL;
+        rc = expand_redirections(sh, s, cmd, &redirs, &owned);
     }
 
-    char* token = strtok(input, " \n");
-    while (token != NULL)
+    /* NAME=VALUE words: shell assignments on their own, else the command's environment */
+    const assign_t* as = script_at(s, cmd->assigns);
+    const sref_t* names = script_at(s, script_header(s)->names);
+    for (uint32_t i = 0; i < cmd->nassign && rc == 0; ++i)
     {
-        if (argc + 1 >= cap)
+        char* value = NULL;
+        rc = expand_word(sh, s, &as[i].value, false, &value, &owned);
+        if (rc != 0)
         {
-            cap *= 2;
-            char** tmp = realloc(tokens, cap * sizeof(*tokens));
-            if (tmp == NULL)
+            break;
+        }
+        if (args.count == 0)
+        {
+            if (vars_slot_set(sh->vars, s->slots[as[i].name], value, false) != 0)
             {
-                free(tokens);
-                perror("realloc");
-                return NULL;
+                rc = -1;
             }
-            tokens = tmp;
+            continue;
+        }
+        const char* name = script_at(s, names[as[i].name]);
+        size_t nlen = strlen(name), vlen = strlen(value);
+        char* env = malloc(nlen + vlen + 2);
+        if (env == NULL || strvec_push(&owned, env) != 0)
+        {
+            free(env);
+            rc = -1;
+            break;
         }
+        memcpy(env, name, nlen);
+        env[nlen] = '=';
+        memcpy(env + nlen + 1, value, vlen + 1);
+        rc = strvec_push(&assigns, env);
+    }
 
-        tokens[argc++] = token;
-        token = strtok(NULL, " \n");
+    if (rc > 0)
+    {
+        sh->last_status = 1;
+        rc = 0;
+        goto out;
+    }
+    if (rc < 0)
+    {
+        perror("expand");
+        goto out;
     }
 
-    tokens[argc] = NULL;
-    *argc_out = argc;
-    return tokens;
-}
+    char** argv = args.items;
+    size_t argc = args.count;
+    int nmod = 0;
+    if (argc > 0)
+    {
+        /* pin / nice / ionice / sched modifiers in front of the command */
+        nmod = launch_parse(argv, argc, &sh->launch);
+        argv += nmod;
+        argc -= (size_t)nmod;
+    }
 
-static void free_tokens(char** tokens)
-{
-    free(tokens);
+    const func_t* func = argc > 0 ? find_function(sh, argv[0]) : NULL;
+    if (nmod > 0 && (func != NULL || is_builtin(argv[0], argc + assigns.count)))
+    {
+        /* they only take effect between fork and exec */
+        fprintf(stderr, "%s: modifiers only apply to external commands, not to %s\n", args.items[0], argv[0]);
+        sh->last_status = 2;
+        goto out;
+    }
+
+    /* assignments count as arguments so that "NAME=VALUE env" reaches env(1) */
+    if (argc == 0 || func != NULL || is_builtin(argv[0], argc + assigns.count))
+    {
+        /* run in the shell itself: redirect around the call and put the fds back */
+        int saved[MAX_REDIRS];
+        size_t applied = 0;
+        if (apply_redirections(&redirs, saved, &applied) == 0)
+        {
+            if (func != NULL)
+            {
+                rc = call_function(sh, func, argv, argc);
+            }
+            else if (argc > 0)
+            {
+                run_builtin(sh, argv, argc, assigns.items, assigns.count);
+            }
+            else
+            {
+                sh->last_status = 0;
+            }
+        }
+        else
+        {
+            sh->last_status = 1;
+        }
+        restore_redirections(&redirs, saved, applied);
+    }
+    else
+    {
+        sh->last_status = run_external(sh, argv, &redirs, assigns.items, assigns.count);
+    }
+
+out:
+    glob_ctx_free(gctx);
+    strvec_free(&args, false);
+    strvec_free(&assigns, false);
+    strvec_free(&owned, true);
+    return rc;
 }
 
-static void setup_signals(void)
+/*
+ * Expand words into out, NULL-terminated. Unquoted words that expand to
+ * nothing are dropped, $@ gives one word per positional parameter and words
+ * with unquoted pattern characters go through pathname expansion.
+ * Returns 0, 1 after reporting an expansion error, or -1 when out of memory.
+ */
+static int expand_words(shell_t* sh, script_t* s, const word_t* words, size_t n, strvec_t* out, strvec_t* owned,
+                        glob_ctx_t** gctx)
 {
-    struct sigaction sa;
-    sigemptyset(&sa.sa_mask);
-    sa.sa_flags = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        const word_t* w = &words[i];
+        if (w->flags & WORD_ALL_ARGS)
+        {
+            for (size_t k = 0; k < sh->nparams; ++k)
+            {
+                if (strvec_push(out, sh->params[k]) != 0)
+                {
+                    return -1;
+                }
+            }
+            continue;
+        }
 
-    sa.sa_handler = SIG_IGN;
-    sigaction(SIGINT, &sa, NULL);
+        char* str = NULL;
+        int rc = expand_word(sh, s, w, (w->flags & WORD_GLOB) != 0, &str, owned);
+        if (rc != 0)
+        {
+            return rc;
+        }
+        if (*str == '\0' && !(w->flags & WORD_QUOTED))
+        {
+            continue;
+        }
+        if (!(w->flags & WORD_GLOB))
+        {
+            if (strvec_push(out, str) != 0)
+            {
+                return -1;
+            }
+            continue;
+        }
 
-    sa.sa_handler = SIG_DFL;
-    sigaction(SIGQUIT, &sa, NULL);
-    sigaction(SIGTSTP, &sa, NULL);
+        if (*gctx == NULL && (*gctx = glob_ctx_new(sh->glob_sort)) == NULL)
+        {
+            return -1;
+        }
+        size_t count = 1;
+        char** matches = glob_expand_argv(*gctx, &str, &count);
+        if (matches == NULL)
+        {
+            return -1;
+        }
+        for (size_t k = 0; k < count; ++k)
+        {
+            if (strvec_push(out, matches[k]) != 0)
+            {
+                return -1;
+            }
+        }
+    }
+
+    if (strvec_push(out, NULL) != 0)
+    {
+        return -1;
+    }
+    out->count--;
+    return 0;
+}
+
+static int append(char** buf, size_t* len, size_t* cap, const char* str, size_t n)
+{
+    if (*len + n + 1 > *cap)
+    {
+        size_t c = (*len + n + 1) * 2;
+        char* tmp = realloc(*buf, c);
+        if (tmp == NULL)
+        {
+            return -1;
+        }
+        *buf = tmp;
+        *cap = c;
+    }
+    memcpy(*buf + *len, str, n);
+    *len += n;
+    (*buf)[*len] = '\0';
+    return 0;
+}
+
+/* append str, with a backslash before every byte that brace or pathname expansion would interpret */
+static int append_escaped(char** buf, size_t* len, size_t* cap, const char* str, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (str[i] != '\0' && strchr("*?[]{},\\", str[i]) != NULL && append(buf, len, cap, "\\", 1) != 0)
+        {
+            return -1;
+        }
+        if (append(buf, len, cap, str + i, 1) != 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Expand one word into *out. A word that is a single literal is used
+ * straight from the script; anything else is built in a string that is
+ * added to owned. With pattern set the result is for glob_expand_argv():
+ * only the unquoted literal text keeps its meaning there, quoted text and
+ * expansions are backslash-escaped. Returns 0, 1 after an arithmetic error,
+ * -1 when out of memory.
+ */
+static int expand_word(shell_t* sh, script_t* s, const word_t* w, bool pattern, char** out, strvec_t* owned)
+{
+    const part_t* parts = script_at(s, w->parts);
+    if (w->nparts == 1 && (parts[0].kind == PART_LIT || (parts[0].kind == PART_QUOTED && !pattern)))
+    {
+        *out = (char*)script_at(s, parts[0].data);
+        return 0;
+    }
+
+    int (*text)(char**, size_t*, size_t*, const char*, size_t) = pattern ? append_escaped : append;
+
+    char* buf = NULL;
+    size_t len = 0, cap = 0;
+    int rc = append(&buf, &len, &cap, "", 0);
+    for (uint32_t i = 0; i < w->nparts && rc == 0; ++i)
+    {
+        const part_t* p = &parts[i];
+        char num[32];
+        const char* str = NULL;
+        switch ((part_kind_t)p->kind)
+        {
+        case PART_LIT:
+            rc = append(&buf, &len, &cap, script_at(s, p->data), p->val);
+            break;
+        case PART_QUOTED:
+            rc = text(&buf, &len, &cap, script_at(s, p->data), p->val);
+            break;
+        case PART_VAR:
+            str = vars_slot_get(sh->vars, s->slots[p->val]);
+            break;
+        case PART_ARITH:
+        {
+            int64_t v = 0;
+            rc = eval_arith(sh, s, p->data, &v);
+            snprintf(num, sizeof(num), "%" PRId64, v);
+            str = num;
+            break;
+        }
+        case PART_SPECIAL:
+            switch (p->val)
+            {
+            case '?':
+                snprintf(num, sizeof(num), "%d", sh->last_status);
+                str = num;
+                break;
+            case '$':
+                str = sh->pid;
+                break;
+            case '#':
+                snprintf(num, sizeof(num), "%zu", sh->nparams);
+                str = num;
+                break;
+            case '0':
+                str = sh->arg0;
+                break;
+            case '@':
+            case '*':
+                for (size_t k = 0; k < sh->nparams && rc == 0; ++k)
+                {
+                    rc = append(&buf, &len, &cap, " ", k > 0);
+                    if (rc == 0)
+                    {
+                        rc = text(&buf, &len, &cap, sh->params[k], strlen(sh->params[k]));
+                    }
+                }
+                break;
+            default:
+                if (p->val - '1' < sh->nparams)
+                {
+                    str = sh->params[p->val - '1'];
+                }
+                break;
+            }
+            break;
+        }
+        if (rc == 0 && str != NULL)
+        {
+            rc = text(&buf, &len, &cap, str, strlen(str));
+        }
+    }
+
+    if (rc != 0 || strvec_push(owned, buf) != 0)
+    {
+        free(buf);
+        return rc > 0 ? rc : -1;
+    }
+    *out = buf;
+    return 0;
+}
+
+static int expand_redirections(shell_t* sh, script_t* s, const cmd_node_t* cmd, redir_list_t* redirs,
+                               strvec_t* owned)
+{
+    const sredir_t* sr = script_at(s, cmd->redirs);
+    redirs->count = 0;
+    if (cmd->nredir > MAX_REDIRS)
+    {
+        fprintf(stderr, "too many redirections\n");
+        return 1;
+    }
+
+    for (uint32_t i = 0; i < cmd->nredir; ++i)
+    {
+        redirection_t* r = &redirs->items[redirs->count++];
+        char* target = NULL;
+        int rc = expand_word(sh, s, &sr[i].target, false, &target, owned);
+        if (rc != 0)
+        {
+            return rc;
+        }
+        r->kind = (redir_kind_t)sr[i].kind;
+        r->fd = sr[i].fd;
+        r->target = target;
+        if (r->kind == REDIR_DUP)
+        {
+            char* endptr = NULL;
+            long fd = strtol(target, &endptr, 10);
+            if (endptr == target || *endptr != '\0' || fd < 0 || fd >= SAVED_FD_MIN)
+            {
+                fprintf(stderr, "%s: bad file descriptor\n", target);
+                return 1;
+            }
+            r->dup_fd = (int)fd;
+            r->target = NULL;
+        }
+    }
+    return 0;
+}
+
+/* $((...)): 64-bit integers, unset and empty variables count as 0 */
+static int eval_arith(shell_t* sh, script_t* s, sref_t ref, int64_t* out)
+{
+    const arith_t* a = script_at(s, ref);
+    int64_t l = 0, r = 0;
+
+    switch ((arith_op_t)a->op)
+    {
+    case ARITH_NUM:
+        *out = a->num;
+        return 0;
+    case ARITH_VAR:
+    case ARITH_PARAM:
+    {
+        const char* v = NULL;
+        char num[32];
+        if (a->op == ARITH_VAR)
+        {
+            v = vars_slot_get(sh->vars, s->slots[a->var]);
+        }
+        else if (a->var == '#' || a->var == '?')
+        {
+            snprintf(num, sizeof(num), "%zu", a->var == '#' ? sh->nparams : (size_t)sh->last_status);
+            v = num;
+        }
+        else if (a->var != '0' && a->var - '1' < sh->nparams)
+        {
+            v = sh->params[a->var - '1'];
+        }
+        char* end = NULL;
+        errno = 0;
+        *out = (v == NULL || *v == '\0') ? 0 : strtoll(v, &end, 10);
+        if (end != NULL && (end == v || *end != '\0' || errno != 0))
+        {
+            const sref_t* names = script_at(s, script_header(s)->names);
+            fprintf(stderr, "%s: bad number\n", a->op == ARITH_VAR ? (const char*)script_at(s, names[a->var]) : v);
+            return 1;
+        }
+        return 0;
+    }
+    case ARITH_NEG:
+    case ARITH_NOT:
+        if (eval_arith(sh, s, a->left, &l) != 0)
+        {
+            return 1;
+        }
+        *out = a->op == ARITH_NEG ? (int64_t)(0 - (uint64_t)l) : !l;
+        return 0;
+    case ARITH_AND:
+    case ARITH_OR:
+        if (eval_arith(sh, s, a->left, &l) != 0)
+        {
+            return 1;
+        }
+        if ((l != 0) == (a->op == ARITH_OR))
+        {
+            *out = l != 0;
+            return 0;
+        }
+        if (eval_arith(sh, s, a->right, &r) != 0)
+        {
+            return 1;
+        }
+        *out = r != 0;
+        return 0;
+    default:
+        break;
+    }
+
+    if (eval_arith(sh, s, a->left, &l) != 0 || eval_arith(sh, s, a->right, &r) != 0)
+    {
+        return 1;
+    }
+    switch ((arith_op_t)a->op)
+    {
+    case ARITH_DIV:
+    case ARITH_MOD:
+        if (r == 0)
+        {
+            fprintf(stderr, "arithmetic: division by zero\n");
+            return 1;
+        }
+        if (r == -1)
+        {
+            /* INT64_MIN / -1 wraps instead of trapping */
+            *out = a->op == ARITH_DIV ? (int64_t)(0 - (uint64_t)l) : 0;
+            return 0;
+        }
+        *out = a->op == ARITH_DIV ? l / r : l % r;
+        return 0;
+    /* + - * wrap around like the other shells do */
+    case ARITH_MUL:
+        *out = (int64_t)((uint64_t)l * (uint64_t)r);
+        return 0;
+    case ARITH_ADD:
+        *out = (int64_t)((uint64_t)l + (uint64_t)r);
+        return 0;
+    case ARITH_SUB:
+        *out = (int64_t)((uint64_t)l - (uint64_t)r);
+        return 0;
+    case ARITH_LT:
+        *out = l < r;
+        return 0;
+    case ARITH_LE:
+        *out = l <= r;
+        return 0;
+    case ARITH_GT:
+        *out = l > r;
+        return 0;
+    case ARITH_GE:
+        *out = l >= r;
+        return 0;
+    case ARITH_EQ:
+        *out = l == r;
+        return 0;
+    case ARITH_NE:
+        *out = l != r;
+        return 0;
+    default:
+        *out = 0;
+        return 0;
+    }
+}
+
+static void strvec_init(strvec_t* v)
+{
+    v->items = v->inline_items;
+    v->count = 0;
+    v->cap = INLINE_WORDS;
+}
+
+static int strvec_push(strvec_t* v, char* str)
+{
+    if (v->count == v->cap)
+    {
+        size_t cap = v->cap * 2;
+        char** items = malloc(cap * sizeof(*items));
+        if (items == NULL)
+        {
+            return -1;
+        }
+        memcpy(items, v->items, v->count * sizeof(*items));
+        if (v->items != v->inline_items)
+        {
+            free(v->items);
+        }
+        v->items = items;
+        v->cap = cap;
+    }
+    v->items[v->count++] = str;
+    return 0;
+}
+
+static void strvec_free(strvec_t* v, bool free_items)
+{
+    for (size_t i = 0; free_items && i < v->count; ++i)
+    {
+        free(v->items[i]);
+    }
+    if (v->items != v->inline_items)
+    {
+        free(v->items);
+    }
+    strvec_init(v);
+}
+
+/* NAME() { ... }: (re)define NAME; the function keeps its script alive */
+static int define_function(shell_t* sh, script_t* s, const func_node_t* n)
+{
+    const char* name = script_at(s, n->name);
+    func_t* f = (func_t*)find_function(sh, name);
+    if (f == NULL)
+    {
+        if (sh->nfuncs == sh->funcs_cap)
+        {
+            size_t cap = sh->funcs_cap ? sh->funcs_cap * 2 : 8;
+            func_t* funcs = realloc(sh->funcs, cap * sizeof(*funcs));
+            if (funcs == NULL)
+            {
+                perror("function");
+                return -1;
+            }
+            sh->funcs = funcs;
+            sh->funcs_cap = cap;
+        }
+        f = &sh->funcs[sh->nfuncs++];
+    }
+    else
+    {
+        script_release(f->script);
+    }
+
+    script_retain(s);
+    f->name = name;
+    f->script = s;
+    f->body = n->body;
+    sh->last_status = 0;
+    return 0;
+}
+
+static const func_t* find_function(const shell_t* sh, const char* name)
+{
+    for (size_t i = 0; i < sh->nfuncs; ++i)
+    {
+        if (strcmp(sh->funcs[i].name, name) == 0)
+        {
+            return &sh->funcs[i];
+        }
+    }
+    return NULL;
+}
+
+/* run a function body with $1... set to argv[1...] */
+static int call_function(shell_t* sh, const func_t* f, char** argv, size_t argc)
+{
+    if (sh->call_depth >= MAX_CALL_DEPTH)
+    {
+        fprintf(stderr, "%s: maximum function nesting level exceeded\n", argv[0]);
+        sh->last_status = 1;
+        return 0;
+    }
+
+    /* the body may redefine the function, which must not free the running script */
+    func_t fn = *f;
+    script_retain(fn.script);
+
+    char** params = sh->params;
+    size_t nparams = sh->nparams;
+    int loop_depth = sh->loop_depth;
+    sh->params = argv + 1;
+    sh->nparams = argc - 1;
+    sh->loop_depth = 0;
+    sh->call_depth++;
+
+    int rc = run_node(sh, fn.script, fn.body);
+
+    sh->returning = false;
+    sh->call_depth--;
+    sh->loop_depth = loop_depth;
+    sh->params = params;
+    sh->nparams = nparams;
+    script_release(fn.script);
+    return rc;
+}
+
+static void free_functions(shell_t* sh)
+{
+    for (size_t i = 0; i < sh->nfuncs; ++i)
+    {
+        script_release(sh->funcs[i].script);
+    }
+    free(sh->funcs);
+    sh->funcs = NULL;
+    sh->nfuncs = 0;
+}
+
+/*
+ * If word is NAME=VALUE, cut it at the '=' and point *value past it.
+ */
+static bool split_assignment(char* word, char** value)
+{
+    char* eq = strchr(word, '=');
+    if (eq == NULL || !vars_valid_name(word, (size_t)(eq - word)))
+    {
+        return false;
+    }
+    *eq = '\0';
+    *value = eq + 1;
+    return true;
+}
+
+/*
+ * fork/exec an external command with its redirections (if any) applied in the child.
+ * Returns the exit status in shell convention (128 + signal when killed).
+ */
+static int run_external(shell_t* sh, char** argv, const redir_list_t* redirs, char** assigns, size_t nassign)
+{
+    /* rebuilt only when an exported variable changed since the last command */
+    char** envp = vars_envp(sh->vars);
+    if (envp == NULL)
+    {
+        perror("environment");
+        return 1;
+    }
+
+    const launch_attrs_t* launch = prepare_launch(sh);
+    pid_t pid = fork();
+    if (pid == -1)
+    {
+        perror("fork");
+        return errno;
+    }
+
+    if (pid == 0)
+    {
+        if ((redirs != NULL && apply_redirections(redirs, NULL, NULL) != 0) || launch_apply(launch) != 0)
+        {
+            _exit(1);
+        }
+        exec_command(argv, envp, assigns, nassign);
+    }
+
+    int status = 0;
+    if (waitpid(pid, &status, 0) == -1)
+    {
+        perror("waitpid");
+        return errno;
+    }
+    if (WIFEXITED(status))
+    {
+        return WEXITSTATUS(status);
+    }
+    if (WIFSIGNALED(status))
+    {
+        return 128 + WTERMSIG(status);
+    }
+    return 0;
+}
+
+/*
+ * Modifiers for the command about to be forked; with spreadcpus set in a
+ * serve worker, a command that was not pinned explicitly goes to the cpu
+ * of its worker slot, so requests running side by side use different cpus.
+ */
+static const launch_attrs_t* prepare_launch(shell_t* sh)
+{
+    if (sh->spread_cpus && sh->serve_slot >= 0 && !sh->launch.has_cpus)
+    {
+        launch_spread(&sh->launch, (size_t)sh->serve_slot);
+    }
+    return &sh->launch;
+}
+
+/*
+ * In a forked child: install the environment plus the command's own
+ * NAME=VALUE assignments and exec argv. Never returns.
+ */
+static void exec_command(char** argv, char** envp, char** assigns, size_t nassign)
+{
+    environ = envp;
+    for (size_t i = 0; i < nassign; ++i)
+    {
+        char* value = NULL;
+        split_assignment(assigns[i], &value);
+        setenv(assigns[i], value, 1);
+    }
+    execvp(argv[0], argv);
+    if (errno == ENOENT)
+    {
+        dprintf(STDERR_FILENO, "%s: command not found\n", argv[0]);
+    }
+    else
+    {
+        perror(argv[0]);
+    }
+    _exit(127);
+}
+
+static bool is_builtin(const char* name, size_t argc)
+{
+    static const char* const builtins[] = {"echo",  "pwd",   "cd",    "exit",     "set",    "export",
+                                           "unset", "env",   "memo",  "test",     "[",      "true",
+                                           "false", ":",     "break", "continue", "return", "shift"};
+
+    /* "env cmd ..." and env with assignments are left to the external env(1) */
+    if (argc > 1 && strcmp(name, "env") == 0)
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); ++i)
+    {
+        if (strcmp(name, builtins[i]) == 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool run_builtin(shell_t* sh, char** argv, size_t argc, char** assigns, size_t nassign)
+{
+    if (strcmp(argv[0], "echo") == 0)
+    {
+        sh->last_status = builtin_echo(argv);
+        return true;
+    }
+
+    if (strcmp(argv[0], "pwd") == 0)
+    {
+        sh->last_status = builtin_pwd();
+        return true;
+    }
+
+    if (strcmp(argv[0], "cd") == 0)
+    {
+        sh->last_status = builtin_cd(sh, argv, argc);
+        return true;
+    }
+
+    if (strcmp(argv[0], "exit") == 0)
+    {
+        sh->last_status = builtin_exit(argv, argc, sh->last_status);
+        sh->should_exit = true;
+        return true;
+    }
+
+    if (strcmp(argv[0], "set") == 0)
+    {
+        sh->last_status = builtin_set(sh, argv, argc);
+        return true;
+    }
+
+    if (strcmp(argv[0], "export") == 0)
+    {
+        sh->last_status = builtin_export(sh, argv, argc);
+        return true;
+    }
+
+    if (strcmp(argv[0], "unset") == 0)
+    {
+        sh->last_status = builtin_unset(sh, argv, argc);
+        return true;
+    }
+
+    if (strcmp(argv[0], "env") == 0)
+    {
+        sh->last_status = builtin_env(sh);
+        return true;
+    }
+
+    if (strcmp(argv[0], "memo") == 0)
+    {
+        sh->last_status = builtin_memo(sh, argv, argc, assigns, nassign);
+        return true;
+    }
+
+    if (strcmp(argv[0], "test") == 0 || strcmp(argv[0], "[") == 0)
+    {
+        sh->last_status = builtin_test(argv, argc);
+        return true;
+    }
+
+    if (strcmp(argv[0], "true") == 0 || strcmp(argv[0], ":") == 0 || strcmp(argv[0], "false") == 0)
+    {
+        sh->last_status = argv[0][0] == 'f';
+        return true;
+    }
+
+    if (strcmp(argv[0], "break") == 0 || strcmp(argv[0], "continue") == 0)
+    {
+        sh->last_status = builtin_break(sh, argv, argc);
+        return true;
+    }
+
+    if (strcmp(argv[0], "return") == 0)
+    {
+        sh->last_status = builtin_return(sh, argv, argc);
+        return true;
+    }
+
+    if (strcmp(argv[0], "shift") == 0)
+    {
+        sh->last_status = builtin_shift(sh, argv, argc);
+        return true;
+    }
+
+    return false;
+}
+
+/*
+ * set -o NAME / set +o NAME: turn a shell option on / off; "set -o" lists them.
+ *   nosortglob  leave glob matches in directory order instead of sorting them
+ *   spreadcpus  under --serve, pin forked commands to a cpu per worker slot
+ */
+static int builtin_set(shell_t* sh, char** argv, size_t argc)
+{
+    if (argc == 1 || (argc == 2 && strcmp(argv[1], "-o") == 0))
+    {
+        printf("nosortglob\t%s\n", sh->glob_sort ? "off" : "on");
+        printf("spreadcpus\t%s\n", sh->spread_cpus ? "on" : "off");
+        fflush(stdout);
+        return 0;
+    }
+
+    if (argc != 3 || (strcmp(argv[1], "-o") != 0 && strcmp(argv[1], "+o") != 0))
+    {
+        fprintf(stderr, "set: usage: set [-o|+o] option\n");
+        return 2;
+    }
+
+    bool enable = argv[1][0] == '-';
+    if (strcmp(argv[2], "nosortglob") == 0)
+    {
+        sh->glob_sort = !enable;
+        return 0;
+    }
+    if (strcmp(argv[2], "spreadcpus") == 0)
+    {
+        sh->spread_cpus = enable;
+        return 0;
+    }
+
+    fprintf(stderr, "set: %s: invalid option name\n", argv[2]);
+    return 1;
+}
+
+static int builtin_echo(char** argv)
+{
+    char buf[ECHO_BUF];
+    rio_writer_t out;
+    rio_writer_init(&out, STDOUT_FILENO, buf, sizeof(buf));
+
+    for (size_t i = 1; argv[i] != NULL; ++i)
+    {
+        if (i > 1)
+        {
+            rio_writer_putc(&out, ' ');
+        }
+        rio_writer_puts(&out, argv[i]);
+    }
+    rio_writer_putc(&out, '\n');
+
+    /* a failed put is remembered and reported here */
+    if (rio_writer_flush(&out) < 0)
+    {
+        rio_error("echo: write", NULL);
+        return 1;
+    }
+
+    return 0;
+}
+
+static int builtin_pwd(void)
+{
+    char cwd[PATH_MAX + 1];
+
+    if (getcwd(cwd, PATH_MAX) == NULL)
+    {
+        perror("getcwd");
+        return 1;
+    }
+
+    size_t len = strlen(cwd);
+    cwd[len] = '\n';
+    if (rio_write_full(STDOUT_FILENO, cwd, len + 1) < 0)
+    {
+        rio_error("pwd: write", NULL);
+        return 1;
+    }
+
+    return 0;
+}
+
+static int builtin_cd(shell_t* sh, char** argv, size_t argc)
+{
+    const char* target = NULL;
+    if (argc < 2)
+    {
+        target = vars_get(sh->vars, "HOME");
+        if (target == NULL)
+        {
+            fprintf(stderr, "cd: HOME not set\n");
+            return 1;
+        }
+    }
+    else
+    {
+        target = argv[1];
+    }
+
+    if (chdir(target) != 0)
+    {
+        fprintf(stderr, "cd: %s: %s\n", target, strerror(errno));
+        return 1;
+    }
+
+    return 0;
+}
+
+static int builtin_exit(char** argv, size_t argc, int last_status)
+{
+    if (rio_write_full(STDOUT_FILENO, END_MSG, strlen(END_MSG)) < 0)
+    {
+        rio_error("exit: write", NULL);
+    }
+
+    if (argc < 2)
+    {
+        return last_status;
+    }
+
+    char* endptr = NULL;
+    long code = strtol(argv[1], &endptr, 10);
+    if (endptr == argv[1] || *endptr != '\0')
+    {
+        return EXIT_FAILURE;
+    }
+
+    return (int)(code & 0xFF);
+}
+
+/*
+ * export                 list exported variables
+ * export NAME[=VALUE]... mark variables for the environment of commands
+ */
+static int builtin_export(shell_t* sh, char** argv, size_t argc)
+{
+    if (argc == 1)
+    {
+        char** envp = vars_envp(sh->vars);
+        for (size_t i = 0; envp != NULL && envp[i] != NULL; ++i)
+        {
+            printf("export %s\n", envp[i]);
+        }
+        fflush(stdout);
+        return 0;
+    }
+
+    int status = 0;
+    for (size_t i = 1; i < argc; ++i)
+    {
+        /* argv may point into a compiled script: look at the '=' without cutting there */
+        const char* eq = strchr(argv[i], '=');
+        int rc;
+        if (eq != NULL && vars_valid_name(argv[i], (size_t)(eq - argv[i])))
+        {
+            int slot = vars_slot(sh->vars, argv[i], (size_t)(eq - argv[i]));
+            rc = slot < 0 ? -1 : vars_slot_set(sh->vars, slot, eq + 1, true);
+        }
+        else if (vars_valid_name(argv[i], strlen(argv[i])))
+        {
+            rc = vars_export(sh->vars, argv[i]);
+        }
+        else
+        {
+            fprintf(stderr, "export: `%s': not a valid identifier\n", argv[i]);
+            status = 1;
+            continue;
+        }
+        if (rc != 0)
+        {
+            perror("export");
+            status = 1;
+        }
+    }
+
+    return status;
+}
+
+static int builtin_unset(shell_t* sh, char** argv, size_t argc)
+{
+    for (size_t i = 1; i < argc; ++i)
+    {
+        vars_unset(sh->vars, argv[i]);
+    }
+    return 0;
+}
+
+/* integer operand of test; false after reporting a malformed one */
+static bool test_number(const char* s, long long* out)
+{
+    char* end = NULL;
+    errno = 0;
+    *out = strtoll(s, &end, 10);
+    if (end == s || *end != '\0' || errno != 0)
+    {
+        fprintf(stderr, "test: %s: integer expression expected\n", s);
+        return false;
+    }
+    return true;
+}
+
+/* 0 true, 1 false, 2 error */
+static int test_expr(char** a, size_t n)
+{
+    static const char* const binary[] = {"=", "==", "!=", "-eq", "-ne", "-lt", "-le", "-gt", "-ge"};
+
+    if (n == 3)
+    {
+        size_t op = 0;
+        while (op < sizeof(binary) / sizeof(binary[0]) && strcmp(a[1], binary[op]) != 0)
+        {
+            op++;
+        }
+        if (op < 3)
+        {
+            bool equal = strcmp(a[0], a[2]) == 0;
+            return (op < 2 ? equal : !equal) ? 0 : 1;
+        }
+        if (op < sizeof(binary) / sizeof(binary[0]))
+        {
+            long long l, r;
+            if (!test_number(a[0], &l) || !test_number(a[2], &r))
+            {
+                return 2;
+            }
+            bool result = false;
+            switch (op)
+            {
+            case 3:
+                result = l == r;
+                break;
+            case 4:
+                result = l != r;
+                break;
+            case 5:
+                result = l < r;
+                break;
+            case 6:
+                result = l <= r;
+                break;
+            case 7:
+                result = l > r;
+                break;
+            default:
+                result = l >= r;
+                break;
+            }
+            return result ? 0 : 1;
+        }
+    }
+
+    if (n > 0 && strcmp(a[0], "!") == 0)
+    {
+        int r = test_expr(a + 1, n - 1);
+        return r == 2 ? 2 : !r;
+    }
+
+    if (n == 0)
+    {
+        return 1;
+    }
+    if (n == 1)
+    {
+        return a[0][0] == '\0';
+    }
+    if (n > 2)
+    {
+        fprintf(stderr, "test: too many arguments\n");
+        return 2;
+    }
+
+    const char* op = a[0];
+    struct stat st;
+    if (strcmp(op, "-z") == 0 || strcmp(op, "-n") == 0)
+    {
+        return (a[1][0] == '\0') == (op[1] == 'z') ? 0 : 1;
+    }
+    if (strcmp(op, "-r") == 0 || strcmp(op, "-w") == 0 || strcmp(op, "-x") == 0)
+    {
+        int mode = op[1] == 'r' ? R_OK : op[1] == 'w' ? W_OK : X_OK;
+        return access(a[1], mode) == 0 ? 0 : 1;
+    }
+    if (strcmp(op, "-e") != 0 && strcmp(op, "-f") != 0 && strcmp(op, "-d") != 0 && strcmp(op, "-s") != 0)
+    {
+        fprintf(stderr, "test: %s: unary operator expected\n", op);
+        return 2;
+    }
+    if (stat(a[1], &st) != 0)
+    {
+        return 1;
+    }
+    switch (op[1])
+    {
+    case 'f':
+        return S_ISREG(st.st_mode) ? 0 : 1;
+    case 'd':
+        return S_ISDIR(st.st_mode) ? 0 : 1;
+    case 's':
+        return st.st_size > 0 ? 0 : 1;
+    default:
+        return 0;
+    }
+}
+
+/*
+ * test EXPR / [ EXPR ]: string, integer and file tests with '!'.
+ *   -z -n -e -f -d -s -r -w -x    = == != -eq -ne -lt -le -gt -ge
+ */
+static int builtin_test(char** argv, size_t argc)
+{
+    if (strcmp(argv[0], "[") == 0)
+    {
+        if (strcmp(argv[argc - 1], "]") != 0)
+        {
+            fprintf(stderr, "[: missing ']'\n");
+            return 2;
+        }
+        argc--;
+    }
+    return test_expr(argv + 1, argc - 1);
+}
+
+/* optional count argument of break / continue / return / shift */
+static bool count_arg(char** argv, size_t argc, long min, long* out)
+{
+    if (argc < 2)
+    {
+        return true;
+    }
+    char* end = NULL;
+    errno = 0;
+    long n = strtol(argv[1], &end, 10);
+    if (end == argv[1] || *end != '\0' || errno != 0 || n < min)
+    {
+        fprintf(stderr, "%s: %s: numeric argument required\n", argv[0], argv[1]);
+        return false;
+    }
+    *out = n;
+    return true;
+}
+
+/* break [n] / continue [n]: leave (or continue) the n-th enclosing loop */
+static int builtin_break(shell_t* sh, char** argv, size_t argc)
+{
+    long n = 1;
+    if (!count_arg(argv, argc, 1, &n))
+    {
+        return 1;
+    }
+    if (sh->loop_depth == 0)
+    {
+        fprintf(stderr, "%s: only meaningful in a loop\n", argv[0]);
+        return 0;
+    }
+    if (n > sh->loop_depth)
+    {
+        n = sh->loop_depth;
+    }
+    if (argv[0][0] == 'b')
+    {
+        sh->breaking = (int)n;
+    }
+    else
+    {
+        sh->continuing = (int)n;
+    }
+    return 0;
+}
+
+static int builtin_return(shell_t* sh, char** argv, size_t argc)
+{
+    long n = sh->last_status;
+    if (sh->call_depth == 0)
+    {
+        fprintf(stderr, "return: can only be used in a function\n");
+        return 1;
+    }
+    if (!count_arg(argv, argc, LONG_MIN, &n))
+    {
+        n = 2;
+    }
+    sh->returning = true;
+    return (int)(n & 0xFF);
+}
+
+static int builtin_shift(shell_t* sh, char** argv, size_t argc)
+{
+    long n = 1;
+    if (!count_arg(argv, argc, 0, &n))
+    {
+        return 1;
+    }
+    if ((size_t)n > sh->nparams)
+    {
+        fprintf(stderr, "shift: shift count out of range\n");
+        return 1;
+    }
+    sh->params += n;
+    sh->nparams -= (size_t)n;
+    return 0;
+}
+
+static int builtin_env(shell_t* sh)
+{
+    char** envp = vars_envp(sh->vars);
+    if (envp == NULL)
+    {
+        perror("env");
+        return 1;
+    }
+    for (size_t i = 0; envp[i] != NULL; ++i)
+    {
+        printf("%s\n", envp[i]);
+    }
+    fflush(stdout);
+    return 0;
+}
+
+/*
+ * Apply redirections in order with open/dup2. When saved is not NULL (builtins
+ * running in the shell) the original descriptor is first copied above
+ * SAVED_FD_MIN so restore_redirections() can put it back; *applied counts the
+ * entries of saved that need restoring, also when a redirection fails.
+ * Returns 0 on success, -1 after reporting the failing redirection.
+ */
+static int apply_redirections(const redir_list_t* redirs, int* saved, size_t* applied)
+{
+    for (size_t i = 0; i < redirs->count; ++i)
+    {
+        const redirection_t* r = &redirs->items[i];
+
+        if (saved != NULL)
+        {
+            /* -1 means the fd was closed before and must be closed again */
+            saved[i] = fcntl(r->fd, F_DUPFD_CLOEXEC, SAVED_FD_MIN);
+            *applied = i + 1;
+        }
+
+        int src = -1;
+        switch (r->kind)
+        {
+        case REDIR_IN:
+            src = open(r->target, O_RDONLY | O_CLOEXEC);
+            break;
+        case REDIR_OUT:
+            src = open(r->target, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+            break;
+        case REDIR_APPEND:
+            src = open(r->target, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+            break;
+        case REDIR_DUP:
+            src = r->dup_fd;
+            break;
+        }
+
+        if (src == -1)
+        {
+            fprintf(stderr, "%s: %s\n", r->target, strerror(errno));
+            return -1;
+        }
+
+        if (src != r->fd)
+        {
+            if (dup2(src, r->fd) == -1)
+            {
+                fprintf(stderr, "%d: %s\n", r->kind == REDIR_DUP ? r->dup_fd : r->fd, strerror(errno));
+                if (r->kind != REDIR_DUP)
+                {
+                    close(src);
+                }
+                return -1;
+            }
+            if (r->kind != REDIR_DUP)
+            {
+                close(src);
+            }
+        }
+        else if (r->kind != REDIR_DUP)
+        {
+            /* opened straight onto the target fd: keep it across exec */
+            fcntl(src, F_SETFD, 0);
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Undo the first 'applied' redirections in reverse order.
+ */
+static void restore_redirections(const redir_list_t* redirs, int* saved, size_t applied)
+{
+    for (size_t i = applied; i-- > 0;)
+    {
+        int fd = redirs->items[i].fd;
+        if (saved[i] == -1)
+        {
+            close(fd);
+        }
+        else
+        {
+            dup2(saved[i], fd);
+            close(saved[i]);
+        }
+    }
+}
+
+/* $HISTFILE, or ~/.pico_history; NULL only when out of memory */
+static history_t* open_history(const vars_t* vars)
+{
+    char path[PATH_MAX];
+    const char* file = vars_get(vars, "HISTFILE");
+    const char* home = vars_get(vars, "HOME");
+
+    if (file == NULL && home != NULL)
+    {
+        int n = snprintf(path, sizeof(path), "%s/%s", home, HISTORY_FILE);
+        file = (n > 0 && (size_t)n < sizeof(path)) ? path : NULL;
+    }
+
+    /* without a usable file the history still works, just for this session */
+    return history_open(file);
+}
+
+static void setup_signals(void)
+{
+    struct sigaction sa;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+
+    sa.sa_handler = SIG_IGN;
+    sigaction(SIGINT, &sa, NULL);
+
+    sa.sa_handler = SIG_DFL;
+    sigaction(SIGQUIT, &sa, NULL);
+    sigaction(SIGTSTP, &sa, NULL);
+}
+
+/* $PICO_MEMO_MAX in bytes, with an optional K, M or G suffix */
+static size_t memo_max_bytes(const vars_t* vars)
+{
+    const char* s = vars_get(vars, "PICO_MEMO_MAX");
+    if (s == NULL || *s == '\0')
+    {
+        return MEMO_MAX_DEFAULT;
+    }
+
+    char* end = NULL;
+    unsigned long long n = strtoull(s, &end, 10);
+    switch (*end)
+    {
+    case 'G':
+        n <<= 10;
+        /* fall through */
+    case 'M':
+        n <<= 10;
+        /* fall through */
+    case 'K':
+        n <<= 10;
+        end++;
+        break;
+    default:
+        break;
+    }
+    return (end == s || *end != '\0') ? MEMO_MAX_DEFAULT : (size_t)n;
+}
+
+/*
+ * memo [-i FILE]... [-e NAME]... [--] cmd args...
+ *
+ * Run cmd through the result cache. The key covers argv, the working
+ * directory, PATH, the NAME=VALUE words in front of memo, the variables
+ * named with -e and the (dev, ino, size, mtime_ns) of every -i FILE.
+ * stdin is not part of the key: only memoize commands that do not read it.
+ */
+static int builtin_memo(shell_t* sh, char** argv, size_t argc, char** assigns, size_t nassign)
+{
+    memo_key_t* key = memo_key_new();
+    if (key == NULL)
+    {
+        perror("memo");
+        return 1;
+    }
+
+    size_t i = 1;
+    int rc = 0;
+    for (; i < argc && argv[i][0] == '-' && rc == 0; i += 2)
+    {
+        if (strcmp(argv[i], "--") == 0)
+        {
+            i++;
+            break;
+        }
+        if (i + 1 >= argc || (strcmp(argv[i], "-i") != 0 && strcmp(argv[i], "-e") != 0))
+        {
+            i = argc;
+            break;
+        }
+        if (argv[i][1] == 'i')
+        {
+            rc = memo_key_add_file(key, argv[i + 1]);
+        }
+        else
+        {
+            /* an unset variable and an empty one are different keys */
+            const char* value = vars_get(sh->vars, argv[i + 1]);
+            rc = memo_key_add(key, 'e', argv[i + 1], strlen(argv[i + 1]));
+            if (rc == 0)
+            {
+                rc = value != NULL ? memo_key_add(key, 'v', value, strlen(value)) : memo_key_add(key, 'u', "", 0);
+            }
+        }
+    }
+    if (i >= argc)
+    {
+        fprintf(stderr, "memo: usage: memo [-i file]... [-e name]... [--] command [args...]\n");
+        memo_key_free(key);
+        return 2;
+    }
+
+    char** cmd = argv + i;
+    char cwd[PATH_MAX];
+    const char* path = vars_get(sh->vars, "PATH");
+    for (size_t k = 0; cmd[k] != NULL && rc == 0; ++k)
+    {
+        rc = memo_key_add(key, 'a', cmd[k], strlen(cmd[k]));
+    }
+    for (size_t k = 0; k < nassign && rc == 0; ++k)
+    {
+        rc = memo_key_add(key, 'A', assigns[k], strlen(assigns[k]));
+    }
+    if (rc == 0 && getcwd(cwd, sizeof(cwd)) != NULL)
+    {
+        rc = memo_key_add(key, 'c', cwd, strlen(cwd));
+    }
+    if (rc == 0 && path != NULL)
+    {
+        rc = memo_key_add(key, 'p', path, strlen(path));
+    }
+    char** envp = vars_envp(sh->vars);
+    if (rc != 0 || envp == NULL)
+    {
+        perror("memo");
+        memo_key_free(key);
+        return 1;
+    }
+
+    /* $PICO_MEMO_DIR, else $XDG_CACHE_HOME/pico_memo, else ~/.cache/pico_memo */
+    char dir[PATH_MAX];
+    const char* base = vars_get(sh->vars, "XDG_CACHE_HOME");
+    const char* home = vars_get(sh->vars, "HOME");
+    int n;
+    if (vars_get(sh->vars, "PICO_MEMO_DIR") != NULL)
+    {
+        n = snprintf(dir, sizeof(dir), "%s", vars_get(sh->vars, "PICO_MEMO_DIR"));
+    }
+    else if (base != NULL)
+    {
+        n = snprintf(dir, sizeof(dir), "%s/%s", base, MEMO_DIR);
+    }
+    else
+    {
+        n = snprintf(dir, sizeof(dir), "%s/.cache/%s", home != NULL ? home : ".", MEMO_DIR);
+    }
+    if (n < 0 || (size_t)n >= sizeof(dir) || memo_dir_prepare(dir) != 0)
+    {
+        /* still run the command, it just is not cached: a truncated path must not be read or written */
+        fprintf(stderr, "memo: %s: %s\n", dir, n < 0 || (size_t)n >= sizeof(dir) ? "path too long" : strerror(errno));
+        memo_key_free(key);
+        return run_external(sh, cmd, NULL, assigns, nassign);
+    }
+
+    int status = 0;
+    if (memo_replay(dir, key, &status) == 1)
+    {
+        memo_key_free(key);
+        return status;
+    }
+
+    /* miss: run with stdout and stderr on pipes so they can be recorded */
+    int out[2], err[2];
+    if (pipe(out) == -1)
+    {
+        perror("memo: pipe");
+        memo_key_free(key);
+        return 1;
+    }
+    if (pipe(err) == -1)
+    {
+        perror("memo: pipe");
+        close(out[0]);
+        close(out[1]);
+        memo_key_free(key);
+        return 1;
+    }
+    fflush(stdout);
+
+    const launch_attrs_t* launch = prepare_launch(sh);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        dup2(out[1], STDOUT_FILENO);
+        dup2(err[1], STDERR_FILENO);
+        close(out[0]);
+        close(out[1]);
+        close(err[0]);
+        close(err[1]);
+        if (launch_apply(launch) != 0)
+        {
+            _exit(1);
+        }
+        exec_command(cmd, envp, assigns, nassign);
+    }
+    close(out[1]);
+    close(err[1]);
+    if (pid == -1)
+    {
+        perror("memo: fork");
+        close(out[0]);
+        close(err[0]);
+        memo_key_free(key);
+        return 1;
+    }
+
+    status = memo_record(dir, key, out[0], err[0], pid, memo_max_bytes(sh->vars));
+    memo_key_free(key);
+    return status;
 }
@@ -0,0 +1,351 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "pico_vars.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define VARS_INITIAL_CAP 64 /* power of two */
+
+typedef struct
+{
+    char* key;        /* interned name */
+    uint32_t hash;
+    char* value;      /* NULL while unset */
+    size_t value_cap; /* bytes allocated for value, reused by later assignments */
+    char* env_str;    /* cached "NAME=VALUE", rebuilt after a change */
+    bool exported;
+} var_entry_t;
+
+struct vars
+{
+    var_entry_t* entries; /* indexed by slot, never reordered */
+    size_t count;
+    size_t entries_cap;
+    uint32_t* table;  /* open addressing: slot + 1, 0 for an empty bucket */
+    size_t cap;       /* buckets, always a power of two */
+    char** envp;
+    size_t envp_cap;
+    bool env_dirty;   /* an exported variable changed since the last vars_envp() */
+};
+
+/* FNV-1a */
+static uint32_t hash_name(const char* s, size_t len)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; ++i)
+    {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/* linear probing: returns the bucket holding name, or the empty bucket where it would go */
+static uint32_t* find_bucket(const vars_t* vars, const char* name, size_t len, uint32_t hash)
+{
+    size_t mask = vars->cap - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask)
+    {
+        uint32_t* b = &vars->table[i];
+        if (*b == 0)
+        {
+            return b;
+        }
+        const var_entry_t* e = &vars->entries[*b - 1];
+        if (e->hash == hash && strncmp(e->key, name, len) == 0 && e->key[len] == '\0')
+        {
+            return b;
+        }
+    }
+}
+
+static int grow(vars_t* vars)
+{
+    size_t cap = vars->cap * 2;
+    uint32_t* table = calloc(cap, sizeof(*table));
+    if (table == NULL)
+    {
+        return -1;
+    }
+
+    /* only the index moves, slots keep their numbers */
+    for (size_t slot = 0; slot < vars->count; ++slot)
+    {
+        size_t mask = cap - 1;
+        size_t i = vars->entries[slot].hash & mask;
+        while (table[i] != 0)
+        {
+            i = (i + 1) & mask;
+        }
+        table[i] = (uint32_t)slot + 1;
+    }
+
+    free(vars->table);
+    vars->table = table;
+    vars->cap = cap;
+    return 0;
+}
+
+int vars_slot(vars_t* vars, const char* name, size_t len)
+{
+    uint32_t hash = hash_name(name, len);
+    uint32_t* b = find_bucket(vars, name, len, hash);
+    if (*b != 0)
+    {
+        return (int)*b - 1;
+    }
+
+    /* keep the load factor under 0.7 */
+    if ((vars->count + 1) * 10 > vars->cap * 7)
+    {
+        if (grow(vars) != 0)
+        {
+            return -1;
+        }
+        b = find_bucket(vars, name, len, hash);
+    }
+    if (vars->count == vars->entries_cap)
+    {
+        size_t cap = vars->entries_cap ? vars->entries_cap * 2 : VARS_INITIAL_CAP;
+        var_entry_t* entries = realloc(vars->entries, cap * sizeof(*entries));
+        if (entries == NULL)
+        {
+            return -1;
+        }
+        vars->entries = entries;
+        vars->entries_cap = cap;
+    }
+
+    char* key = malloc(len + 1);
+    if (key == NULL)
+    {
+        return -1;
+    }
+    memcpy(key, name, len);
+    key[len] = '\0';
+
+    var_entry_t* e = &vars->entries[vars->count];
+    memset(e, 0, sizeof(*e));
+    e->key = key;
+    e->hash = hash;
+    *b = (uint32_t)vars->count + 1;
+    return (int)vars->count++;
+}
+
+static const var_entry_t* lookup(const vars_t* vars, const char* name, size_t len)
+{
+    uint32_t b = *find_bucket(vars, name, len, hash_name(name, len));
+    return (b != 0 && vars->entries[b - 1].value != NULL) ? &vars->entries[b - 1] : NULL;
+}
+
+vars_t* vars_new(char** envp)
+{
+    vars_t* vars = calloc(1, sizeof(*vars));
+    if (vars == NULL)
+    {
+        return NULL;
+    }
+    vars->cap = VARS_INITIAL_CAP;
+    vars->table = calloc(vars->cap, sizeof(*vars->table));
+    if (vars->table == NULL)
+    {
+        free(vars);
+        return NULL;
+    }
+    vars->env_dirty = true;
+
+    for (char** p = envp; p != NULL && *p != NULL; ++p)
+    {
+        const char* eq = strchr(*p, '=');
+        if (eq == NULL)
+        {
+            continue;
+        }
+        int slot = vars_slot(vars, *p, (size_t)(eq - *p));
+        if (slot < 0 || vars_slot_set(vars, slot, eq + 1, true) != 0)
+        {
+            vars_free(vars);
+            return NULL;
+        }
+    }
+
+    return vars;
+}
+
+void vars_free(vars_t* vars)
+{
+    if (vars == NULL)
+    {
+        return;
+    }
+    for (size_t i = 0; i < vars->count; ++i)
+    {
+        free(vars->entries[i].key);
+        free(vars->entries[i].value);
+        free(vars->entries[i].env_str);
+    }
+    free(vars->entries);
+    free(vars->table);
+    free(vars->envp);
+    free(vars);
+}
+
+const char* vars_get(const vars_t* vars, const char* name)
+{
+    const var_entry_t* e = lookup(vars, name, strlen(name));
+    return e != NULL ? e->value : NULL;
+}
+
+const char* vars_slot_get(const vars_t* vars, int slot)
+{
+    return vars->entries[slot].value;
+}
+
+int vars_slot_set(vars_t* vars, int slot, const char* value, bool export)
+{
+    var_entry_t* e = &vars->entries[slot];
+    size_t len = strlen(value);
+    if (len + 1 > e->value_cap)
+    {
+        /* loop counters and the like are rewritten in place once the buffer fits */
+        size_t cap = len + 1 < 16 ? 16 : len + 1;
+        char* buf = realloc(e->value, cap);
+        if (buf == NULL)
+        {
+            return -1;
+        }
+        e->value = buf;
+        e->value_cap = cap;
+    }
+    memcpy(e->value, value, len + 1);
+    e->exported = e->exported || export;
+    if (e->exported)
+    {
+        free(e->env_str);
+        e->env_str = NULL;
+        vars->env_dirty = true;
+    }
+    return 0;
+}
+
+int vars_set(vars_t* vars, const char* name, const char* value, bool export)
+{
+    int slot = vars_slot(vars, name, strlen(name));
+    return slot < 0 ? -1 : vars_slot_set(vars, slot, value, export);
+}
+
+int vars_export(vars_t* vars, const char* name)
+{
+    int slot = vars_slot(vars, name, strlen(name));
+    if (slot < 0)
+    {
+        return -1;
+    }
+    var_entry_t* e = &vars->entries[slot];
+    if (!e->exported)
+    {
+        e->exported = true;
+        vars->env_dirty = vars->env_dirty || e->value != NULL;
+    }
+    return 0;
+}
+
+void vars_unset(vars_t* vars, const char* name)
+{
+    size_t len = strlen(name);
+    uint32_t b = *find_bucket(vars, name, len, hash_name(name, len));
+    if (b == 0)
+    {
+        return;
+    }
+
+    /* the slot stays, so compiled scripts holding it and later assignments keep working */
+    var_entry_t* e = &vars->entries[b - 1];
+    vars->env_dirty = vars->env_dirty || (e->exported && e->value != NULL);
+    free(e->value);
+    free(e->env_str);
+    e->value = NULL;
+    e->value_cap = 0;
+    e->env_str = NULL;
+    e->exported = false;
+}
+
+char** vars_envp(vars_t* vars)
+{
+    if (!vars->env_dirty && vars->envp != NULL)
+    {
+        return vars->envp;
+    }
+
+    size_t count = 0;
+    for (size_t i = 0; i < vars->count; ++i)
+    {
+        count += vars->entries[i].exported && vars->entries[i].value != NULL;
+    }
+    if (count + 1 > vars->envp_cap)
+    {
+        char** envp = realloc(vars->envp, (count + 1) * sizeof(*envp));
+        if (envp == NULL)
+        {
+            return NULL;
+        }
+        vars->envp = envp;
+        vars->envp_cap = count + 1;
+    }
+
+    size_t n = 0;
+    for (size_t i = 0; i < vars->count; ++i)
+    {
+        var_entry_t* e = &vars->entries[i];
+        if (!e->exported || e->value == NULL)
+        {
+            continue;
+        }
+        if (e->env_str == NULL)
+        {
+            size_t klen = strlen(e->key), vlen = strlen(e->value);
+            e->env_str = malloc(klen + vlen + 2);
+            if (e->env_str == NULL)
+            {
+                return NULL;
+            }
+            memcpy(e->env_str, e->key, klen);
+            e->env_str[klen] = '=';
+            memcpy(e->env_str + klen + 1, e->value, vlen + 1);
+        }
+        vars->envp[n++] = e->env_str;
+    }
+    vars->envp[n] = NULL;
+    vars->env_dirty = false;
+    return vars->envp;
+}
+
+static bool is_name_start(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+static bool is_name_char(char c)
+{
+    return is_name_start(c) || (c >= '0' && c <= '9');
+}
+
+bool vars_valid_name(const char* s, size_t len)
+{
+    if (len == 0 || !is_name_start(s[0]))
+    {
+        return false;
+    }
+    for (size_t i = 1; i < len; ++i)
+    {
+        if (!is_name_char(s[i]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
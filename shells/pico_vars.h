@@ -0,0 +1,43 @@
+#ifndef PICO_VARS_H
+#define PICO_VARS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Shell and environment variables in one open-addressing hash table.
+ * Names are interned into numbered slots: once a name has been seen its
+ * slot stays valid for the life of the table ("unset" only drops the
+ * value), so compiled scripts resolve their variables to slots once and
+ * skip the hash lookup afterwards. The envp vector handed to exec is
+ * rebuilt lazily, only after an exported variable changed.
+ */
+typedef struct vars vars_t;
+
+/* create the table and import every entry of envp as an exported variable */
+vars_t* vars_new(char** envp);
+void vars_free(vars_t* vars);
+
+/* NULL if the variable is not set */
+const char* vars_get(const vars_t* vars, const char* name);
+
+/*
+ * Set a variable; it becomes exported when export is true, otherwise it
+ * keeps its current export flag. Returns -1 when out of memory.
+ */
+int vars_set(vars_t* vars, const char* name, const char* value, bool export);
+int vars_export(vars_t* vars, const char* name);
+void vars_unset(vars_t* vars, const char* name);
+
+/* slot of name[0..len), interning it if needed; -1 when out of memory */
+int vars_slot(vars_t* vars, const char* name, size_t len);
+const char* vars_slot_get(const vars_t* vars, int slot);
+int vars_slot_set(vars_t* vars, int slot, const char* value, bool export);
+
+/* "NAME=VALUE" vector of the exported variables, owned by vars */
+char** vars_envp(vars_t* vars);
+
+/* true if s[0..len) is a valid variable name */
+bool vars_valid_name(const char* s, size_t len);
+
+#endif /* PICO_VARS_H */